@@ -1,13 +1,22 @@
 #include "process/ImgProc.h"
+#include "process/DetectionLogReader.h"
+
+#include <string>
 
 using Tk = ImgProc::ImgProcToolkit;
 
 /// <summary>
 /// 実行時間計測, 結果出力
+/// "--dump-log (検出ログのパス)"を渡すと処理は行わず, 検出ログをCSVとして標準出力に出す
 /// </summary>
 /// <returns>テンプレ</returns>
-int main()
+int main(int argc, char* argv[])
 {
+	/* 検出ログの読み出し */
+	if ((argc >= 3) && (std::string(argv[1]) == "--dump-log"))
+		return ImgProc::DetectionLogReader::DumpCsv(argv[2], std::cout) ? 0 : 1;
+	/* end */
+
 	Tk::SetResourcesAndParams();
 	//Tk::ShowResourcesAndParams();
 	Tk::ImgProcToolkit::RunImageProcedure();
@@ -1,73 +1,312 @@
 #include "BackImageHandle.h"
 
-using Tk = ImgProc::ImgProcToolkit;
+#include <opencv2/core/hal/intrin.hpp>
 
 namespace ImgProc
 {
-	Image CarsExtractor::BackImageHandle::sSubtracted;
-	Image CarsExtractor::BackImageHandle::sBackImgFloat;
-	Image CarsExtractor::BackImageHandle::sFrameFloat;
-	Image CarsExtractor::BackImageHandle::sMoveCarsMask;
-	bool CarsExtractor::BackImageHandle::sIsExistPreBackImg = false;
-
+	/// <summary>
+	/// 初期背景画像を作成. スナップショットが開いていればその背景モデルから再開し, 初期背景画像の作成に使うフレームを読まない
+	/// </summary>
 	void CarsExtractor::BackImageHandle::CreatePreBackImg()
 	{
-		auto& refFrame = Tk::GetFrame();
-		auto& refBackImg = Tk::GetBackImg();
-		auto& refFrameCount = Tk::GetFrameCount();
-		const auto& crefParams = Tk::GetBackImgHandleParams();
+		Image frame;
+		auto& refBackImg = mContext.GetBackImg();
+		auto& refFrameCount = mContext.GetFrameCount();
+		const auto& crefParams = mContext.GetBackImgHandleParams();
 
-		auto& videoCapture = ImgProcToolkit::GetVideoCapture();
 		auto fgbg = cv::createBackgroundSubtractorMOG2();
+		fgbg->setHistory(crefParams.warmupFrames); // 初期背景画像の作成に使うフレーム数
+
+		mContext.ReadFrame(frame);
+		frame.convertTo(mBackImgFloat, CV_32FC3);
+		mBackImgFloat.setTo(0.0);
+		mContext.ReleaseFrame();
+
+		/* スナップショットから再開, 処理開始フレームは進めない */
+		const auto& crefSnapshot = mContext.GetSnapshot();
+		if (crefSnapshot.IsOpened())
+		{
+			mBackImgFixed = crefSnapshot.GetBackImgFixed(); // コピーオンライトのマップを直接更新する
+			mBackImgFixed.convertTo(refBackImg, CV_8UC3, 1.0 / 256);
+			mBackImgFloat.release();
+			mIsExistPreBackImg = true;
+			return;
+		}
+		/* end */
 
-		videoCapture >> refFrame;
-		refFrame.convertTo(sBackImgFloat, CV_32FC3);
-		sBackImgFloat.setTo(0.0);
+		if (crefParams.warmupMode == WarmupMode::MEDIAN)
+		{
+			CreateMedianBackImg();
+			return;
+		}
 
 		uint64_t count = 0;
 		for (int count = 1; count <= fgbg->getHistory(); count++)
 		while (count <= fgbg->getHistory())
 		{
-			refFrameCount++;
-			videoCapture >> refFrame;
-			if (refFrame.empty())
+			if (!mContext.ReadFrame(frame)) // refFrameCountもここで更新される
 				break;
 
-			if (refFrameCount < Tk::GetStartFrame())
+			if (refFrameCount < mContext.GetStartFrame())
+			{
+				mContext.ReleaseFrame();
 				continue;
-			else if (refFrameCount > Tk::GetEndFrame())
+			}
+			else if (refFrameCount > mContext.GetEndFrame())
+			{
+				mContext.ReleaseFrame();
 				break;
+			}
 
-			refFrame.convertTo(sFrameFloat, CV_32FC3);
+			frame.convertTo(mFrameFloat, CV_32FC3);
 
-			fgbg->apply(refFrame, sMoveCarsMask);
-			binarizeImage(sMoveCarsMask);
-			cv::bitwise_not(sMoveCarsMask, sMoveCarsMask);
-			cv::accumulateWeighted(sFrameFloat, sBackImgFloat, crefParams.blendAlpha, sMoveCarsMask);
+			fgbg->apply(frame, mMoveCarsMask);
+			binarizeImage(mMoveCarsMask);
+			cv::bitwise_not(mMoveCarsMask, mMoveCarsMask);
+			cv::accumulateWeighted(mFrameFloat, mBackImgFloat, crefParams.blendAlpha, mMoveCarsMask);
+			mContext.ReleaseFrame();
 
 			std::cout << refFrameCount << std::endl;
 			count++;
 		}
 
-		sBackImgFloat.convertTo(refBackImg, CV_8UC3);
-		sIsExistPreBackImg = true;
-		Tk::GetStartFrame() += fgbg->getHistory();
+		FinishPreBackImg();
+		mContext.GetStartFrame() += fgbg->getHistory();
 	}
 
 
-	void CarsExtractor::BackImageHandle::UpdateBackground()
+	/// <summary>
+	/// warmupStrideおきに抜き出したフレームの画素ごとの時間方向メディアンから初期背景画像を作成
+	/// 入力を読み直せればフレームは並列に読み, メディアンは行の帯に分けて並列に求める
+	/// </summary>
+	void CarsExtractor::BackImageHandle::CreateMedianBackImg()
 	{
-		const auto& crefParams = Tk::GetBackImgHandleParams();
-		const auto& crefFrame = Tk::GetFrame();
-		const auto& refBackImg = Tk::GetBackImg();
-		cv::absdiff(crefFrame, refBackImg, sSubtracted); // 差分を取ってからその絶対値を画素値として格納
-		binarizeImage(sSubtracted);
-		
-		/* 背景更新処理 */
-		cv::bitwise_not(sSubtracted, sMoveCarsMask);
-		crefFrame.convertTo(sFrameFloat, CV_32FC3);
-		cv::accumulateWeighted(sFrameFloat, sBackImgFloat, crefParams.blendAlpha, sMoveCarsMask);
-		sBackImgFloat.convertTo(refBackImg, CV_8UC3);
+		const auto& crefParams = mContext.GetBackImgHandleParams();
+		const auto startFrame = mContext.GetStartFrame();
+		const auto warmupEnd = std::min<uint64_t>(startFrame + crefParams.warmupFrames, mContext.GetEndFrame() + 1); // この直前まで使う
+
+		/* フレームの抜き出し */
+		std::vector<Image> samples;
+		if (mContext.IsWarmupReadSeparately())
+		{
+			// デコード先読みスレッドはこの範囲を読み飛ばしている
+			std::vector<uint64_t> frameCounts;
+			for (auto frameCount = startFrame; frameCount < warmupEnd; frameCount += crefParams.warmupStride)
+				frameCounts.push_back(frameCount);
+			mContext.ReadSampledFrames(frameCounts, samples);
+		}
+		else
+		{
+			// 生フレーム入力は読み直せないので, 先読みスレッドから順に受け取り抜き出すフレームだけ複製する
+			Image frame;
+			const auto& crefFrameCount = mContext.GetFrameCount();
+			for (auto count = startFrame; count < warmupEnd; count++)
+			{
+				if (!mContext.ReadFrame(frame))
+					break;
+				if ((crefFrameCount - startFrame) % crefParams.warmupStride == 0)
+					samples.push_back(frame.clone());
+				mContext.ReleaseFrame();
+			}
+		}
+		/* end */
+
+		/* 画素ごとの時間方向メディアン, 行の帯ごとに並列に求める */
+		if (samples.empty())
+		{
+			std::cout << "no frames to create the background image." << std::endl;
+		}
+		else
+		{
+			const auto samplesNum = samples.size();
+			const auto rowBytes = static_cast<size_t>(samples[0].cols) * samples[0].channels();
+			Image median(samples[0].size(), CV_8UC3);
+			cv::parallel_for_(cv::Range(0, median.rows), [&](const cv::Range& range)
+			{
+				std::vector<uchar> values(samplesNum);
+				std::vector<const uchar*> rows(samplesNum);
+				for (int y = range.start; y < range.end; y++)
+				{
+					for (size_t idx = 0; idx < samplesNum; idx++)
+						rows[idx] = samples[idx].ptr<uchar>(y);
+					auto dst = median.ptr<uchar>(y);
+					for (size_t x = 0; x < rowBytes; x++)
+					{
+						for (size_t idx = 0; idx < samplesNum; idx++)
+							values[idx] = rows[idx][x];
+						std::nth_element(values.begin(), values.begin() + samplesNum / 2, values.end());
+						dst[x] = values[samplesNum / 2];
+					}
+				}
+			}, static_cast<double>(mContext.GetThreadsNum()));
+			median.convertTo(mBackImgFloat, CV_32FC3);
+			std::cout << "background image: median of " << samplesNum << " frames" << std::endl;
+		}
+		/* end */
+
+		FinishPreBackImg();
+		mContext.GetStartFrame() += crefParams.warmupFrames;
+	}
+
+	/// <summary>
+	/// 初期背景画像の作成を終える. 浮動小数点の背景モデルを固定小数点に移し, 作成中のみ使うバッファを解放する
+	/// </summary>
+	void CarsExtractor::BackImageHandle::FinishPreBackImg()
+	{
+		mBackImgFloat.convertTo(mBackImgFixed, CV_16UC3, 256.0);
+		mBackImgFloat.convertTo(mContext.GetBackImg(), CV_8UC3);
+		mBackImgFloat.release();
+		mFrameFloat.release();
+		mMoveCarsMask.release();
+		mIsExistPreBackImg = true;
+	}
+
+	/// <summary>
+	/// 背景差分と背景モデルの更新
+	/// 差分のグレースケール化とヒストグラム, 二値化と背景モデルの更新と8bit版の書き出しをそれぞれ1回の走査で行う
+	/// 大津の閾値は差分全体のヒストグラムが揃うまで決まらないので, 走査は2回になる
+	/// </summary>
+	/// <param name="frame">入力フレーム</param>
+	/// <param name="backImg">更新後の背景画像の格納先, 追跡中の前フレームの背景画像とは別のバッファを渡す</param>
+	void CarsExtractor::BackImageHandle::UpdateBackground(const Image& frame, Image& backImg)
+	{
+		const auto& crefParams = mContext.GetBackImgHandleParams();
+		const auto& crefRoi = mContext.GetProcessRoi();
+		auto& refBackImg = mContext.GetBackImg();
+		const auto frameRoi = frame(crefRoi);
+		const auto prevBackRoi = refBackImg(crefRoi);
+		auto backImgFixedRoi = mBackImgFixed(crefRoi);
+		mSubtracted.create(crefRoi.size(), CV_8UC1);
+
+		/* 1回目: 差分の絶対値をグレースケール化して格納し, ヒストグラムを取る. 係数はcv::COLOR_BGR2GRAYの8bit版と同じ */
+		constexpr uint32_t B2Y = 1868, G2Y = 9617, R2Y = 4899, GRAY_SHIFT = 14;
+		uint32_t hist[256] = {};
+		for (int y = 0; y < crefRoi.height; y++)
+		{
+			const auto src = frameRoi.ptr<uchar>(y);
+			const auto back = prevBackRoi.ptr<uchar>(y);
+			auto dst = mSubtracted.ptr<uchar>(y);
+			int x = 0;
+#if CV_SIMD
+			constexpr int lanes = cv::v_uint8::nlanes;
+			const auto vB2Y = cv::vx_setall_u32(B2Y), vG2Y = cv::vx_setall_u32(G2Y), vR2Y = cv::vx_setall_u32(R2Y);
+			const auto vHalf = cv::vx_setall_u32(1u << (GRAY_SHIFT - 1));
+			auto toGray = [&](const cv::v_uint16& b, const cv::v_uint16& g, const cv::v_uint16& r)
+			{
+				cv::v_uint32 b0, b1, g0, g1, r0, r1;
+				cv::v_expand(b, b0, b1);
+				cv::v_expand(g, g0, g1);
+				cv::v_expand(r, r0, r1);
+				return cv::v_pack((b0 * vB2Y + g0 * vG2Y + r0 * vR2Y + vHalf) >> GRAY_SHIFT, (b1 * vB2Y + g1 * vG2Y + r1 * vR2Y + vHalf) >> GRAY_SHIFT);
+			};
+			for (; x <= crefRoi.width - lanes; x += lanes)
+			{
+				cv::v_uint8 fB, fG, fR, bB, bG, bR;
+				cv::v_load_deinterleave(src + x * 3, fB, fG, fR);
+				cv::v_load_deinterleave(back + x * 3, bB, bG, bR);
+				cv::v_uint16 dB0, dB1, dG0, dG1, dR0, dR1;
+				cv::v_expand(cv::v_absdiff(fB, bB), dB0, dB1);
+				cv::v_expand(cv::v_absdiff(fG, bG), dG0, dG1);
+				cv::v_expand(cv::v_absdiff(fR, bR), dR0, dR1);
+				cv::v_store(dst + x, cv::v_pack(toGray(dB0, dG0, dR0), toGray(dB1, dG1, dR1)));
+			}
+#endif
+			for (; x < crefRoi.width; x++)
+			{
+				const uint32_t dB = std::abs(src[x * 3] - back[x * 3]);
+				const uint32_t dG = std::abs(src[x * 3 + 1] - back[x * 3 + 1]);
+				const uint32_t dR = std::abs(src[x * 3 + 2] - back[x * 3 + 2]);
+				dst[x] = static_cast<uchar>((dB * B2Y + dG * G2Y + dR * R2Y + (1u << (GRAY_SHIFT - 1))) >> GRAY_SHIFT);
+			}
+			for (x = 0; x < crefRoi.width; x++) // ヒストグラムはベクトル化できないので, キャッシュに残っている行を続けて数える
+				hist[dst[x]]++;
+		}
+		const auto thr = calcOtsuThreshold(hist, static_cast<uint64_t>(crefRoi.area()));
+		/* end */
+
+		/* 2回目: 二値化, 動体でない画素のみ背景モデルを混合し, 8bit版を書き出す. 処理範囲外の背景モデルは初期背景画像のまま */
+		// 混合率はQ0.15, 差(最大255 << 8)との積が32bitに収まる
+		const auto alpha = static_cast<int32_t>(std::lround(std::clamp(crefParams.blendAlpha, 0.0, 1.0) * (1 << 15)));
+		if (backImg.size() != refBackImg.size())
+			refBackImg.copyTo(backImg); // 初回のみ処理範囲外も埋める. 以降は処理範囲外が変わらないので処理範囲のみ書く
+		auto backImgRoi = backImg(crefRoi);
+		for (int y = 0; y < crefRoi.height; y++)
+		{
+			const auto src = frameRoi.ptr<uchar>(y);
+			auto subtracted = mSubtracted.ptr<uchar>(y);
+			auto model = backImgFixedRoi.ptr<uint16_t>(y);
+			auto dst = backImgRoi.ptr<uchar>(y);
+			int x = 0;
+#if CV_SIMD
+			constexpr int lanes = cv::v_uint8::nlanes;
+			constexpr int halfLanes = cv::v_uint16::nlanes;
+			const auto vThr8 = cv::vx_setall_u8(static_cast<uchar>(thr));
+			const auto vThr16 = cv::vx_setall_u16(static_cast<ushort>(thr));
+			const auto vAlpha = cv::vx_setall_s32(alpha), vRound = cv::vx_setall_s32(1 << 14);
+			const auto vExportHalf = cv::vx_setall_u16(128);
+			auto blend = [&](const cv::v_uint16& bg, const cv::v_uint16& f, const cv::v_uint16& isStill)
+			{
+				cv::v_uint32 bg0, bg1, t0, t1;
+				cv::v_expand(bg, bg0, bg1);
+				cv::v_expand(f << 8, t0, t1);
+				const auto sBg0 = cv::v_reinterpret_as_s32(bg0), sBg1 = cv::v_reinterpret_as_s32(bg1);
+				const auto next0 = sBg0 + (((cv::v_reinterpret_as_s32(t0) - sBg0) * vAlpha + vRound) >> 15);
+				const auto next1 = sBg1 + (((cv::v_reinterpret_as_s32(t1) - sBg1) * vAlpha + vRound) >> 15);
+				return cv::v_select(isStill, cv::v_pack_u(next0, next1), bg);
+			};
+			for (; x <= crefRoi.width - lanes; x += lanes)
+			{
+				const auto gray = cv::vx_load(subtracted + x);
+				cv::v_store(subtracted + x, cv::v_select(gray > vThr8, cv::vx_setall_u8(255), cv::vx_setzero_u8()));
+
+				cv::v_uint16 gray0, gray1;
+				cv::v_expand(gray, gray0, gray1);
+				cv::v_uint8 fB, fG, fR;
+				cv::v_load_deinterleave(src + x * 3, fB, fG, fR);
+				cv::v_uint16 fB0, fB1, fG0, fG1, fR0, fR1;
+				cv::v_expand(fB, fB0, fB1);
+				cv::v_expand(fG, fG0, fG1);
+				cv::v_expand(fR, fR0, fR1);
+
+				cv::v_uint16 mB0, mG0, mR0, mB1, mG1, mR1;
+				cv::v_load_deinterleave(model + x * 3, mB0, mG0, mR0);
+				cv::v_load_deinterleave(model + (x + halfLanes) * 3, mB1, mG1, mR1);
+				const auto isStill0 = gray0 <= vThr16, isStill1 = gray1 <= vThr16;
+				mB0 = blend(mB0, fB0, isStill0);
+				mG0 = blend(mG0, fG0, isStill0);
+				mR0 = blend(mR0, fR0, isStill0);
+				mB1 = blend(mB1, fB1, isStill1);
+				mG1 = blend(mG1, fG1, isStill1);
+				mR1 = blend(mR1, fR1, isStill1);
+				cv::v_store_interleave(model + x * 3, mB0, mG0, mR0);
+				cv::v_store_interleave(model + (x + halfLanes) * 3, mB1, mG1, mR1);
+
+				cv::v_store_interleave(dst + x * 3,
+					cv::v_pack((mB0 + vExportHalf) >> 8, (mB1 + vExportHalf) >> 8),
+					cv::v_pack((mG0 + vExportHalf) >> 8, (mG1 + vExportHalf) >> 8),
+					cv::v_pack((mR0 + vExportHalf) >> 8, (mR1 + vExportHalf) >> 8));
+			}
+#endif
+			for (; x < crefRoi.width; x++)
+			{
+				const auto isStill = subtracted[x] <= thr;
+				subtracted[x] = isStill ? 0 : 255;
+				for (int c = 0; c < 3; c++)
+				{
+					auto& refModel = model[x * 3 + c];
+					if (isStill)
+					{
+						const auto bg = static_cast<int32_t>(refModel);
+						refModel = static_cast<uint16_t>(bg + ((((static_cast<int32_t>(src[x * 3 + c]) << 8) - bg) * alpha + (1 << 14)) >> 15));
+					}
+					dst[x * 3 + c] = static_cast<uchar>((refModel + 128) >> 8);
+				}
+			}
+		}
+#if CV_SIMD
+		cv::vx_cleanup();
+#endif
+		refBackImg = backImg; // 次フレームの差分はこのバッファと取る. ヘッダのみのシャローコピー
 		/* end */
 	}
 };
\ No newline at end of file
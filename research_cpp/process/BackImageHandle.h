@@ -1,20 +1,50 @@
 #pragma once
 
 #include "CarsExtractor.h"
+#include "PipelineContext.h"
 
 class ImgProc::CarsExtractor::BackImageHandle
 {
 private:
-	static Image sSubtracted; // グレースケール二値画像
-	static Image sBackImgFloat;
-	static Image sFrameFloat;
-	static Image sMoveCarsMask; // グレースケール二値画像
-	static bool sIsExistPreBackImg;
+	PipelineContext& mContext; // 実行コンテキスト
+	Image mSubtracted; // グレースケール二値画像
+	Image mBackImgFixed; // 背景モデル, CV_16UC3でQ8.8の固定小数点
+	Image mBackImgFloat; // 初期背景画像の作成中の背景モデル
+	Image mFrameFloat; // 初期背景画像の作成中のみ使う
+	Image mMoveCarsMask; // グレースケール二値画像, 初期背景画像の作成中のみ使う
+	bool mIsExistPreBackImg = false;
 
 public:
-	static Image& GetSubtracted() { return sSubtracted; }
+	explicit BackImageHandle(PipelineContext& context) : mContext(context) {}
 
-	static void CreatePreBackImg();
-	static void UpdateBackground();
-};
+	Image& GetSubtracted() { return mSubtracted; }
+	const Image& GetBackImgFixed() const { return mBackImgFixed; }
 
+	/// <summary>
+	/// 初期背景画像を作成. スナップショットが開いていればその背景モデルから再開し, 初期背景画像の作成に使うフレームを読まない
+	/// </summary>
+	void CreatePreBackImg();
+
+private:
+	/// <summary>
+	/// warmupStrideおきに抜き出したフレームの画素ごとの時間方向メディアンから初期背景画像を作成
+	/// 入力を読み直せればフレームは並列に読み, メディアンは行の帯に分けて並列に求める
+	/// </summary>
+	void CreateMedianBackImg();
+
+	/// <summary>
+	/// 初期背景画像の作成を終える. 浮動小数点の背景モデルを固定小数点に移し, 作成中のみ使うバッファを解放する
+	/// </summary>
+	void FinishPreBackImg();
+
+public:
+
+	/// <summary>
+	/// 背景差分と背景モデルの更新
+	/// 差分のグレースケール化とヒストグラム, 二値化と背景モデルの更新と8bit版の書き出しをそれぞれ1回の走査で行う
+	/// 大津の閾値は差分全体のヒストグラムが揃うまで決まらないので, 走査は2回になる
+	/// </summary>
+	/// <param name="frame">入力フレーム</param>
+	/// <param name="backImg">更新後の背景画像の格納先, 追跡中の前フレームの背景画像とは別のバッファを渡す</param>
+	void UpdateBackground(const Image& frame, Image& backImg);
+};
\ No newline at end of file
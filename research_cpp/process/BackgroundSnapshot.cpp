@@ -0,0 +1,206 @@
+#include "BackgroundSnapshot.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+namespace ImgProc
+{
+	/// <summary>
+	/// マスク画像の最終更新時刻のうち最新のものを取得. マスク画像を読み込むより十分速い
+	/// </summary>
+	/// <param name="roadMaskPath">マスク画像（全体）パス</param>
+	/// <param name="roadMasksBasePath">道路マスク画像ベースパス</param>
+	/// <returns>最終更新時刻, マスク画像がなければ0</returns>
+	int64_t BackgroundSnapshot::GetMasksWriteTime(const std::string& roadMaskPath, const std::string& roadMasksBasePath)
+	{
+		std::error_code error;
+		int64_t latest = 0;
+		auto update = [&](const std::string& path)
+		{
+			const auto writeTime = std::filesystem::last_write_time(path, error);
+			if (error)
+				return false;
+			latest = std::max<int64_t>(latest, static_cast<int64_t>(writeTime.time_since_epoch().count()));
+			return true;
+		};
+
+		update(roadMaskPath);
+		for (size_t idx = 0; update(roadMasksBasePath + std::to_string(idx) + ".png"); idx++); // CreateImageResourceと同じく連番が途切れるまで
+		return latest;
+	}
+
+	/// <summary>
+	/// スナップショットをメモリマップする. 古ければ理由を出力して開かない
+	/// </summary>
+	/// <param name="path">スナップショットのパス</param>
+	/// <param name="cameraId">カメラID</param>
+	/// <param name="frameSize">入力のフレームサイズ</param>
+	/// <param name="masksWriteTime">マスク画像の最終更新時刻</param>
+	/// <param name="backImgHandleParams">背景処理パラメータ</param>
+	/// <returns>開けないか古ければfalse</returns>
+	bool BackgroundSnapshot::Open(const std::string& path, const std::string& cameraId, const cv::Size& frameSize, const int64_t& masksWriteTime,
+		const BackImgHandleParams& backImgHandleParams)
+	{
+		Close();
+
+		/* 画像は必要になった時点で読み込まれればよいので, 先読みは指定しない */
+		if (!mFile.Open(path, false))
+			return false;
+		if (mFile.GetSize() < sizeof(Header))
+		{
+			Close();
+			return false;
+		}
+		/* end */
+
+		/* ヘッダ確認 */
+		std::memcpy(&mHeader, mFile.GetData(), sizeof(Header));
+		const auto imgBytes = static_cast<uint64_t>(mHeader.width) * mHeader.height;
+		const auto isValid = (std::memcmp(mHeader.magic, MAGIC, sizeof(MAGIC)) == 0)
+			&& (mHeader.version == VERSION)
+			&& (mHeader.roadMasksNum > 0)
+			&& (mHeader.roadMaskStride >= imgBytes)
+			&& (mHeader.backImgOffset + imgBytes * 3 * sizeof(uint16_t) <= mFile.GetSize())
+			&& (mHeader.roadMaskOffset + imgBytes <= mFile.GetSize())
+			&& (mHeader.roadMasksOffset + mHeader.roadMaskStride * mHeader.roadMasksNum <= mFile.GetSize());
+		if (!isValid)
+		{
+			std::cout << path << ": invalid snapshot" << std::endl;
+			Close();
+			return false;
+		}
+		/* end */
+
+		/* 古さの確認 */
+		const char* staleReason = nullptr;
+		if (mHeader.cameraHash != HashCameraId(cameraId))
+			staleReason = "camera changed";
+		else if ((mHeader.width != frameSize.width) || (mHeader.height != frameSize.height))
+			staleReason = "resolution changed";
+		else if (mHeader.masksWriteTime != masksWriteTime)
+			staleReason = "road masks changed";
+		else if ((mHeader.backImgHandleParams.blendAlpha != backImgHandleParams.blendAlpha)
+			|| (mHeader.backImgHandleParams.warmupFrames != backImgHandleParams.warmupFrames)
+			|| (mHeader.backImgHandleParams.warmupMode != backImgHandleParams.warmupMode)
+			|| (mHeader.backImgHandleParams.warmupStride != backImgHandleParams.warmupStride))
+			staleReason = "background params changed";
+		if (staleReason != nullptr)
+		{
+			std::cout << path << ": stale snapshot (" << staleReason << "), rebuild it." << std::endl;
+			Close();
+			return false;
+		}
+		/* end */
+
+		/* 画像はヘッダのみ作成, 画素はマップを直接参照する. コピーオンライトなので背景モデルを更新してもファイルは変わらない */
+		const auto data = mFile.GetData();
+		mBackImgFixed = Image(mHeader.height, mHeader.width, CV_16UC3, data + mHeader.backImgOffset);
+		mRoadMaskGray = Image(mHeader.height, mHeader.width, CV_8UC1, data + mHeader.roadMaskOffset);
+		for (uint32_t idx = 0; idx < mHeader.roadMasksNum; idx++)
+			mRoadMasksGray.push_back(Image(mHeader.height, mHeader.width, CV_8UC1, data + mHeader.roadMasksOffset + mHeader.roadMaskStride * idx));
+		/* end */
+
+		return true;
+	}
+
+	/// <summary>
+	/// マップを解除してファイルを閉じる. 取り出した画像はこれ以降参照しない
+	/// </summary>
+	void BackgroundSnapshot::Close()
+	{
+		mBackImgFixed = Image();
+		mRoadMaskGray = Image();
+		mRoadMasksGray.clear();
+		mFile.Close();
+		mHeader = Header{};
+	}
+
+	/// <summary>
+	/// スナップショットを書き出す. 一時ファイルに書いてから置き換えるので, 途中で止まっても壊れたスナップショットは残らない
+	/// マップ中のファイルは置き換えられない環境があるので, 開いていれば置き換える前に閉じる
+	/// </summary>
+	/// <param name="path">スナップショットのパス</param>
+	/// <param name="header">カメラ・更新時刻・記録用の値を設定したヘッダ, 書式に関わる値はここで設定する</param>
+	/// <param name="backImgFixed">背景モデル, CV_16UC3(Q8.8)</param>
+	/// <param name="roadMaskGray">二値化済みマスク画像(全体)</param>
+	/// <param name="roadMasksGray">二値化済み道路マスク画像</param>
+	/// <returns>書き込めなければfalse</returns>
+	bool BackgroundSnapshot::Save(const std::string& path, Header header, const Image& backImgFixed, const Image& roadMaskGray, const std::vector<Image>& roadMasksGray)
+	{
+		/* 型とサイズの確認 */
+		auto isMask = [&](const Image& mask) { return (mask.type() == CV_8UC1) && (mask.size() == backImgFixed.size()); };
+		if ((backImgFixed.type() != CV_16UC3) || !isMask(roadMaskGray) || roadMasksGray.empty()
+			|| !std::all_of(roadMasksGray.begin(), roadMasksGray.end(), isMask))
+			return false;
+		/* end */
+
+		/* 書式に関わる値の設定 */
+		const auto imgBytes = static_cast<uint64_t>(backImgFixed.cols) * backImgFixed.rows;
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+		header.roadMasksNum = static_cast<uint32_t>(roadMasksGray.size());
+		header.width = backImgFixed.cols;
+		header.height = backImgFixed.rows;
+		header.backImgOffset = PAGE_SIZE;
+		header.roadMaskStride = AlignToPage(imgBytes);
+		header.roadMaskOffset = header.backImgOffset + AlignToPage(imgBytes * 3 * sizeof(uint16_t));
+		header.roadMasksOffset = header.roadMaskOffset + header.roadMaskStride;
+		/* end */
+
+		const auto tempPath = path + ".tmp";
+		auto file = std::fopen(tempPath.c_str(), "wb");
+		if (file == nullptr)
+			return false;
+
+		/* ヘッダ領域を0埋めで確保し, 続けて各画像をページ境界まで詰めて書く */
+		std::vector<uchar> padding(static_cast<size_t>(PAGE_SIZE), 0);
+		auto writeImg = [&](const Image& img)
+		{
+			const auto continuous = img.isContinuous() ? img : img.clone();
+			const auto bytes = continuous.total() * continuous.elemSize();
+			const auto paddingBytes = static_cast<size_t>(AlignToPage(bytes) - bytes);
+			return (std::fwrite(continuous.data, 1, bytes, file) == bytes)
+				&& (std::fwrite(padding.data(), 1, paddingBytes, file) == paddingBytes);
+		};
+
+		bool isSucceeded = (std::fwrite(padding.data(), 1, padding.size(), file) == padding.size())
+			&& writeImg(backImgFixed) && writeImg(roadMaskGray);
+		for (const auto& mask : roadMasksGray)
+			isSucceeded = isSucceeded && writeImg(mask);
+		isSucceeded = isSucceeded && (std::fseek(file, 0, SEEK_SET) == 0)
+			&& (std::fwrite(&header, sizeof(header), 1, file) == 1);
+		isSucceeded = (std::fclose(file) == 0) && isSucceeded;
+		/* end */
+
+		/* 置き換え */
+		Close();
+		std::error_code error;
+		if (isSucceeded)
+			std::filesystem::rename(tempPath, path, error);
+		if (!isSucceeded || error)
+		{
+			std::filesystem::remove(tempPath, error);
+			return false;
+		}
+		/* end */
+
+		return true;
+	}
+
+	/// <summary>
+	/// カメラIDのハッシュ(FNV-1a)
+	/// </summary>
+	/// <param name="cameraId">カメラID</param>
+	/// <returns>ハッシュ値</returns>
+	uint64_t BackgroundSnapshot::HashCameraId(const std::string& cameraId)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (const auto& c : cameraId)
+		{
+			hash ^= static_cast<uchar>(c);
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+};
\ No newline at end of file
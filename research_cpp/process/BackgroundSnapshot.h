@@ -0,0 +1,117 @@
+#pragma once
+#include "ImgProc.h"
+#include "MappedFile.h"
+
+#include <string>
+
+/// <summary>
+/// 背景モデルと二値化済み道路マスクのスナップショット
+/// 実行の終わりに書き出し, 次回の起動時にメモリマップして初期背景画像の作成とマスク画像の読み込み・二値化を省く
+/// カメラ・解像度・マスク画像の更新時刻・背景処理パラメータのいずれかが変わっていれば古いものとして使わない
+/// パラメータは毎回設定ファイルから読み, スナップショットからは復元しない
+///
+/// 書式(リトルエンディアン)
+///   [0, PAGE_SIZE): Header, 残りは0埋め
+///   backImgOffset: 背景モデル, CV_16UC3(Q8.8の固定小数点)で行間の詰め物なし
+///   roadMaskOffset: マスク画像(全体), CV_8UC1
+///   roadMasksOffset + roadMaskStride * i: i番の道路マスク画像, CV_8UC1
+///   各画像の先頭はページ境界に揃える
+/// </summary>
+class ImgProc::BackgroundSnapshot
+{
+public:
+	static constexpr size_t PAGE_SIZE = 4096; // 画像の配置境界
+	static constexpr char MAGIC[8] = { 'B', 'G', 'S', 'N', 'A', 'P', 'S', 'H' }; // 識別子
+	static constexpr uint32_t VERSION = 2; // 2: 背景モデルを固定小数点に変更
+
+	/// <summary>
+	/// スナップショットのヘッダ
+	/// </summary>
+	struct Header
+	{
+		char magic[8]; // "BGSNAPSH"
+		uint32_t version; // 書式のバージョン
+		uint32_t roadMasksNum; // 道路マスク画像数
+		int32_t width; // 画像の横幅
+		int32_t height; // 画像の縦幅
+		uint64_t cameraHash; // カメラIDのハッシュ
+		int64_t masksWriteTime; // マスク画像の最終更新時刻のうち最新のもの
+		uint64_t frameCount; // 書き出し時点のフレーム番号, 記録のみ
+		BackImgHandleParams backImgHandleParams; // 背景モデルを作ったときの背景処理パラメータ
+		uint64_t backImgOffset; // 背景モデルの位置
+		uint64_t roadMaskOffset; // マスク画像(全体)の位置
+		uint64_t roadMasksOffset; // 0番の道路マスク画像の位置
+		uint64_t roadMaskStride; // 道路マスク画像の格納間隔
+	};
+
+private:
+	MappedFile mFile; // スナップショットのマップ
+	Header mHeader{}; // 読み込んだヘッダ
+	Image mBackImgFixed; // 背景モデル, マップを直接参照
+	Image mRoadMaskGray; // マスク画像(全体), マップを直接参照
+	std::vector<Image> mRoadMasksGray; // 道路マスク画像, マップを直接参照
+
+public:
+	BackgroundSnapshot() = default;
+	~BackgroundSnapshot() { Close(); }
+
+	/// <summary>
+	/// マスク画像の最終更新時刻のうち最新のものを取得. マスク画像を読み込むより十分速い
+	/// </summary>
+	/// <param name="roadMaskPath">マスク画像（全体）パス</param>
+	/// <param name="roadMasksBasePath">道路マスク画像ベースパス</param>
+	/// <returns>最終更新時刻, マスク画像がなければ0</returns>
+	static int64_t GetMasksWriteTime(const std::string& roadMaskPath, const std::string& roadMasksBasePath);
+
+	/// <summary>
+	/// スナップショットをメモリマップする. 古ければ理由を出力して開かない
+	/// </summary>
+	/// <param name="path">スナップショットのパス</param>
+	/// <param name="cameraId">カメラID</param>
+	/// <param name="frameSize">入力のフレームサイズ</param>
+	/// <param name="masksWriteTime">マスク画像の最終更新時刻</param>
+	/// <param name="backImgHandleParams">背景処理パラメータ</param>
+	/// <returns>開けないか古ければfalse</returns>
+	bool Open(const std::string& path, const std::string& cameraId, const cv::Size& frameSize, const int64_t& masksWriteTime,
+		const BackImgHandleParams& backImgHandleParams);
+
+	/// <summary>
+	/// マップを解除してファイルを閉じる. 取り出した画像はこれ以降参照しない
+	/// </summary>
+	void Close();
+
+	/// <summary>
+	/// スナップショットを書き出す. 一時ファイルに書いてから置き換えるので, 途中で止まっても壊れたスナップショットは残らない
+	/// マップ中のファイルは置き換えられない環境があるので, 開いていれば置き換える前に閉じる
+	/// </summary>
+	/// <param name="path">スナップショットのパス</param>
+	/// <param name="header">カメラ・更新時刻・記録用の値を設定したヘッダ, 書式に関わる値はここで設定する</param>
+	/// <param name="backImgFixed">背景モデル, CV_16UC3(Q8.8)</param>
+	/// <param name="roadMaskGray">二値化済みマスク画像(全体)</param>
+	/// <param name="roadMasksGray">二値化済み道路マスク画像</param>
+	/// <returns>書き込めなければfalse</returns>
+	bool Save(const std::string& path, Header header, const Image& backImgFixed, const Image& roadMaskGray, const std::vector<Image>& roadMasksGray);
+
+	/// <summary>
+	/// カメラIDのハッシュ(FNV-1a)
+	/// </summary>
+	/// <param name="cameraId">カメラID</param>
+	/// <returns>ハッシュ値</returns>
+	static uint64_t HashCameraId(const std::string& cameraId);
+
+	bool IsOpened() const { return mFile.IsOpened(); }
+	const Header& GetHeader() const { return mHeader; }
+	const Image& GetBackImgFixed() const { return mBackImgFixed; }
+	const Image& GetRoadMaskGray() const { return mRoadMaskGray; }
+	const std::vector<Image>& GetRoadMasksGray() const { return mRoadMasksGray; }
+
+private:
+	BackgroundSnapshot(const BackgroundSnapshot& other) = delete;
+
+	/// <summary>
+	/// ページ境界に切り上げる
+	/// </summary>
+	/// <param name="bytes">バイト数</param>
+	/// <returns>切り上げたバイト数</returns>
+	static uint64_t AlignToPage(const uint64_t& bytes) { return (bytes + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE; }
+};
\ No newline at end of file
@@ -1,23 +1,73 @@
 #include "CarsExtractor.h"
 #include "BackImageHandle.h"
 
-using Tk = ImgProc::ImgProcToolkit;
+#include <opencv2/core/hal/intrin.hpp>
 
 namespace ImgProc
 {
-	void CarsExtractor::ExtractCars()
+	CarsExtractor::CarsExtractor(PipelineContext& context)
+		: mContext(context), mBackImageHandle(std::make_unique<BackImageHandle>(context))
 	{
-		SubtractBackImage();
-		ExtractShadow();
+		/* 車影画像の画素値, a値とb値を128で埋めてグレースケール化する従来の変換を2画素分だけ行って求める */
+		Image lab(1, 2, CV_8UC3), bgr, gray;
+		lab.at<cv::Vec3b>(0, 0) = cv::Vec3b(0, 128, 128);
+		lab.at<cv::Vec3b>(0, 1) = cv::Vec3b(255, 128, 128);
+		cv::cvtColor(lab, bgr, cv::COLOR_Lab2BGR);
+		cv::cvtColor(bgr, gray, cv::COLOR_BGR2GRAY);
+		mShadowGrays[0] = gray.at<uchar>(0, 0);
+		mShadowGrays[1] = gray.at<uchar>(0, 1);
+		/* end */
+
+		/* モルフォロジカーネルの初期化 */
+		const auto& kernelSize = mContext.GetExtractorParams().kernelSize;
+		mCloseKernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(kernelSize, kernelSize)); // モルフォロジカーネル取得関数, RECTのほかにCROSS, ELIPSEがある
+		/* end */
+	}
+
+	CarsExtractor::~CarsExtractor() = default;
+
+	const Image& CarsExtractor::GetBackImgFixed() const
+	{
+		return mBackImageHandle->GetBackImgFixed();
+	}
+
+	/// <summary>
+	/// 車両抽出
+	/// </summary>
+	/// <param name="frameData">フレームバッファ, frameを読んでbackImgとcarsImgを書き込む</param>
+	void CarsExtractor::ExtractCars(FrameData& frameData)
+	{
+		SubtractBackImage(frameData);
+		ExtractCarsFromSubtracted(frameData);
+	}
+
+	/// <summary>
+	/// 他の抽出器が作った背景差分画像から車両抽出. パラメータ探索で背景差分を1回だけ計算して各抽出器に配るのに使う
+	/// </summary>
+	/// <param name="frameData">フレームバッファ, frameを読んでcarsImgを書き込む</param>
+	/// <param name="subtracted">マスキング済みの背景差分画像, 読み取りのみ</param>
+	void CarsExtractor::ExtractCars(FrameData& frameData, const Image& subtracted)
+	{
+		mSubtracted = subtracted; // ヘッダのみのシャローコピー, 以降の処理はmSubtractedに書き込まない
+		ExtractCarsFromSubtracted(frameData);
+	}
+
+	/// <summary>
+	/// 背景差分画像から車影を除去して車両二値画像を作る
+	/// </summary>
+	/// <param name="frameData">フレームバッファ</param>
+	void CarsExtractor::ExtractCarsFromSubtracted(FrameData& frameData)
+	{
+		ExtractShadow(frameData.frame);
 		ReExtractShadow();
 
-		const auto& crefParams = Tk::GetExtractorParams();
-		auto& refCarsImg = Tk::GetCars();
-		const auto& crefRoadMaskGray = Tk::GetRoadMaskGray();
+		const auto& crefParams = mContext.GetExtractorParams();
+		auto& refCarsImg = frameData.carsImg;
+		const auto& crefRoadMaskGray = mContext.GetRoadMaskGray();
 		mPreCars = mSubtracted - mReShadow; // 移動物体から車影を除去
 		cv::morphologyEx(mPreCars, refCarsImg, cv::MORPH_CLOSE, mCloseKernel, cv::Point(-1, -1), crefParams.closeCount);
-		cv::bitwise_and(refCarsImg, crefRoadMaskGray, refCarsImg);
-		OutputProcessVideo();
+		cv::bitwise_and(refCarsImg, crefRoadMaskGray(mContext.GetProcessRoi()), refCarsImg);
+		OutputProcessVideo(frameData);
 	}
 
 	/// <summary>
@@ -25,74 +75,152 @@ namespace ImgProc
 	/// </summary>
 	void CarsExtractor::InitBackgroundImage()
 	{
-		BackImageHandle::CreatePreBackImg();
+		mBackImageHandle->CreatePreBackImg();
 	}
 
 	/// <summary>
 	/// 背景差分, 移動物体検出
 	/// </summary>
-	void CarsExtractor::SubtractBackImage()
+	/// <param name="frameData">フレームバッファ</param>
+	void CarsExtractor::SubtractBackImage(FrameData& frameData)
 	{
-		BackImageHandle::UpdateBackground();
-		const auto& crefSubtracted = BackImageHandle::GetSubtracted();
-		const auto& crefRoadMaskGray = Tk::GetRoadMaskGray();
-		cv::bitwise_and(crefSubtracted, crefRoadMaskGray, mSubtracted); // マスキング処理
+		mBackImageHandle->UpdateBackground(frameData.frame, frameData.backImg);
+		const auto& crefSubtracted = mBackImageHandle->GetSubtracted();
+		const auto& crefRoadMaskGray = mContext.GetRoadMaskGray();
+		cv::bitwise_and(crefSubtracted, crefRoadMaskGray(mContext.GetProcessRoi()), mSubtracted); // マスキング処理
 	}
 
 	/// <summary>
 	/// 車影抽出
 	/// </summary>
-	void CarsExtractor::ExtractShadow()
+	/// <param name="frame">入力フレーム, 処理範囲のみ使う</param>
+	void CarsExtractor::ExtractShadow(const Image& frame)
 	{
-		const auto& crefFrame = Tk::GetFrame();
-		const auto& crefParams = Tk::GetExtractorParams();
+		const auto& crefParams = mContext.GetExtractorParams();
 
-		// [0], [1], [2]にl, a, bが分割して代入される動的配列
-		std::vector<Image> vLab;
+		cv::cvtColor(frame(mContext.GetProcessRoi()), mTemp, cv::COLOR_BGR2Lab); //l*a*b*に変換, 統計量も処理範囲のもの
 
-		cv::cvtColor(crefFrame, mTemp, cv::COLOR_BGR2Lab); //l*a*b*に変換
-		cv::split(mTemp, vLab); //split: チャンネルごとに分割する関数
-
-		/* 参照型でリソース削減しつつ, わかりやすいエイリアスを定義 */
-		auto& l = vLab[0];
-		auto& a = vLab[1];
-		auto& b = vLab[2];
+		/* 統計量導出, cv::meanとcv::meanStdDevと同じく整数の総和に画素数の逆数を掛ける */
+		uint64_t sums[4] = {};
+		SumLabStats(mTemp, sums);
+		const auto scale = 1.0 / static_cast<double>(mTemp.total());
+		const auto meanL = static_cast<double>(sums[0]) * scale;
+		const auto stdL = std::sqrt(std::max(static_cast<double>(sums[1]) * scale - meanL * meanL, 0.0));
+		const auto meanA = static_cast<double>(sums[2]) * scale;
+		const auto meanB = static_cast<double>(sums[3]) * scale;
 		/* end */
 
-		/* 統計量導出 */
-		auto& meanA = cv::mean(a)[0]; //cv::Scalarはdoubleの二次元配列なのかも?
-		auto& meanB = cv::mean(b)[0];
-		cv::Scalar meanLScalar, stdLScalar;
-		cv::meanStdDev(l, meanLScalar, stdLScalar);
-		auto& meanL = meanLScalar[0];
-		auto& stdL = stdLScalar[0];
-		/* end */
-
-		/* L値を決定する処理 */
-		// np.where -> matA cmpop matB で代替
-		// 戻り値はMatExprだが, Matと互換性あり
-		// しかもcmpopがtrueの要素が255, それ以外の要素が0の行列として帰ってくる -> まんまwhere
+		/* L値とb値の閾値を決定する処理, 画素値は整数なので閾値以下は閾値の切り捨て以下と同じ */
+		int lLimit = 255;
+		int bLimit = 255;
 		if ((meanA + meanB) <= 256)
+			lLimit = static_cast<int>(std::clamp(std::floor(meanL - stdL / 3), -1.0, 255.0));
+		else
 		{
-			auto thr = meanL - stdL / 3;
-			l = (l <= thr);
+			lLimit = std::clamp(crefParams.shadowThrL, -1, 255);
+			bLimit = std::clamp(crefParams.shadowThrB, -1, 255);
 		}
-		else
-			l = (l <= crefParams.shadowThrL).mul(b <= crefParams.shadowThrB);
 		/* end */
 
-		/* a, b値を128で埋めてグレースケール化 */
-		a = mLab128;
-		b = mLab128;
-		/* end */
+		ThresholdShadow(mTemp, lLimit, bLimit);
+	}
 
-		/* 統合処理 */
-		cv::merge(vLab, mTemp);
-		cv::cvtColor(mTemp, mTemp, cv::COLOR_Lab2BGR);
-		/* end */
+	/// <summary>
+	/// L*a*b*画像のL値, L値の2乗, a値, b値の総和を1回の走査で求める
+	/// </summary>
+	/// <param name="lab">L*a*b*画像, CV_8UC3</param>
+	/// <param name="sums">L値, L値の2乗, a値, b値の順の総和の格納先</param>
+	void CarsExtractor::SumLabStats(const Image& lab, uint64_t(&sums)[4])
+	{
+		for (int y = 0; y < lab.rows; y++)
+		{
+			const auto src = lab.ptr<uchar>(y);
+			int x = 0;
+#if CV_SIMD
+			/* 行内はレーンごとに32bitで累積する. 1行の2乗和でも1レーンあたり桁あふれしない */
+			constexpr int lanes = cv::v_uint8::nlanes;
+			auto vSumL = cv::vx_setzero_u32(), vSqSumL = cv::vx_setzero_u32(), vSumA = cv::vx_setzero_u32(), vSumB = cv::vx_setzero_u32();
+			for (; x <= lab.cols - lanes; x += lanes)
+			{
+				cv::v_uint8 l, a, b;
+				cv::v_load_deinterleave(src + x * 3, l, a, b);
 
-		cv::cvtColor(mTemp, mTemp, cv::COLOR_BGR2GRAY);
-		cv::bitwise_and(mTemp, mSubtracted, mShadow);
+				cv::v_uint16 l0, l1, a0, a1, b0, b1;
+				cv::v_uint32 s0, s1;
+				cv::v_expand(l, l0, l1);
+				cv::v_expand(a, a0, a1);
+				cv::v_expand(b, b0, b1);
+				cv::v_expand(l0 + l1, s0, s1);
+				vSumL = vSumL + s0 + s1;
+				cv::v_expand(a0 + a1, s0, s1);
+				vSumA = vSumA + s0 + s1;
+				cv::v_expand(b0 + b1, s0, s1);
+				vSumB = vSumB + s0 + s1;
+				cv::v_expand(l0 * l0, s0, s1); // 255 * 255は16bitに収まる
+				vSqSumL = vSqSumL + s0 + s1;
+				cv::v_expand(l1 * l1, s0, s1);
+				vSqSumL = vSqSumL + s0 + s1;
+			}
+			sums[0] += cv::v_reduce_sum(vSumL);
+			sums[1] += cv::v_reduce_sum(vSqSumL);
+			sums[2] += cv::v_reduce_sum(vSumA);
+			sums[3] += cv::v_reduce_sum(vSumB);
+			/* end */
+#endif
+			for (; x < lab.cols; x++)
+			{
+				const uint64_t l = src[x * 3];
+				sums[0] += l;
+				sums[1] += l * l;
+				sums[2] += src[x * 3 + 1];
+				sums[3] += src[x * 3 + 2];
+			}
+		}
+#if CV_SIMD
+		cv::vx_cleanup();
+#endif
+	}
+
+	/// <summary>
+	/// L値とb値の閾値で車影を判定し, 背景差分画像でマスキングした車影画像を1回の走査で書き込む
+	/// </summary>
+	/// <param name="lab">L*a*b*画像, CV_8UC3</param>
+	/// <param name="lLimit">L値がこれ以下なら車影, 負なら車影なし</param>
+	/// <param name="bLimit">b値がこれ以下なら車影, 負なら車影なし</param>
+	void CarsExtractor::ThresholdShadow(const Image& lab, const int& lLimit, const int& bLimit)
+	{
+		mShadow.create(lab.size(), CV_8UC1);
+		const auto hasShadow = (lLimit >= 0) && (bLimit >= 0);
+		const auto lMax = static_cast<uchar>(std::max(lLimit, 0));
+		const auto bMax = static_cast<uchar>(std::max(bLimit, 0));
+		for (int y = 0; y < lab.rows; y++)
+		{
+			const auto src = lab.ptr<uchar>(y);
+			const auto subtracted = mSubtracted.ptr<uchar>(y);
+			auto dst = mShadow.ptr<uchar>(y);
+			int x = 0;
+#if CV_SIMD
+			constexpr int lanes = cv::v_uint8::nlanes;
+			const auto vLMax = cv::vx_setall_u8(lMax), vBMax = cv::vx_setall_u8(bMax);
+			const auto vOff = cv::vx_setall_u8(mShadowGrays[0]), vOn = cv::vx_setall_u8(mShadowGrays[1]);
+			const auto vHasShadow = cv::vx_setall_u8(hasShadow ? 255 : 0);
+			for (; x <= lab.cols - lanes; x += lanes)
+			{
+				cv::v_uint8 l, a, b;
+				cv::v_load_deinterleave(src + x * 3, l, a, b);
+				const auto isShadow = (l <= vLMax) & (b <= vBMax) & vHasShadow;
+				cv::v_store(dst + x, cv::v_select(isShadow, vOn, vOff) & cv::vx_load(subtracted + x));
+			}
+#endif
+			for (; x < lab.cols; x++)
+			{
+				const auto isShadow = hasShadow && (src[x * 3] <= lMax) && (src[x * 3 + 2] <= bMax);
+				dst[x] = mShadowGrays[isShadow ? 1 : 0] & subtracted[x];
+			}
+		}
+#if CV_SIMD
+		cv::vx_cleanup();
+#endif
 	}
 
 	/// <summary>
@@ -104,30 +232,15 @@ namespace ImgProc
 	{
 		//ラベリングによって求められるラベル数
 		auto labelNum = cv::connectedComponentsWithStats(mShadow, mLabels, mStats, mCentroids, 8);
-		const auto& crefDetectArea = Tk::GetDetectAreaInf();
-		const auto& crefParams = Tk::GetExtractorParams();
-		mShadow.copyTo(mReShadow);
+		const auto& crefParams = mContext.GetExtractorParams();
 
-		/* 各領域ごとの処理, 0番は背景 */
-		for (int label = 1; label < labelNum; label++)
+		/* 横長の領域は車影でないので除く, 0番は背景 */
+		mLabelFilter.Build(mStats, labelNum, [&](const LabelFilter::Stats& stats)
 		{
-			/* 統計情報分割 */
-			auto statsPtr = mStats.ptr<int>(label);
-			auto& x = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_LEFT];
-			auto& y = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_TOP];
-			auto& width = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_WIDTH];
-			auto& height = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_HEIGHT];
-			auto& area = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_AREA];
-			/* end */
-
-			auto aspect = static_cast<float>(width) / height; //アスペクト比の導出
-
-			if (aspect > crefParams.reshadowAspectThr)
-			{
-				auto idxGroup = (mLabels == label); // 車影でない部分をマスクとして抜き出す
-				mReShadow.setTo(0, idxGroup); // 車影でない部分を0埋め
-			}
-		}
+			auto aspect = static_cast<float>(stats.width) / stats.height; //アスペクト比の導出
+			return !(aspect > crefParams.reshadowAspectThr);
+		});
+		mLabelFilter.Apply(mLabels, mShadow, mReShadow);
 		/* end */
 	}
 
@@ -148,23 +261,16 @@ namespace ImgProc
 	}
 
 	/// <summary>
-	/// 書く処理過程の結果画像を出力
+	/// 各処理過程の結果画像を, 有効なタップポイントのみフレーム全体の位置に戻して出力
 	/// </summary>
-	void CarsExtractor::OutputProcessVideo()
+	/// <param name="frameData">フレームバッファ</param>
+	void CarsExtractor::OutputProcessVideo(const FrameData& frameData)
 	{
-		cv::cvtColor(mSubtracted, mTemp, cv::COLOR_GRAY2BGR);
-		mVideoWriterSub << mTemp;
-
-		cv::cvtColor(mShadow, mTemp, cv::COLOR_GRAY2BGR);
-		mVideoWriterShadow << mTemp;
-
-		cv::cvtColor(mReShadow, mTemp, cv::COLOR_GRAY2BGR);
-		mVideoWriterReShadow << mTemp;
-
-		cv::cvtColor(mPreCars, mTemp, cv::COLOR_GRAY2BGR);
-		mVideoWriterPreCars << mTemp;
-
-		cv::cvtColor(Tk::GetCars(), mTemp, cv::COLOR_GRAY2BGR);
-		mVideoWriterCars << mTemp;
+		const auto& crefFrameCount = frameData.frameCount;
+		mContext.OutputRoiTapPoint(TapPoint::SUBTRACTED, mSubtracted, crefFrameCount);
+		mContext.OutputRoiTapPoint(TapPoint::SHADOW, mShadow, crefFrameCount);
+		mContext.OutputRoiTapPoint(TapPoint::RESHADOW, mReShadow, crefFrameCount);
+		mContext.OutputRoiTapPoint(TapPoint::PRE_CARS, mPreCars, crefFrameCount);
+		mContext.OutputRoiTapPoint(TapPoint::CARS, frameData.carsImg, crefFrameCount);
 	}
 };
\ No newline at end of file
@@ -1,96 +1,44 @@
 #pragma once
 #include "ImgProc.h"
+#include "LabelFilter.h"
 
 class ImgProc::CarsExtractor
 {
 private:
 	class BackImageHandle;
 
-	/* 出力画像バッファ */
+	PipelineContext& mContext; // 実行コンテキスト
+	std::unique_ptr<BackImageHandle> mBackImageHandle; // 背景処理
+
+	/* 出力画像バッファ, 画像バッファはすべて処理範囲(PipelineContext::GetProcessRoi())の大きさ */
 	Image mSubtracted; //背景差分画像, 1チャンネル固定
 	Image mShadow; //車影画像, 1チャンネル固定
 	Image mReShadow;//車影再抽出画像, 1チャンネル固定
 	Image mPreCars; // モルフォロジかけない車両抽出画像, 1チャンネル固定
 	/* end */
 
-	cv::VideoWriter mVideoWriterSub;
-	cv::VideoWriter mVideoWriterShadow;
-	cv::VideoWriter mVideoWriterReShadow;
-	cv::VideoWriter mVideoWriterCars;
-	cv::VideoWriter mVideoWriterPreCars;
-
 	/* 画像処理に用いるバッファ */
 	Image mTemp; //バッファ
-	Image mLab128; //グレースケール化のために, L*a*b*のa値とb値を128にするためのバッファ, チャンネル数1
 	Image mLabels; //ラベル画像
 	Image mStats; //ラベリングにおける統計情報
 	Image mCentroids; //ラベリングにおける中心点座標群
 	Image mCloseKernel; // クロージングで使用するカーネル
 	Image mOpenKernel; // クロージングで使用するカーネル
+	LabelFilter mLabelFilter; // ラベルごとの取捨選択
 	/* end */
 
+	// 車影画像の画素値, [0]が車影でない画素, [1]が車影の画素
+	// L*a*b*のL値を0か255, a値とb値を128にしてBGR, グレースケールと変換した値で, 変換を省いても結果を変えない
+	uchar mShadowGrays[2] = { 0, 255 };
+
 public:
-	CarsExtractor()
-	{
-		const auto& [crefVideoWidth, crefVideoHeight] = ImgProcToolkit::GetVideoWidAndHigh();
-		cv::Size imgSize(crefVideoWidth, crefVideoHeight);
-
-		/* メンバ画像の初期化 */
-		mLab128 = Image::ones(imgSize, CV_8U) * 128;
-		/* end */
-
-		/* モルフォロジカーネルの初期化 */
-		const auto& kernelSize = ImgProcToolkit::GetExtractorParams().kernelSize;
-		mCloseKernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(kernelSize, kernelSize)); // モルフォロジカーネル取得関数, RECTのほかにCROSS, ELIPSEがある
-		/* end */
-
-		auto fourcc = cv::VideoWriter::fourcc('m', 'p', '4', 'v');
-		auto videoFps = ImgProcToolkit::GetVideoCapture().get(cv::CAP_PROP_FPS);
-
-		std::string outputPath = ImgProcToolkit::GetOutputBasePath() + "_Sub.mp4";
-		mVideoWriterSub.open(outputPath, fourcc, videoFps, cv::Size(crefVideoWidth, crefVideoHeight));
-		if (!mVideoWriterSub.isOpened())
-		{
-			std::cout << outputPath << ": can't create or overwrite" << std::endl;
-			assert("failed to overwrite video");
-		}
-
-		outputPath = ImgProcToolkit::GetOutputBasePath() + "_Shadow.mp4";
-		mVideoWriterShadow.open(outputPath, fourcc, videoFps, cv::Size(crefVideoWidth, crefVideoHeight));
-		if (!mVideoWriterShadow.isOpened())
-		{
-			std::cout << outputPath << ": can't create or overwrite" << std::endl;
-			assert("failed to overwrite video");
-		}
-
-		outputPath = ImgProcToolkit::GetOutputBasePath() + "_ReShadow.mp4";
-		mVideoWriterReShadow.open(outputPath, fourcc, videoFps, cv::Size(crefVideoWidth, crefVideoHeight));
-		if (!mVideoWriterReShadow.isOpened())
-		{
-			std::cout << outputPath << ": can't create or overwrite" << std::endl;
-			assert("failed to overwrite video");
-		}
-
-		outputPath = ImgProcToolkit::GetOutputBasePath() + "_PreCars.mp4";
-		mVideoWriterPreCars.open(outputPath, fourcc, videoFps, cv::Size(crefVideoWidth, crefVideoHeight));
-		if (!mVideoWriterPreCars.isOpened())
-		{
-			std::cout << outputPath << ": can't create or overwrite" << std::endl;
-			assert("failed to overwrite video");
-		}
-
-		outputPath = ImgProcToolkit::GetOutputBasePath() + "_Cars.mp4";
-		mVideoWriterCars.open(outputPath, fourcc, videoFps, cv::Size(crefVideoWidth, crefVideoHeight));
-		if (!mVideoWriterCars.isOpened())
-		{
-			std::cout << outputPath << ": can't create or overwrite" << std::endl;
-			assert("failed to overwrite video");
-		}
-	}
+	explicit CarsExtractor(PipelineContext& context);
+	~CarsExtractor();
 
 	const Image& GetSubtracted() const { return mSubtracted; }
 	const Image& GetShadow() const { return mShadow; }
 	const Image& GetReShadow() const { return mReShadow; }
+	const Image& GetBackImgFixed() const;
 
 	/// <summary>
 	/// 初期背景画像を作成(500フレーム使用)
@@ -100,20 +48,51 @@ public:
 	/// <summary>
 	/// 車両抽出
 	/// </summary>
-	void ExtractCars();
+	/// <param name="frameData">フレームバッファ, frameを読んでbackImgとcarsImgを書き込む</param>
+	void ExtractCars(FrameData& frameData);
+
+	/// <summary>
+	/// 他の抽出器が作った背景差分画像から車両抽出. パラメータ探索で背景差分を1回だけ計算して各抽出器に配るのに使う
+	/// </summary>
+	/// <param name="frameData">フレームバッファ, frameを読んでcarsImgを書き込む</param>
+	/// <param name="subtracted">マスキング済みの背景差分画像, 読み取りのみ</param>
+	void ExtractCars(FrameData& frameData, const Image& subtracted);
+
+	/// <summary>
+	/// 背景差分, 移動物体検出
+	/// </summary>
+	/// <param name="frameData">フレームバッファ</param>
+	void SubtractBackImage(FrameData& frameData);
 
 private:
 	CarsExtractor(const CarsExtractor& other) = delete;
 
 	/// <summary>
-	/// 背景差分, 移動物体検出
+	/// 背景差分画像から車影を除去して車両二値画像を作る
 	/// </summary>
-	void SubtractBackImage();
+	/// <param name="frameData">フレームバッファ</param>
+	void ExtractCarsFromSubtracted(FrameData& frameData);
 
 	/// <summary>
 	/// 車影抽出
 	/// </summary>
-	void ExtractShadow();
+	/// <param name="frame">入力フレーム, 処理範囲のみ使う</param>
+	void ExtractShadow(const Image& frame);
+
+	/// <summary>
+	/// L*a*b*画像のL値, L値の2乗, a値, b値の総和を1回の走査で求める
+	/// </summary>
+	/// <param name="lab">L*a*b*画像, CV_8UC3</param>
+	/// <param name="sums">L値, L値の2乗, a値, b値の順の総和の格納先</param>
+	static void SumLabStats(const Image& lab, uint64_t(&sums)[4]);
+
+	/// <summary>
+	/// L値とb値の閾値で車影を判定し, 背景差分画像でマスキングした車影画像を1回の走査で書き込む
+	/// </summary>
+	/// <param name="lab">L*a*b*画像, CV_8UC3</param>
+	/// <param name="lLimit">L値がこれ以下なら車影, 負なら車影なし</param>
+	/// <param name="bLimit">b値がこれ以下なら車影, 負なら車影なし</param>
+	void ThresholdShadow(const Image& lab, const int& lLimit, const int& bLimit);
 
 	/// <summary>
 	/// 車影再抽出
@@ -129,7 +108,8 @@ private:
 	void ShowOutImgs(const int& interval = 1500);
 
 	/// <summary>
-	/// 各処理過程の結果画像を出力
+	/// 各処理過程の結果画像を, 有効なタップポイントのみフレーム全体の位置に戻して出力
 	/// </summary>
-	void OutputProcessVideo();
-};
+	/// <param name="frameData">フレームバッファ</param>
+	void OutputProcessVideo(const FrameData& frameData);
+};
\ No newline at end of file
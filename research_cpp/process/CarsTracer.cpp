@@ -1,34 +1,63 @@
 #include "CarsTracer.h"
 #include "TemplateHandle.h"
 
-using Tk = ImgProc::ImgProcToolkit;
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <atomic>
+#include <bit>
+#include <cfloat>
 
 namespace ImgProc
 {
-	CarsTracer::CarsTracer()
+	CarsTracer::CarsTracer(PipelineContext& context)
+		: mContext(context), mTemplateHandle(std::make_unique<TemplateHandle>(context))
 	{
-		TemplateHandle::MakeCloseKernel();
+		mTrackCachesList.resize(mContext.GetRoadMasksNum());
+		if (mContext.AreRoadMasksDisjoint()) // 重なり判定と表示はリソース読み込み時に済んでいる
+			mLaneLabeler.Build(mContext.GetRoadMasksGray(), mContext.GetProcessRoi());
 	}
 
+	CarsTracer::~CarsTracer() = default;
+
 	/// <summary>
 	/// 車両検出
 	/// </summary>
-	void CarsTracer::DetectCars()
+	/// <param name="frameData">フレームバッファ, frame, backImg, carsImgを読んでresultImgを書き込む</param>
+	void CarsTracer::DetectCars(FrameData& frameData)
 	{
-		const auto& crefFrame = Tk::GetFrame();
-		auto& refResultImg = Tk::GetResult();
-		const auto& crefCarsImg = Tk::GetCars();
-		const auto& crefRoadMasksGray = Tk::GetRoadMasksGray();
-
-		crefFrame.copyTo(refResultImg);
-		Tk::SetCarsNumPrev(Tk::GetCarsNum()); // 前フレームの車両台数を保持
-
-		for (size_t idx = 0; idx < Tk::GetRoadMasksNum(); idx++)
+		mFrameData = &frameData;
+		const auto& crefFrame = frameData.frame;
+		auto& refResultImg = frameData.resultImg;
+		const auto& crefCarsImg = frameData.carsImg;
+		const auto& crefRoadMasksGray = mContext.GetRoadMasksGray();
+
+		mIsRendering = mContext.IsTapPointActive(TapPoint::RESULT, frameData.frameCount);
+		mIsLogging = mContext.GetDetectionLogParams().enable;
+		frameData.records.clear();
+		if (mIsRendering)
+			crefFrame.copyTo(refResultImg);
+		mContext.SetCarsNumPrev(mContext.GetCarsNum()); // 前フレームの車両台数を保持
+
+		if (frameData.frameCount != mContext.GetStartFrame())
+			MatchTrackedCars(); // 追跡中車両の移動先は車線をまたいでまとめて求める
+
+		const auto isLaneLabeled = mLaneLabeler.IsBuilt();
+		if (isLaneLabeled)
+			mLaneLabeler.Label(crefCarsImg); // 全車線を1回の走査でラベリング
+		for (size_t idx = 0; idx < mContext.GetRoadMasksNum(); idx++)
 		{
-			cv::bitwise_and(crefCarsImg, crefRoadMasksGray[idx], mTemp); // マスキング処理
-			mLabelNum = cv::connectedComponentsWithStats(mTemp, mLabels, mStats, mCentroids, 4); // ラベリング
+			if (isLaneLabeled)
+			{
+				mStats = mLaneLabeler.GetStats(idx);
+				mLabelNum = mLaneLabeler.GetLabelNum(idx);
+			}
+			else
+			{
+				cv::bitwise_and(crefCarsImg, crefRoadMasksGray[idx](mContext.GetProcessRoi()), mTemp); // マスキング処理, 車両二値画像は処理範囲の大きさ
+				mLabelNum = cv::connectedComponentsWithStats(mTemp, mLabels, mStats, mCentroids, 4); // ラベリング
+			}
 
-			if (Tk::GetFrameCount() == Tk::GetStartFrame())
+			if (frameData.frameCount == mContext.GetStartFrame())
 			{
 				DetectNewCars(idx);
 				continue;
@@ -37,81 +66,578 @@ namespace ImgProc
 			TraceCars(idx);
 			DetectNewCars(idx);
 		}
-		const auto& detect = Tk::GetDetectAreaInf();
-		cv::line(refResultImg, cv::Point(0, detect.top), cv::Point(Tk::GetVideoWidAndHigh().first, detect.top), cv::Scalar(0, 255, 0), 3);
-		cv::line(refResultImg, cv::Point(0, detect.bottom), cv::Point(Tk::GetVideoWidAndHigh().first, detect.bottom), cv::Scalar(0, 255, 0), 3);
+		if (!mIsRendering)
+			return;
+
+		const auto& detect = mContext.GetDetectAreaInf();
+		cv::line(refResultImg, cv::Point(0, detect.top), cv::Point(mContext.GetVideoWidAndHigh().first, detect.top), cv::Scalar(0, 255, 0), 3);
+		cv::line(refResultImg, cv::Point(0, detect.bottom), cv::Point(mContext.GetVideoWidAndHigh().first, detect.bottom), cv::Scalar(0, 255, 0), 3);
 	}
 
 	/// <summary>
-	/// 車両追跡
+	/// 全車線の追跡中車両のテンプレートマッチングを並列に行う
+	/// 空いたワーカが次の車両を取りに行くので, 車線ごとの台数の偏りに左右されない
 	/// </summary>
-	/// <param name="idx">道路マスク番号</param>
-	void CarsTracer::TraceCars(const size_t& idx)
+	void CarsTracer::MatchTrackedCars()
 	{
-		const auto& crefFrame = Tk::GetFrame();
-		const auto& crefParams = Tk::GetTracerParams();
-		auto& refResultImg = Tk::GetResult();
-		auto& refTemplates = Tk::GetTemplatesList()[idx];
-		auto& refTemplatePositions = Tk::GetTemplatePositionsList()[idx];
-		auto& refBoundaryCarIdList = Tk::GetBoundaryCarIdLists()[idx];
-		auto& refRoadCarsDirection = Tk::GetRoadCarsDirections()[idx];
+		auto& refTemplatesList = mContext.GetTemplatesList();
+		auto& refTemplatePositionsList = mContext.GetTemplatePositionsList();
 
+		/* 追跡中車両を車線順・車両番号順に並べる. 要素の参照はここで解決し, マッチング中はコンテナに触れない */
+		mMatchTasks.clear();
+		mLaneTaskBegins.clear();
+		for (size_t idx = 0; idx < mContext.GetRoadMasksNum(); idx++)
+		{
+			auto& refTemplates = refTemplatesList[idx];
+			auto& refTemplatePositions = refTemplatePositionsList[idx];
+			auto& refTrackCaches = mTrackCachesList[idx];
+			mLaneTaskBegins.push_back(mMatchTasks.size());
+			for (auto carId = mContext.GetFrontCarId(); carId < mContext.GetCarsNum(); carId++)
+			{
+				auto itr = refTemplates.find(carId);
+				if (itr == refTemplates.end())
+					continue;
+
+				MatchTask task;
+				task.idx = idx;
+				task.carId = carId;
+				task.carImg = &itr->second;
+				task.carPos = &refTemplatePositions.at(carId);
+				task.cache = &refTrackCaches[carId];
+				if (task.cache->bank.original.empty())
+				{
+					task.cache->bank.original = itr->second; // 追跡開始時のテンプレートを拡大・縮小の元にする
+					task.cache->motion.lastPos = task.carPos->tl();
+				}
+				mMatchTasks.push_back(task);
+			}
+		}
+		mLaneTaskBegins.push_back(mMatchTasks.size());
+		/* end */
+
+		/* ピラミッドマッチングなら, フレームの縮小段を全車両で共有するために一度だけ作る */
+		if (!mMatchTasks.empty() && (mContext.GetTracerParams().matchMode == MatchMode::PYRAMID))
+		{
+			mFramePyramid[0] = mFrameData->frame;
+			for (int level = 1; level <= MAX_PYRAMID_LEVEL; level++)
+				cv::pyrDown(mFramePyramid[level - 1], mFramePyramid[level]);
+		}
+		/* end */
+
+		/* ワーカごとに作業領域を持ち, 共有のカーソルから次の車両を取る */
+		const auto tasksNum = mMatchTasks.size();
+		const auto workersNum = std::min(mContext.GetThreadsNum(), tasksNum);
+		if (workersNum == 0)
+			return;
+		if (mMatchBuffers.size() < workersNum)
+			mMatchBuffers.resize(workersNum);
+
+		std::atomic<size_t> next = 0;
+		cv::parallel_for_(cv::Range(0, static_cast<int>(workersNum)), [&](const cv::Range& range)
+		{
+			for (auto worker = range.start; worker < range.end; worker++)
+			{
+				auto& refBuffers = mMatchBuffers[worker];
+				for (auto taskIdx = next++; taskIdx < tasksNum; taskIdx = next++)
+					MatchCar(mMatchTasks[taskIdx], refBuffers);
+			}
+		}, static_cast<double>(workersNum));
+		/* end */
+	}
+
+	/// <summary>
+	/// 車両1台分のテンプレートマッチング. 他の車両の状態は読み書きしない
+	/// </summary>
+	/// <param name="refTask">マッチング対象, 結果を書き込む</param>
+	/// <param name="refBuffers">作業領域</param>
+	void CarsTracer::MatchCar(MatchTask& refTask, MatchBuffers& refBuffers) const
+	{
+		const auto& crefFrame = mFrameData->frame;
+		const auto& crefParams = mContext.GetTracerParams();
+		const auto& crefCarImg = *refTask.carImg;
+		auto& refFeatures = refTask.cache->features;
+		auto& refNearImg = refBuffers.nearImg;
+		auto& refResult = refBuffers.result;
 		double maxValueArray[2] = { 0.0, 0.0 };
-		double maxValue = 0.0;
-		Image gray, edge, edgeTempl;
-		/* 検出済み車両ごとに処理 */
-		for (auto carId = Tk::GetFrontCarId(); carId < Tk::GetCarsNum(); carId++)
+		cv::Point maxLocArray[2]{};
+
+		mTemplateHandle->ExtractCarsNearestArea(refTask.nearRect, refTask.idx, *refTask.cache, *refTask.carImg, *refTask.carPos);
+		UpdateFeatures(crefCarImg, refFeatures); // 使う段が変わったときだけ作り直す
+		GetImgSlice(crefFrame, refTask.nearRect).copyTo(refNearImg);
+		cv::cvtColor(refNearImg, refBuffers.gray, cv::COLOR_BGR2GRAY);
+
+		/* テンプレートの方が大きければ絞り込めないので, 探索範囲全体をそのままマッチングする */
+		if ((refNearImg.cols < crefCarImg.cols) || (refNearImg.rows < crefCarImg.rows))
 		{
-			if (refTemplates.find(carId) == refTemplates.end())
-				continue;
+			cv::Laplacian(refBuffers.gray, refBuffers.edge, CV_8U);
+			MatchEdge(refBuffers.edge, refFeatures, refBuffers);
+			cv::minMaxLoc(refResult, nullptr, &maxValueArray[0], nullptr, &maxLocArray[0]);
+			cv::matchTemplate(refNearImg, crefCarImg, refResult, cv::TM_CCOEFF_NORMED);
+			cv::minMaxLoc(refResult, nullptr, &maxValueArray[1], nullptr, &maxLocArray[1]);
+		}
+		/* end */
+		else if (crefParams.matchMode == MatchMode::SAD)
+		{
+			/* 差の絶対値和をテンプレートの平均との差の絶対値和で割って, 1を一致, 0を平坦な領域との一致程度とする */
+			cv::Laplacian(refBuffers.gray, refBuffers.edge, CV_8U);
+			if (crefParams.binaryEdge)
+				maxValueArray[0] = MatchBinaryEdge(refBuffers.edge, refFeatures, crefParams.edgeBinThr, refBuffers, maxLocArray[0]);
+			else
+			{
+				const auto edgeSad = MatchSad(refBuffers.edge, refFeatures.edge, refFeatures.edgeRowSums, refBuffers, maxLocArray[0]);
+				maxValueArray[0] = 1.0 - static_cast<double>(edgeSad) / std::max(refFeatures.edgeAbsDev, 1.0);
+			}
+			const auto colorSad = MatchSad(refNearImg, crefCarImg, refFeatures.colorRowSums, refBuffers, maxLocArray[1]);
+			maxValueArray[1] = 1.0 - static_cast<double>(colorSad) / std::max(refFeatures.colorAbsDev, 1.0);
+			/* end */
+		}
+		else
+		{
+			/* 結果画像上の探索範囲, ピラミッドマッチングなら縮小段の一致位置の近傍に絞る */
+			const cv::Rect fullRect(0, 0, refNearImg.cols - crefCarImg.cols + 1, refNearImg.rows - crefCarImg.rows + 1);
+			cv::Rect searchRects[2] = { fullRect, fullRect };
+			if (crefParams.matchMode == MatchMode::PYRAMID)
+			{
+				int level = 0;
+				while ((level < MAX_PYRAMID_LEVEL) && ((std::min(crefCarImg.cols, crefCarImg.rows) >> (level + 1)) >= crefParams.pyramidMinSize))
+					level++;
+				if (level > 0)
+					MatchCoarse(refTask, refBuffers, level, searchRects);
+			}
+			/* end */
 
-			/* テンプレートマッチング */
-			auto& refCarImg = refTemplates[carId];
-			auto& refCarPos = refTemplatePositions[carId];
-			TemplateHandle::ExtractCarsNearestArea(mNearRect, idx, carId);
-			mTemp = GetImgSlice(crefFrame, mNearRect).clone();
-
-			/* エッジによるテンプレートマッチング */
-			cv::cvtColor(mTemp, gray, cv::COLOR_BGR2GRAY);
-			cv::Laplacian(gray, edge, CV_8U);
-			cv::cvtColor(edge, edge, cv::COLOR_GRAY2BGR);
-
-			cv::cvtColor(refCarImg, gray, cv::COLOR_BGR2GRAY);
-			cv::Laplacian(gray, edgeTempl, CV_8U);
-			cv::cvtColor(edgeTempl, edgeTempl, cv::COLOR_GRAY2BGR);
-			cv::matchTemplate(edge, edgeTempl, mDataTemp, cv::TM_CCOEFF_NORMED);
-			cv::minMaxLoc(mDataTemp, nullptr, &maxValueArray[0], nullptr, &mMaxLocArray[0]);
+			/* エッジによるテンプレートマッチング, 3チャンネルとも同じ値なので1チャンネルで行う */
+			/* 部分画像のラプラシアンは外側の画素も参照するので, 探索範囲全体で求めたものと一致する */
+			const cv::Rect edgeRect(searchRects[0].tl(), searchRects[0].size() + crefCarImg.size() - cv::Size(1, 1));
+			cv::Laplacian(refBuffers.gray(edgeRect), refBuffers.edge, CV_8U);
+			if (crefParams.binaryEdge)
+				maxValueArray[0] = MatchBinaryEdge(refBuffers.edge, refFeatures, crefParams.edgeBinThr, refBuffers, maxLocArray[0]);
+			else
+			{
+				MatchEdge(refBuffers.edge, refFeatures, refBuffers);
+				cv::minMaxLoc(refResult, nullptr, &maxValueArray[0], nullptr, &maxLocArray[0]);
+			}
+			maxLocArray[0] += searchRects[0].tl();
 			/* end */
 
 			/* カラーによるテンプレートマッチング */
-			cv::matchTemplate(mTemp, refCarImg, mDataTemp, cv::TM_CCOEFF_NORMED);
-			cv::minMaxLoc(mDataTemp, nullptr, &maxValueArray[1], nullptr, &mMaxLocArray[1]);
+			const cv::Rect colorRect(searchRects[1].tl(), searchRects[1].size() + crefCarImg.size() - cv::Size(1, 1));
+			cv::matchTemplate(refNearImg(colorRect), crefCarImg, refResult, cv::TM_CCOEFF_NORMED);
+			cv::minMaxLoc(refResult, nullptr, &maxValueArray[1], nullptr, &maxLocArray[1]);
+			maxLocArray[1] += searchRects[1].tl();
 			/* end */
+		}
+
+		const auto better = (maxValueArray[0] <= maxValueArray[1]) ? 1 : 0;
+		refTask.maxLoc = maxLocArray[better];
+		refTask.maxValue = maxValueArray[better];
+	}
+
+	/// <summary>
+	/// 縮小段で粗くマッチングし, 原寸で探す範囲をモダリティごとに一致位置の近傍へ絞る
+	/// </summary>
+	/// <param name="crefTask">マッチング対象, 探索範囲とテンプレートは確定済み</param>
+	/// <param name="refBuffers">作業領域</param>
+	/// <param name="level">縮小段</param>
+	/// <param name="searchRects">結果画像上の探索範囲, エッジ・カラーの順. 絞れなければ変えない</param>
+	void CarsTracer::MatchCoarse(const MatchTask& crefTask, MatchBuffers& refBuffers, const int& level, cv::Rect(&searchRects)[2]) const
+	{
+		auto& refFeatures = crefTask.cache->features;
+		const auto& crefCoarseFrame = mFramePyramid[level];
+		const auto scale = 1 << level;
+		double maxValue = 0.0;
+		cv::Point maxLocArray[2]{};
+
+		/* 縮小テンプレートは段ごとに一度だけ作る */
+		for (int finerLevel = 0; finerLevel < level; finerLevel++)
+		{
+			auto& refCoarseColor = refFeatures.coarseColors[finerLevel + 1];
+			if (!refCoarseColor.empty())
+				continue;
+			cv::pyrDown((finerLevel == 0) ? *crefTask.carImg : refFeatures.coarseColors[finerLevel], refCoarseColor);
+			cv::cvtColor(refCoarseColor, refBuffers.coarseGray, cv::COLOR_BGR2GRAY);
+			cv::Laplacian(refBuffers.coarseGray, refFeatures.coarseEdges[finerLevel + 1], CV_8U);
+		}
+		const auto& crefCoarseColor = refFeatures.coarseColors[level];
+		const auto& crefCoarseEdge = refFeatures.coarseEdges[level];
+		/* end */
+
+		/* 探索範囲を縮小段の座標に移す, 端数は外側に広げる */
+		const auto nearX = static_cast<int>(crefTask.nearRect.x);
+		const auto nearY = static_cast<int>(crefTask.nearRect.y);
+		const auto nearSize = refBuffers.nearImg.size();
+		const auto coarseX = nearX / scale;
+		const auto coarseY = nearY / scale;
+		const auto coarseRect = cv::Rect(coarseX, coarseY, (nearX + nearSize.width + scale - 1) / scale - coarseX, (nearY + nearSize.height + scale - 1) / scale - coarseY)
+			& cv::Rect(0, 0, crefCoarseFrame.cols, crefCoarseFrame.rows);
+		if ((coarseRect.width < crefCoarseColor.cols) || (coarseRect.height < crefCoarseColor.rows))
+			return;
+		const auto coarseNearImg = crefCoarseFrame(coarseRect);
+		/* end */
+
+		/* エッジによる粗いマッチング */
+		cv::cvtColor(coarseNearImg, refBuffers.coarseGray, cv::COLOR_BGR2GRAY);
+		cv::Laplacian(refBuffers.coarseGray, refBuffers.coarseEdge, CV_8U);
+		cv::matchTemplate(refBuffers.coarseEdge, crefCoarseEdge, refBuffers.result, cv::TM_CCOEFF_NORMED);
+		cv::minMaxLoc(refBuffers.result, nullptr, &maxValue, nullptr, &maxLocArray[0]);
+		/* end */
+
+		/* カラーによる粗いマッチング */
+		cv::matchTemplate(coarseNearImg, crefCoarseColor, refBuffers.result, cv::TM_CCOEFF_NORMED);
+		cv::minMaxLoc(refBuffers.result, nullptr, &maxValue, nullptr, &maxLocArray[1]);
+		/* end */
+
+		/* 原寸に戻した一致位置の前後1段分だけを探索範囲とする */
+		for (int modality = 0; modality < 2; modality++)
+		{
+			const auto x = (coarseRect.x + maxLocArray[modality].x) * scale - nearX;
+			const auto y = (coarseRect.y + maxLocArray[modality].y) * scale - nearY;
+			const auto refineRect = cv::Rect(x - scale, y - scale, scale * 2 + 1, scale * 2 + 1) & searchRects[modality];
+			if (!refineRect.empty())
+				searchRects[modality] = refineRect;
+		}
+		/* end */
+	}
+
+	/// <summary>
+	/// テンプレートが変わっていればマッチング用特徴量を作り直す
+	/// </summary>
+	/// <param name="crefCarImg">テンプレート</param>
+	/// <param name="refFeatures">マッチング用特徴量</param>
+	void CarsTracer::UpdateFeatures(const Image& crefCarImg, MatchFeatures& refFeatures)
+	{
+		if ((refFeatures.source == crefCarImg.data) && (refFeatures.sourceSize == crefCarImg.size()))
+			return;
+
+		cv::cvtColor(crefCarImg, refFeatures.gray, cv::COLOR_BGR2GRAY);
+		cv::Laplacian(refFeatures.gray, refFeatures.edge, CV_8U);
+
+		/* cv::matchTemplateと同じく, 平均と標準偏差からノルムを求める */
+		cv::Scalar mean, stdDev;
+		cv::meanStdDev(refFeatures.edge, mean, stdDev);
+		refFeatures.edgeMean = mean[0];
+		refFeatures.edgeNorm = stdDev[0] * std::sqrt(static_cast<double>(refFeatures.edge.total()));
+		/* end */
+
+		refFeatures.colorAbsDev = CalcSadStats(crefCarImg, refFeatures.colorRowSums);
+		refFeatures.edgeAbsDev = CalcSadStats(refFeatures.edge, refFeatures.edgeRowSums);
+		refFeatures.edgeBits.clear(); // 二値エッジテンプレートは次に使うときに作り直す
+		for (auto& refCoarse : refFeatures.coarseColors)
+			refCoarse.release(); // 縮小テンプレートは次に使うときに作り直す
+		for (auto& refCoarse : refFeatures.coarseEdges)
+			refCoarse.release();
+
+		refFeatures.source = crefCarImg.data;
+		refFeatures.sourceSize = crefCarImg.size();
+	}
+
+	/// <summary>
+	/// 1チャンネルのエッジ画像でcv::TM_CCOEFF_NORMEDのマッチングを行う. テンプレートの平均とノルムはキャッシュしたものを使う
+	/// </summary>
+	/// <param name="crefEdge">探索範囲のエッジ画像</param>
+	/// <param name="crefFeatures">マッチング用特徴量</param>
+	/// <param name="refBuffers">作業領域, resultに結果を書き込む</param>
+	void CarsTracer::MatchEdge(const Image& crefEdge, const MatchFeatures& crefFeatures, MatchBuffers& refBuffers)
+	{
+		auto& refResult = refBuffers.result;
+		const auto& crefTempl = crefFeatures.edge;
+		if ((crefEdge.rows < crefTempl.rows) || (crefEdge.cols < crefTempl.cols))
+		{
+			cv::matchTemplate(crefEdge, crefTempl, refResult, cv::TM_CCOEFF_NORMED); // テンプレートの方が大きいときの扱いはOpenCVに任せる
+			return;
+		}
+
+		cv::matchTemplate(crefEdge, crefTempl, refResult, cv::TM_CCORR); // 相互相関だけ求め, 正規化は以下で行う
+		if (crefFeatures.edgeNorm * crefFeatures.edgeNorm < DBL_EPSILON * crefTempl.total())
+		{
+			refResult.setTo(1.0); // 平坦なテンプレート, cv::matchTemplateと同じく1とする
+			return;
+		}
 
-			if (maxValueArray[0] <= maxValueArray[1])
+		/* 窓内の和と2乗和で平均を引いた相関に直し, ノルムで割る */
+		cv::integral(crefEdge, refBuffers.sum, refBuffers.sqSum, CV_64F, CV_64F);
+		const auto invArea = 1.0 / static_cast<double>(crefTempl.total());
+		const auto templH = crefTempl.rows;
+		const auto templW = crefTempl.cols;
+		for (int y = 0; y < refResult.rows; y++)
+		{
+			auto resultPtr = refResult.ptr<float>(y);
+			const auto sumTop = refBuffers.sum.ptr<double>(y);
+			const auto sumBottom = refBuffers.sum.ptr<double>(y + templH);
+			const auto sqSumTop = refBuffers.sqSum.ptr<double>(y);
+			const auto sqSumBottom = refBuffers.sqSum.ptr<double>(y + templH);
+			for (int x = 0; x < refResult.cols; x++)
 			{
-				mMaxLoc = mMaxLocArray[1];
-				maxValue = maxValueArray[1];
+				const auto wndSum = sumTop[x] - sumTop[x + templW] - sumBottom[x] + sumBottom[x + templW];
+				const auto wndSqSum = sqSumTop[x] - sqSumTop[x + templW] - sqSumBottom[x] + sqSumBottom[x + templW];
+				auto num = resultPtr[x] - wndSum * crefFeatures.edgeMean;
+				const auto denom = std::sqrt(std::max(wndSqSum - wndSum * wndSum * invArea, 0.0)) * crefFeatures.edgeNorm;
+
+				/* 丸め誤差で1をわずかに超えたものは1に丸め, 明らかに超えたもの(平坦な窓)は0とする */
+				if (std::abs(num) < denom)
+					num /= denom;
+				else if (std::abs(num) < denom * 1.125)
+					num = (num > 0) ? 1.0 : -1.0;
+				else
+					num = 0.0;
+				/* end */
+				resultPtr[x] = static_cast<float>(num);
 			}
-			else
+		}
+		/* end */
+	}
+
+	/// <summary>
+	/// テンプレートの行ごと, チャンネルごとの和と, チャンネルごとの平均との差の絶対値和を求める
+	/// </summary>
+	/// <param name="crefTempl">テンプレート, CV_8UC1かCV_8UC3</param>
+	/// <param name="refRowSums">行ごと, チャンネルごとの和</param>
+	/// <returns>平均との差の絶対値和</returns>
+	double CarsTracer::CalcSadStats(const Image& crefTempl, std::vector<int>& refRowSums)
+	{
+		const auto channels = crefTempl.channels();
+		refRowSums.assign(static_cast<size_t>(crefTempl.rows) * channels, 0);
+		for (int y = 0; y < crefTempl.rows; y++)
+		{
+			const auto templPtr = crefTempl.ptr<uchar>(y);
+			auto rowSumsPtr = refRowSums.data() + static_cast<size_t>(y) * channels;
+			for (int x = 0; x < crefTempl.cols * channels; x++)
+				rowSumsPtr[x % channels] += templPtr[x];
+		}
+
+		const auto mean = cv::mean(crefTempl);
+		double absDev = 0.0;
+		for (int y = 0; y < crefTempl.rows; y++)
+		{
+			const auto templPtr = crefTempl.ptr<uchar>(y);
+			for (int x = 0; x < crefTempl.cols * channels; x++)
+				absDev += std::abs(templPtr[x] - mean[x % channels]);
+		}
+		return absDev;
+	}
+
+	/// <summary>
+	/// 差の絶対値和(SAD)が最小の位置を全探索する. 行和の差は差の絶対値和を超えないので, その和が暫定最小値以上の位置は計算しない
+	/// </summary>
+	/// <param name="crefImg">探索範囲, テンプレートと同じ型</param>
+	/// <param name="crefTempl">テンプレート</param>
+	/// <param name="crefRowSums">テンプレートの行ごと, チャンネルごとの和</param>
+	/// <param name="refBuffers">作業領域</param>
+	/// <param name="refMinLoc">SADが最小の位置, 同じ値なら先に走査した位置</param>
+	/// <returns>最小のSAD</returns>
+	uint64_t CarsTracer::MatchSad(const Image& crefImg, const Image& crefTempl, const std::vector<int>& crefRowSums, MatchBuffers& refBuffers, cv::Point& refMinLoc)
+	{
+		const auto channels = crefImg.channels();
+		const auto templH = crefTempl.rows;
+		const auto rowBytes = crefTempl.cols * channels;
+		auto& refSum = refBuffers.sadSum;
+		cv::integral(crefImg, refSum, CV_32S);
+
+		auto minSad = std::numeric_limits<uint64_t>::max();
+		refMinLoc = cv::Point(0, 0);
+		for (int y = 0; y <= crefImg.rows - templH; y++)
+		{
+			for (int x = 0; x <= crefImg.cols - crefTempl.cols; x++)
 			{
-				mMaxLoc = mMaxLocArray[0];
-				maxValue = maxValueArray[0];
+				/* 下界: 行ごと, チャンネルごとの和の差の絶対値和 */
+				uint64_t bound = 0;
+				for (int r = 0; (r < templH) && (bound < minSad); r++)
+				{
+					const auto sumTop = refSum.ptr<int>(y + r);
+					const auto sumBottom = refSum.ptr<int>(y + r + 1);
+					const auto left = x * channels;
+					const auto right = (x + crefTempl.cols) * channels;
+					const auto rowSums = crefRowSums.data() + static_cast<size_t>(r) * channels;
+					for (int c = 0; c < channels; c++)
+					{
+						const auto rowSum = sumBottom[right + c] - sumTop[right + c] - sumBottom[left + c] + sumTop[left + c];
+						bound += static_cast<uint64_t>(std::abs(rowSum - rowSums[c]));
+					}
+				}
+				if (bound >= minSad)
+					continue;
+				/* end */
+
+				/* 差の絶対値和, 行ごとに暫定最小値を超えたら打ち切る */
+				uint64_t sad = 0;
+				for (int r = 0; (r < templH) && (sad < minSad); r++)
+				{
+					const auto imgPtr = crefImg.ptr<uchar>(y + r) + x * channels;
+					const auto templPtr = crefTempl.ptr<uchar>(r);
+					int i = 0;
+#if CV_SIMD
+					for (; i <= rowBytes - cv::v_uint8::nlanes; i += cv::v_uint8::nlanes)
+						sad += cv::v_reduce_sad(cv::vx_load(imgPtr + i), cv::vx_load(templPtr + i));
+#endif
+					for (; i < rowBytes; i++)
+						sad += static_cast<uint64_t>(std::abs(imgPtr[i] - templPtr[i]));
+				}
+				if (sad < minSad)
+				{
+					minSad = sad;
+					refMinLoc = cv::Point(x, y);
+				}
+				/* end */
 			}
+		}
+#if CV_SIMD
+		cv::vx_cleanup();
+#endif
+		return minSad;
+	}
 
-			if (maxValue < crefParams.minMatchingThr)
+	/// <summary>
+	/// エッジ画像を二値化し, 行ごとに64bit語へ詰める. x番目の画素は(x / 64)番目の語の(x % 64)番目のビット
+	/// </summary>
+	/// <param name="crefEdge">エッジ画像, CV_8UC1</param>
+	/// <param name="thr">閾値, これより大きい画素をエッジとする</param>
+	/// <param name="rowWords">1行の語数, 画素数以上であること</param>
+	/// <param name="refBits">詰めたビット列</param>
+	/// <returns>エッジ画素数</returns>
+	int CarsTracer::PackEdgeBits(const Image& crefEdge, const int& thr, const int& rowWords, std::vector<uint64_t>& refBits)
+	{
+		int ones = 0;
+		refBits.assign(static_cast<size_t>(crefEdge.rows) * rowWords, 0);
+		for (int y = 0; y < crefEdge.rows; y++)
+		{
+			const auto edgePtr = crefEdge.ptr<uchar>(y);
+			auto bitsPtr = refBits.data() + static_cast<size_t>(y) * rowWords;
+			for (int x = 0; x < crefEdge.cols; x++)
+			{
+				if (edgePtr[x] <= thr)
+					continue;
+				bitsPtr[x >> 6] |= uint64_t(1) << (x & 63);
+				ones++;
+			}
+		}
+		return ones;
+	}
+
+	/// <summary>
+	/// 二値エッジのハミング距離によるマッチング. XORとpopcountで距離を求め, 二値画像どうしの相関係数に直して最大の位置を探す
+	/// 相関係数は0と1の画像にcv::TM_CCOEFF_NORMEDを適用したものと等しい
+	/// </summary>
+	/// <param name="crefEdge">探索範囲のエッジ画像</param>
+	/// <param name="refFeatures">マッチング用特徴量, 二値エッジテンプレートがなければ作る</param>
+	/// <param name="thr">二値化の閾値</param>
+	/// <param name="refBuffers">作業領域</param>
+	/// <param name="refMaxLoc">相関係数が最大の位置, 同じ値なら先に走査した位置</param>
+	/// <returns>最大の相関係数</returns>
+	double CarsTracer::MatchBinaryEdge(const Image& crefEdge, MatchFeatures& refFeatures, const int& thr, MatchBuffers& refBuffers, cv::Point& refMaxLoc)
+	{
+		const auto& crefTempl = refFeatures.edge;
+		const auto templWords = (crefTempl.cols + 63) / 64;
+		const auto imgWords = (crefEdge.cols + 63) / 64 + 1; // ずらして読むときに次の語も読むので1語足す
+		const auto lastMask = ((crefTempl.cols & 63) == 0) ? ~uint64_t(0) : ((uint64_t(1) << (crefTempl.cols & 63)) - 1); // 行末の語の有効ビット
+		if (refFeatures.edgeBits.empty())
+			refFeatures.edgeOnes = PackEdgeBits(crefTempl, thr, templWords, refFeatures.edgeBits);
+		PackEdgeBits(crefEdge, thr, imgWords, refBuffers.edgeBits);
+
+		/* 0と1の画像の相関係数は, 画素数, 各々の1の数, 共通の1の数だけで決まる */
+		const auto pixelsNum = static_cast<double>(crefTempl.total());
+		const auto templOnes = static_cast<double>(refFeatures.edgeOnes);
+		const auto templVar = templOnes * (pixelsNum - templOnes);
+		auto maxValue = -std::numeric_limits<double>::infinity();
+		refMaxLoc = cv::Point(0, 0);
+		for (int y = 0; y <= crefEdge.rows - crefTempl.rows; y++)
+		{
+			for (int x = 0; x <= crefEdge.cols - crefTempl.cols; x++)
+			{
+				const auto wordIdx = x >> 6;
+				const auto shift = x & 63;
+				uint64_t distance = 0, ones = 0;
+				for (int r = 0; r < crefTempl.rows; r++)
+				{
+					const auto imgPtr = refBuffers.edgeBits.data() + static_cast<size_t>(y + r) * imgWords + wordIdx;
+					const auto templPtr = refFeatures.edgeBits.data() + static_cast<size_t>(r) * templWords;
+					for (int k = 0; k < templWords; k++)
+					{
+						auto word = (shift == 0) ? imgPtr[k] : ((imgPtr[k] >> shift) | (imgPtr[k + 1] << (64 - shift)));
+						if (k == templWords - 1)
+							word &= lastMask;
+						distance += std::popcount(word ^ templPtr[k]);
+						ones += std::popcount(word);
+					}
+				}
+
+				const auto imgOnes = static_cast<double>(ones);
+				const auto commonOnes = (templOnes + imgOnes - static_cast<double>(distance)) * 0.5;
+				const auto denom = std::sqrt(templVar * imgOnes * (pixelsNum - imgOnes));
+				const auto value = (denom > 0.0) ? (pixelsNum * commonOnes - templOnes * imgOnes) / denom : 0.0; // どちらかが一様なら相関なしとする
+				if (value > maxValue)
+				{
+					maxValue = value;
+					refMaxLoc = cv::Point(x, y);
+				}
+			}
+		}
+		/* end */
+		return maxValue;
+	}
+
+	/// <summary>
+	/// 観測した車両位置で運動モデルを更新する
+	/// </summary>
+	/// <param name="refMotion">運動モデル</param>
+	/// <param name="crefCarPos">観測した車両位置</param>
+	/// <param name="gain">平滑化の重み</param>
+	void CarsTracer::UpdateMotion(MotionState& refMotion, const cv::Rect2d& crefCarPos, const double& gain)
+	{
+		const auto observed = crefCarPos.tl() - refMotion.lastPos; // 今回の移動量
+		const auto residual = observed - refMotion.velocity; // 予測位置と観測位置の差
+		const cv::Point2d absResidual(std::abs(residual.x), std::abs(residual.y));
+		switch (refMotion.updatesNum)
+		{
+		case 0: // 速度の初期値は最初の移動量
+			refMotion.velocity = observed;
+			break;
+		case 1: // 誤差の初期値は最初の予測の外れ幅
+			refMotion.error = absResidual;
+			refMotion.velocity += gain * residual;
+			break;
+		default:
+			refMotion.error += gain * (absResidual - refMotion.error);
+			refMotion.velocity += gain * residual;
+			break;
+		}
+		refMotion.lastPos = crefCarPos.tl();
+		refMotion.updatesNum++;
+	}
+
+	/// <summary>
+	/// 車両追跡, マッチング結果を車両番号順に反映する
+	/// </summary>
+	/// <param name="idx">道路マスク番号</param>
+	void CarsTracer::TraceCars(const size_t& idx)
+	{
+		const auto& crefParams = mContext.GetTracerParams();
+		const auto& crefMotionGain = mContext.GetTemplateHandleParams().motionGain;
+		auto& refResultImg = mFrameData->resultImg;
+
+		/* 検出済み車両ごとに処理 */
+		for (auto taskIdx = mLaneTaskBegins[idx]; taskIdx < mLaneTaskBegins[idx + 1]; taskIdx++)
+		{
+			const auto& crefTask = mMatchTasks[taskIdx];
+			const auto& carId = crefTask.carId;
+			auto& refCarPos = *crefTask.carPos;
+			if (crefTask.maxValue < crefParams.minMatchingThr)
 			{
 				mDeleteLists.push_back(std::pair(idx, carId));
+				AddRecord(idx, carId, refCarPos, crefTask.maxValue, TrackEvent::LOST);
 				continue;
 			}
-			/* end */
 
-			refCarPos.x = mNearRect.x + mMaxLoc.x;
-			refCarPos.y = mNearRect.y + mMaxLoc.y;
-			cv::rectangle(refResultImg, refCarPos, cv::Scalar(0, 0, 255), 3);
+			refCarPos.x = crefTask.nearRect.x + crefTask.maxLoc.x;
+			refCarPos.y = crefTask.nearRect.y + crefTask.maxLoc.y;
+			if (crefMotionGain > 0.0)
+				UpdateMotion(crefTask.cache->motion, refCarPos, crefMotionGain);
+			if (mIsRendering)
+				cv::rectangle(refResultImg, refCarPos, cv::Scalar(0, 0, 255), 3);
+			const auto deleteNum = mDeleteLists.size();
 			JudgeStopTraceAndDetect(idx, carId, refCarPos); // 追跡終了判定
-			//std::string path = "./template_" + std::to_string(Tk::GetFrameCount()) + "_" + std::to_string(carId) + ".png";
-			//cv::imwrite(path, refTemplates[carId]);
+			AddRecord(idx, carId, refCarPos, crefTask.maxValue, (mDeleteLists.size() > deleteNum) ? TrackEvent::FINISHED : TrackEvent::TRACED);
+			//std::string path = "./template_" + std::to_string(mFrameData->frameCount) + "_" + std::to_string(carId) + ".png";
+			//cv::imwrite(path, *crefTask.carImg);
 		}
 		/* end */
 		DestructTracedCars(); // 追跡終了処理
@@ -125,9 +651,9 @@ namespace ImgProc
 	/// <param name="carPos">車両位置</param>
 	void CarsTracer::JudgeStopTraceAndDetect(const size_t& idx, const uint64_t& carId, const cv::Rect2d& carPos)
 	{
-		const auto& crefRoadCarsDirection = Tk::GetRoadCarsDirections()[idx];
-		const auto& crefDetectArea = Tk::GetDetectAreaInf();
-		auto& refBoundaryCarIdList = Tk::GetBoundaryCarIdLists()[idx];
+		const auto& crefRoadCarsDirection = mContext.GetRoadCarsDirections()[idx];
+		const auto& crefDetectArea = mContext.GetDetectAreaInf();
+		auto& refBoundaryCarIdList = mContext.GetBoundaryCarIdLists()[idx];
 		auto carPosBottom = carPos.br();
 		/* 追跡終了位置か, 新規車両かどうかの判別 */
 		switch (crefRoadCarsDirection)
@@ -155,16 +681,17 @@ namespace ImgProc
 	/// </summary>
 	void CarsTracer::DestructTracedCars()
 	{
-		auto& refTemplatesList = Tk::GetTemplatesList();
-		auto& refTemplatePositionsList = Tk::GetTemplatePositionsList();
-		auto& refBoundaryCarIdLists = Tk::GetBoundaryCarIdLists();
-		auto& refFrontCarId = Tk::GetFrontCarId();
+		auto& refTemplatesList = mContext.GetTemplatesList();
+		auto& refTemplatePositionsList = mContext.GetTemplatePositionsList();
+		auto& refBoundaryCarIdLists = mContext.GetBoundaryCarIdLists();
+		auto& refFrontCarId = mContext.GetFrontCarId();
 		/* 追跡終了車両をデータから除外 */
 		for (const auto& [roadIdx, carId] : mDeleteLists)
 		{
 			refTemplatesList[roadIdx].erase(carId);
 			refTemplatePositionsList[roadIdx].erase(carId);
 			refBoundaryCarIdLists[roadIdx].erase(carId);
+			mTrackCachesList[roadIdx].erase(carId);
 			if (carId == refFrontCarId)
 				refFrontCarId++;
 		}
@@ -178,35 +705,31 @@ namespace ImgProc
 	/// <param name="idx"></param>
 	void CarsTracer::DetectNewCars(const size_t& idx)
 	{
-		const auto& crefFrame = Tk::GetFrame();
-		const auto& crefDetectArea = Tk::GetDetectAreaInf();
-		const auto& crefParams = Tk::GetTracerParams();
-		auto& refCarsNum = Tk::GetCarsNum();
-		auto& refFrameCarsNum = Tk::GetFrameCarsNum();
-		auto& refResultImg = Tk::GetResult();
-		auto& refTemplates = Tk::GetTemplatesList()[idx];
-		auto& refTemplatePositions = Tk::GetTemplatePositionsList()[idx];
-		auto& refBoundaryCarIdList = Tk::GetBoundaryCarIdLists()[idx];
-
-		/* 各領域ごとの処理, 0番は背景 */
-		for (int label = 1; label < mLabelNum; label++)
+		const auto& crefFrame = mFrameData->frame;
+		const auto& crefDetectArea = mContext.GetDetectAreaInf();
+		const auto& crefProcessRoi = mContext.GetProcessRoi();
+		const auto& crefParams = mContext.GetTracerParams();
+		auto& refCarsNum = mContext.GetCarsNum();
+		auto& refFrameCarsNum = mContext.GetFrameCarsNum();
+		auto& refResultImg = mFrameData->resultImg;
+		auto& refTemplates = mContext.GetTemplatesList()[idx];
+		auto& refTemplatePositions = mContext.GetTemplatePositionsList()[idx];
+		auto& refBoundaryCarIdList = mContext.GetBoundaryCarIdLists()[idx];
+
+		/* 面積で車両でない領域を除く, 0番は背景 */
+		mLabelFilter.Build(mStats, mLabelNum, [&](const LabelFilter::Stats& stats)
 		{
-			/* 統計情報分割 */
-			auto statsPtr = mStats.ptr<int>(label);
-			auto& x = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_LEFT];
-			auto& y = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_TOP];
-			auto& width = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_WIDTH];
-			auto& height = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_HEIGHT];
-			auto& area = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_AREA];
-			/* end */
-
-			if (area < width * height * crefParams.minAreaRatio) // 外周や直線だけで面積を稼いでるラベルを除外
-				continue;
-
-			if (area < (y - crefDetectArea.top) / 4 + crefParams.detectAreaThr)
-				continue;
+			const auto y = stats.y + crefProcessRoi.y; // 処理範囲からフレーム全体の座標に戻す
+			return (stats.area >= stats.width * stats.height * crefParams.minAreaRatio) // 外周や直線だけで面積を稼いでるラベルを除外
+				&& (stats.area >= (y - crefDetectArea.top) / 4 + crefParams.detectAreaThr);
+		});
+		/* end */
 
-			cv::Rect2d carPosRect(x, y, width, height);
+		/* 残った領域ごとの処理 */
+		for (const auto& label : mLabelFilter.GetKeptLabels())
+		{
+			const auto stats = LabelFilter::ReadStats(mStats, label);
+			cv::Rect2d carPosRect(stats.x + crefProcessRoi.x, stats.y + crefProcessRoi.y, stats.width, stats.height); // 処理範囲からフレーム全体の座標に戻す
 			bool doesntDetectCar = false;
 			ReExtractTemplate(carPosRect); // テンプレート再抽出
 
@@ -216,7 +739,7 @@ namespace ImgProc
 				// 検出開始位置近傍の車両を特定, 未検出車両なら車両IDを保存
 				// 1フレーム目は, 車両として検出しても, IDを保存しないものもあることに注意
 				/* 1フレーム目で検出されない領域を除外 */
-				if (Tk::GetFrameCount() == Tk::GetStartFrame())
+				if (mFrameData->frameCount == mContext.GetStartFrame())
 				{
 					doesntDetectCar = (finPos.y < (crefDetectArea.top + crefDetectArea.mergin + crefDetectArea.merginPad))
 						|| (finPos.br().y >(crefDetectArea.bottom - crefDetectArea.mergin - crefDetectArea.merginPad));
@@ -235,14 +758,18 @@ namespace ImgProc
 				refBoundaryCarIdList.insert(refCarsNum); // 新規検出車両として登録
 				mTemp = ExtractTemplate(crefFrame, finPos);
 
-				cv::rectangle(refResultImg, finPos, cv::Scalar(255, 0, 0), 3); // 矩形を描く
+				if (mIsRendering)
+					cv::rectangle(refResultImg, finPos, cv::Scalar(255, 0, 0), 3); // 矩形を描く
 
 				/* テンプレート抽出・保存 */
 				refTemplates.insert(std::pair(refCarsNum, mTemp));
 				refTemplatePositions.insert(std::pair(refCarsNum, finPos));
 				/* end */
 
+				AddRecord(idx, refCarsNum, finPos, 0.0, TrackEvent::NEW);
+
 				/* 検出台数を更新 */
+				mContext.GetCarFirstFrames().push_back(mFrameData->frameCount); // 車両IDを添え字として初検出フレームを記録
 				refCarsNum++;
 				refFrameCarsNum++;
 				/* end */
@@ -261,8 +788,8 @@ namespace ImgProc
 	bool CarsTracer::IsntDetectedCars(const size_t& idx, const cv::Rect2d& carPos)
 	{
 		/* 検出位置チェック */
-		const auto& crefRoadCarsDirection = Tk::GetRoadCarsDirections()[idx];
-		const auto& crefDetectArea = Tk::GetDetectAreaInf();
+		const auto& crefRoadCarsDirection = mContext.GetRoadCarsDirections()[idx];
+		const auto& crefDetectArea = mContext.GetDetectAreaInf();
 		bool doesntDetectCar = true;
 		auto carPosBottom = carPos.br();
 
@@ -283,7 +810,7 @@ namespace ImgProc
 		/* end */
 
 		/* 2フレーム目以降は, 検出開始地点から遠い車両を検出しない */
-		if (doesntDetectCar && (Tk::GetFrameCount() > Tk::GetStartFrame()))
+		if (doesntDetectCar && (mFrameData->frameCount > mContext.GetStartFrame()))
 			return true;
 
 		return false;
@@ -297,9 +824,9 @@ namespace ImgProc
 	/// <returns>判定結果, trueなら検出しない</returns>
 	bool CarsTracer::DoesntAddBoundCar(const size_t& idx, const cv::Rect2d& carPosRect)
 	{
-		const auto& crefDetectArea = Tk::GetDetectAreaInf();
-		const auto& crefBoundaryCarIdList = Tk::GetBoundaryCarIdLists()[idx];
-		auto& crefTemplatePositions = Tk::GetTemplatePositionsList()[idx];
+		const auto& crefDetectArea = mContext.GetDetectAreaInf();
+		const auto& crefBoundaryCarIdList = mContext.GetBoundaryCarIdLists()[idx];
+		auto& crefTemplatePositions = mContext.GetTemplatePositionsList()[idx];
 		bool retFlag = false;
 		for (const auto& elem : crefBoundaryCarIdList)
 		{
@@ -324,12 +851,35 @@ namespace ImgProc
 		return retFlag;
 	}
 
+	/// <summary>
+	/// 処理中のフレームの検出ログに1行追加. 検出ログが無効なら何もしない
+	/// </summary>
+	/// <param name="idx">道路マスク番号</param>
+	/// <param name="carId">車両番号</param>
+	/// <param name="carPos">車両位置</param>
+	/// <param name="score">テンプレートの相関</param>
+	/// <param name="event">イベント種別</param>
+	void CarsTracer::AddRecord(const size_t& idx, const uint64_t& carId, const cv::Rect2d& carPos, const double& score, const TrackEvent& event)
+	{
+		if (!mIsLogging)
+			return;
+
+		DetectionRecord record;
+		record.frameCount = mFrameData->frameCount;
+		record.roadIdx = static_cast<uint32_t>(idx);
+		record.carId = carId;
+		record.position = carPos;
+		record.score = static_cast<float>(score);
+		record.event = event;
+		mFrameData->records.push_back(record);
+	}
+
 	/// <summary>
 	/// テンプレート再抽出
 	/// </summary>
 	/// <param name="carPos">車両位置</param>
 	void CarsTracer::ReExtractTemplate(const cv::Rect2d& carPos)
 	{
-		TemplateHandle::ReLabelingTemplate(mFinCarPosList, carPos);
+		mTemplateHandle->ReLabelingTemplate(mFinCarPosList, carPos, *mFrameData);
 	}
 };
\ No newline at end of file
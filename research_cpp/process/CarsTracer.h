@@ -1,39 +1,226 @@
 #pragma once
 #include "ImgProc.h"
+#include "LabelFilter.h"
+#include "LaneLabeler.h"
+
+#include <map>
+#include <unordered_map>
 
 class ImgProc::CarsTracer
 {
 private:
 	class TemplateHandle;
 
+	PipelineContext& mContext; // 実行コンテキスト
+	std::unique_ptr<TemplateHandle> mTemplateHandle; // テンプレート操作
+
+	static constexpr int MAX_PYRAMID_LEVEL = 2; // ピラミッドマッチングで縮小する最大の段数, 1段で1/2
+
+	/// <summary>
+	/// 追跡中車両のテンプレートの拡大・縮小段. 段は抽出時のテンプレートから作るので, 長く追跡してもぼやけない
+	/// </summary>
+	struct TemplateBank
+	{
+		Image original; // 抽出時のテンプレート
+		double scale = 1.0; // 抽出時からの累積倍率
+		std::map<int, Image> levels; // 段番号ごとのテンプレート, 段番号は累積倍率のscaleStepを底とする対数を丸めたもの
+	};
+
+	/// <summary>
+	/// 追跡中車両のマッチング用特徴量, テンプレートが拡大・縮小・再抽出されるまで使い回す
+	/// </summary>
+	struct MatchFeatures
+	{
+		const uchar* source = nullptr; // 作成元テンプレートの先頭, 拡大・縮小・再抽出で変わる
+		cv::Size sourceSize; // 作成元テンプレートの大きさ
+		Image gray; // グレースケールテンプレート
+		Image edge; // ラプラシアンによるエッジテンプレート, 1チャンネル
+		double edgeMean = 0.0; // エッジテンプレートの平均
+		double edgeNorm = 0.0; // エッジテンプレートから平均を引いたもののノルム
+		std::vector<int> colorRowSums; // テンプレートの行ごと, チャンネルごとの和. SADの下界に使う
+		std::vector<int> edgeRowSums; // エッジテンプレートの行ごとの和
+		double colorAbsDev = 0.0; // テンプレートのチャンネルごとの平均との差の絶対値和, SADを相関の尺度に直すのに使う
+		double edgeAbsDev = 0.0; // エッジテンプレートの平均との差の絶対値和
+		std::vector<uint64_t> edgeBits; // 二値エッジテンプレート, 行ごとに64bit語へ詰める. 必要になったときに作る
+		int edgeOnes = 0; // 二値エッジテンプレートのエッジ画素数
+		Image coarseColors[MAX_PYRAMID_LEVEL + 1]; // 段ごとの縮小テンプレート, 0番は使わない. 必要になった段だけ作る
+		Image coarseEdges[MAX_PYRAMID_LEVEL + 1]; // 段ごとの縮小テンプレートのエッジ, 1チャンネル
+	};
+
+	/// <summary>
+	/// 追跡中車両の等速運動モデル. 位置の観測ごとに速度と予測誤差を指数平滑で更新する
+	/// </summary>
+	struct MotionState
+	{
+		cv::Point2d lastPos; // 直前に観測した左上座標
+		cv::Point2d velocity; // 1フレームあたりの移動量
+		cv::Point2d error; // 予測位置と観測位置の差の絶対値の平滑値
+		int updatesNum = 0; // 観測回数, 2回目から速度と誤差が揃う
+	};
+
+	/// <summary>
+	/// 追跡中車両ごとに持つ, コンテキストには載せない状態
+	/// </summary>
+	struct TrackCache
+	{
+		TemplateBank bank; // テンプレートの拡大・縮小段
+		MatchFeatures features; // マッチング用特徴量, 古ければマッチング中に作り直す
+		MotionState motion; // 探索範囲の予測に使う運動モデル
+	};
+
+	/// <summary>
+	/// 追跡中車両1台分のテンプレートマッチング, 車両ごとに独立して並列に実行する
+	/// </summary>
+	struct MatchTask
+	{
+		size_t idx = 0; // 道路マスク番号
+		uint64_t carId = 0; // 車両番号
+		Image* carImg = nullptr; // テンプレート, マッチング中に使う段に差し替える
+		cv::Rect2d* carPos = nullptr; // 車両位置, マッチング中に大きさだけ更新する
+		TrackCache* cache = nullptr; // 車両ごとの状態, マッチング中は運動モデルを読むだけ
+		cv::Rect2d nearRect; // 探索範囲
+		cv::Point maxLoc; // 探索範囲内の一致位置
+		double maxValue = 0.0; // 相関
+	};
+
+	/// <summary>
+	/// テンプレートマッチングの作業領域, ワーカごとに持つ
+	/// </summary>
+	struct MatchBuffers
+	{
+		Image nearImg;
+		Image gray;
+		Image edge;
+		Image result;
+		Image sum; // エッジ画像の積分画像
+		Image sqSum; // エッジ画像の2乗の積分画像
+		Image sadSum; // SADの下界に使う積分画像
+		std::vector<uint64_t> edgeBits; // 探索範囲の二値エッジ, 行ごとに64bit語へ詰め, 末尾に0の語を足す
+		Image coarseGray; // 縮小段の探索範囲のグレースケール
+		Image coarseEdge; // 縮小段の探索範囲のエッジ
+	};
+
+	FrameData* mFrameData = nullptr; // 処理中のフレームバッファ, DetectCarsの間のみ有効
 	std::vector<std::pair<size_t, uint64_t>> mDeleteLists;
-	Image mTempFrame;
 	Image mTemp;
-	Image mDataTemp;
+
+	std::vector<MatchTask> mMatchTasks; // 全車線の追跡中車両, 車線順かつ車両番号順
+	std::vector<size_t> mLaneTaskBegins; // 車線ごとのmMatchTasksの先頭位置, 末尾は総数
+	std::vector<MatchBuffers> mMatchBuffers; // ワーカごとの作業領域
+	Image mFramePyramid[MAX_PYRAMID_LEVEL + 1]; // フレームの縮小段, 0番は原寸. ピラミッドマッチングのときフレームごとに一度だけ作る
+	std::vector<std::unordered_map<uint64_t, TrackCache>> mTrackCachesList; // 車線ごと, 車両番号ごとの状態
 
 	Image mLabels; //ラベル画像
 	Image mStats; //ラベリングにおける統計情報
 	Image mCentroids; //ラベリングにおける中心点座標群
+	LabelFilter mLabelFilter; // ラベルごとの取捨選択
+	LaneLabeler mLaneLabeler; // 車線ごとのラベリング, 道路マスク画像が重なっていれば使わない
 
 	int mLabelNum = 0; // ラベル数
-
-	cv::Point mMaxLoc;
-	cv::Point mMaxLocArray[2]{};
-	cv::Rect2d mNearRect;
+	bool mIsRendering = true; // 結果画像を描画するか, 結果のタップポイントを出力しないフレームでは描画しない
+	bool mIsLogging = false; // 検出ログを記録するか
 
 	std::vector<cv::Rect> mFinCarPosList;
 public:
-	CarsTracer();
+	explicit CarsTracer(PipelineContext& context);
+	~CarsTracer();
 
 	/// <summary>
 	/// 車両検出
 	/// </summary>
-	void DetectCars();
+	/// <param name="frameData">フレームバッファ, frame, backImg, carsImgを読んでresultImgを書き込む</param>
+	void DetectCars(FrameData& frameData);
 private:
 	CarsTracer(const CarsTracer& other) = delete;
 
 	/// <summary>
-	/// 車両追跡
+	/// 全車線の追跡中車両のテンプレートマッチングを並列に行う
+	/// 空いたワーカが次の車両を取りに行くので, 車線ごとの台数の偏りに左右されない
+	/// </summary>
+	void MatchTrackedCars();
+
+	/// <summary>
+	/// 車両1台分のテンプレートマッチング. 他の車両の状態は読み書きしない
+	/// </summary>
+	/// <param name="refTask">マッチング対象, 結果を書き込む</param>
+	/// <param name="refBuffers">作業領域</param>
+	void MatchCar(MatchTask& refTask, MatchBuffers& refBuffers) const;
+
+	/// <summary>
+	/// テンプレートが変わっていればマッチング用特徴量を作り直す
+	/// </summary>
+	/// <param name="crefCarImg">テンプレート</param>
+	/// <param name="refFeatures">マッチング用特徴量</param>
+	static void UpdateFeatures(const Image& crefCarImg, MatchFeatures& refFeatures);
+
+	/// <summary>
+	/// 縮小段で粗くマッチングし, 原寸で探す範囲をモダリティごとに一致位置の近傍へ絞る
+	/// </summary>
+	/// <param name="crefTask">マッチング対象, 探索範囲とテンプレートは確定済み</param>
+	/// <param name="refBuffers">作業領域</param>
+	/// <param name="level">縮小段</param>
+	/// <param name="searchRects">結果画像上の探索範囲, エッジ・カラーの順. 絞れなければ変えない</param>
+	void MatchCoarse(const MatchTask& crefTask, MatchBuffers& refBuffers, const int& level, cv::Rect(&searchRects)[2]) const;
+
+	/// <summary>
+	/// 1チャンネルのエッジ画像でcv::TM_CCOEFF_NORMEDのマッチングを行う. テンプレートの平均とノルムはキャッシュしたものを使う
+	/// </summary>
+	/// <param name="crefEdge">探索範囲のエッジ画像</param>
+	/// <param name="crefFeatures">マッチング用特徴量</param>
+	/// <param name="refBuffers">作業領域, resultに結果を書き込む</param>
+	static void MatchEdge(const Image& crefEdge, const MatchFeatures& crefFeatures, MatchBuffers& refBuffers);
+
+	/// <summary>
+	/// 観測した車両位置で運動モデルを更新する
+	/// </summary>
+	/// <param name="refMotion">運動モデル</param>
+	/// <param name="crefCarPos">観測した車両位置</param>
+	/// <param name="gain">平滑化の重み</param>
+	static void UpdateMotion(MotionState& refMotion, const cv::Rect2d& crefCarPos, const double& gain);
+
+	/// <summary>
+	/// テンプレートの行ごと, チャンネルごとの和と, チャンネルごとの平均との差の絶対値和を求める
+	/// </summary>
+	/// <param name="crefTempl">テンプレート, CV_8UC1かCV_8UC3</param>
+	/// <param name="refRowSums">行ごと, チャンネルごとの和</param>
+	/// <returns>平均との差の絶対値和</returns>
+	static double CalcSadStats(const Image& crefTempl, std::vector<int>& refRowSums);
+
+	/// <summary>
+	/// 差の絶対値和(SAD)が最小の位置を全探索する. 行和の差は差の絶対値和を超えないので, その和が暫定最小値以上の位置は計算しない
+	/// </summary>
+	/// <param name="crefImg">探索範囲, テンプレートと同じ型</param>
+	/// <param name="crefTempl">テンプレート</param>
+	/// <param name="crefRowSums">テンプレートの行ごと, チャンネルごとの和</param>
+	/// <param name="refBuffers">作業領域</param>
+	/// <param name="refMinLoc">SADが最小の位置, 同じ値なら先に走査した位置</param>
+	/// <returns>最小のSAD</returns>
+	static uint64_t MatchSad(const Image& crefImg, const Image& crefTempl, const std::vector<int>& crefRowSums, MatchBuffers& refBuffers, cv::Point& refMinLoc);
+
+	/// <summary>
+	/// エッジ画像を二値化し, 行ごとに64bit語へ詰める. x番目の画素は(x / 64)番目の語の(x % 64)番目のビット
+	/// </summary>
+	/// <param name="crefEdge">エッジ画像, CV_8UC1</param>
+	/// <param name="thr">閾値, これより大きい画素をエッジとする</param>
+	/// <param name="rowWords">1行の語数, 画素数以上であること</param>
+	/// <param name="refBits">詰めたビット列</param>
+	/// <returns>エッジ画素数</returns>
+	static int PackEdgeBits(const Image& crefEdge, const int& thr, const int& rowWords, std::vector<uint64_t>& refBits);
+
+	/// <summary>
+	/// 二値エッジのハミング距離によるマッチング. XORとpopcountで距離を求め, 二値画像どうしの相関係数に直して最大の位置を探す
+	/// 相関係数は0と1の画像にcv::TM_CCOEFF_NORMEDを適用したものと等しい
+	/// </summary>
+	/// <param name="crefEdge">探索範囲のエッジ画像</param>
+	/// <param name="refFeatures">マッチング用特徴量, 二値エッジテンプレートがなければ作る</param>
+	/// <param name="thr">二値化の閾値</param>
+	/// <param name="refBuffers">作業領域</param>
+	/// <param name="refMaxLoc">相関係数が最大の位置, 同じ値なら先に走査した位置</param>
+	/// <returns>最大の相関係数</returns>
+	static double MatchBinaryEdge(const Image& crefEdge, MatchFeatures& refFeatures, const int& thr, MatchBuffers& refBuffers, cv::Point& refMaxLoc);
+
+	/// <summary>
+	/// 車両追跡, マッチング結果を車両番号順に反映する
 	/// </summary>
 	/// <param name="idx">道路マスク番号</param>
 	void TraceCars(const size_t& idx);
@@ -73,9 +260,19 @@ private:
 	/// <returns>判定結果, trueなら検出しない</returns>
 	bool DoesntAddBoundCar(const size_t& idx, const cv::Rect2d& carPosRect);
 
+	/// <summary>
+	/// 処理中のフレームの検出ログに1行追加. 検出ログが無効なら何もしない
+	/// </summary>
+	/// <param name="idx">道路マスク番号</param>
+	/// <param name="carId">車両番号</param>
+	/// <param name="carPos">車両位置</param>
+	/// <param name="score">テンプレートの相関</param>
+	/// <param name="event">イベント種別</param>
+	void AddRecord(const size_t& idx, const uint64_t& carId, const cv::Rect2d& carPos, const double& score, const TrackEvent& event);
+
 	/// <summary>
 	/// テンプレート再抽出
 	/// </summary>
 	/// <param name="carPos">車両位置</param>
 	void ReExtractTemplate(const cv::Rect2d& carPos);
-};
+};
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "DetectionLogReader.h"
+#include "DetectionLogWriter.h"
+
+#include <cstring>
+
+namespace ImgProc
+{
+	/// <summary>
+	/// 検出ログを開き, ファイルヘッダを確認する
+	/// </summary>
+	/// <param name="path">検出ログのパス</param>
+	/// <returns>開けないか書式が合わなければfalse</returns>
+	bool DetectionLogReader::Open(const std::string& path)
+	{
+		Close();
+
+		mFile = std::fopen(path.c_str(), "rb");
+		if (mFile == nullptr)
+		{
+			std::cout << path << ": doesn't exist" << std::endl;
+			return false;
+		}
+
+		/* ファイルヘッダ確認 */
+		char magic[sizeof(DetectionLogWriter::MAGIC)];
+		uint32_t header[2];
+		const auto isValid = (std::fread(magic, 1, sizeof(magic), mFile) == sizeof(magic))
+			&& (std::fread(header, sizeof(uint32_t), 2, mFile) == 2)
+			&& (std::memcmp(magic, DetectionLogWriter::MAGIC, sizeof(magic)) == 0)
+			&& (header[0] == DetectionLogWriter::VERSION);
+		if (!isValid)
+		{
+			std::cout << path << ": invalid detection log" << std::endl;
+			Close();
+			return false;
+		}
+		/* end */
+
+		return true;
+	}
+
+	/// <summary>
+	/// 検出ログを閉じる
+	/// </summary>
+	void DetectionLogReader::Close()
+	{
+		if (mFile != nullptr)
+			std::fclose(mFile);
+		mFile = nullptr;
+	}
+
+	/// <summary>
+	/// 次のブロックを読み込み, 種別に応じていずれかの末尾に追加する
+	/// </summary>
+	/// <param name="detections">検出ログの追加先</param>
+	/// <param name="frames">フレームの処理結果の追加先</param>
+	/// <returns>終端か壊れたブロックならfalse</returns>
+	bool DetectionLogReader::ReadBlock(std::vector<DetectionRecord>& detections, std::vector<FrameRecord>& frames)
+	{
+		if (mFile == nullptr)
+			return false;
+
+		uint32_t blockHeader[2];
+		if (std::fread(blockHeader, sizeof(uint32_t), 2, mFile) != 2)
+			return false;
+		const auto type = static_cast<DetectionLogWriter::BlockType>(blockHeader[0]);
+		const auto rows = static_cast<size_t>(blockHeader[1]);
+
+		DetectionLogWriter::Block block;
+		/* フレームの処理結果 */
+		if (type == DetectionLogWriter::BlockType::FRAMES)
+		{
+			if (!ReadColumn(block.frameCount, rows) || !ReadColumn(block.elapsed, rows) || !ReadColumn(block.carsNum, rows))
+				return false;
+
+			for (size_t row = 0; row < rows; row++)
+				frames.push_back(FrameRecord{ block.frameCount[row], block.elapsed[row], block.carsNum[row] });
+			return true;
+		}
+		/* end */
+
+		/* 検出ログ */
+		if (type != DetectionLogWriter::BlockType::DETECTIONS)
+			return false;
+
+		const auto isRead = ReadColumn(block.frameCount, rows) && ReadColumn(block.roadIdx, rows) && ReadColumn(block.carId, rows)
+			&& ReadColumn(block.x, rows) && ReadColumn(block.y, rows) && ReadColumn(block.width, rows) && ReadColumn(block.height, rows)
+			&& ReadColumn(block.score, rows) && ReadColumn(block.event, rows);
+		if (!isRead)
+			return false;
+
+		for (size_t row = 0; row < rows; row++)
+		{
+			DetectionRecord record;
+			record.frameCount = block.frameCount[row];
+			record.roadIdx = block.roadIdx[row];
+			record.carId = block.carId[row];
+			record.position = cv::Rect2d(block.x[row], block.y[row], block.width[row], block.height[row]);
+			record.score = block.score[row];
+			record.event = static_cast<TrackEvent>(block.event[row]);
+			detections.push_back(record);
+		}
+		/* end */
+
+		return true;
+	}
+
+	/// <summary>
+	/// 検出ログ全体をCSVとして出力する. 検出ログ, フレームの処理結果の順に, それぞれ見出し行付きで出す
+	/// </summary>
+	/// <param name="path">検出ログのパス</param>
+	/// <param name="out">出力先</param>
+	/// <returns>開けないか書式が合わなければfalse</returns>
+	bool DetectionLogReader::DumpCsv(const std::string& path, std::ostream& out)
+	{
+		DetectionLogReader reader;
+		if (!reader.Open(path))
+			return false;
+
+		std::vector<DetectionRecord> detections;
+		std::vector<FrameRecord> frames;
+		while (reader.ReadBlock(detections, frames)); // 種別ごとにはフレーム番号順に並んでいる
+
+		const char* eventNames[] = { "new", "traced", "lost", "finished" };
+		out << "frame,road,carId,x,y,width,height,score,event\n";
+		for (const auto& record : detections)
+		{
+			const auto eventIdx = static_cast<size_t>(record.event);
+			out << record.frameCount << ',' << record.roadIdx << ',' << record.carId << ','
+				<< record.position.x << ',' << record.position.y << ',' << record.position.width << ',' << record.position.height << ','
+				<< record.score << ',' << ((eventIdx < 4) ? eventNames[eventIdx] : "unknown") << '\n';
+		}
+
+		out << "\nframe,elapsed,carsNum\n";
+		for (const auto& record : frames)
+			out << record.frameCount << ',' << record.elapsed << ',' << record.carsNum << '\n';
+		out << std::flush;
+
+		return true;
+	}
+};
\ No newline at end of file
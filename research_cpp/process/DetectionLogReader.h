@@ -0,0 +1,63 @@
+#pragma once
+#include "ImgProc.h"
+
+#include <cstdio>
+#include <ostream>
+
+/// <summary>
+/// DetectionLogWriterが書き出した検出ログの読み込み
+/// 書式はDetectionLogWriter.hを参照
+/// </summary>
+class ImgProc::DetectionLogReader
+{
+private:
+	std::FILE* mFile = nullptr; // 入力ファイル
+
+public:
+	DetectionLogReader() = default;
+	~DetectionLogReader() { Close(); }
+
+	/// <summary>
+	/// 検出ログを開き, ファイルヘッダを確認する
+	/// </summary>
+	/// <param name="path">検出ログのパス</param>
+	/// <returns>開けないか書式が合わなければfalse</returns>
+	bool Open(const std::string& path);
+
+	/// <summary>
+	/// 検出ログを閉じる
+	/// </summary>
+	void Close();
+
+	/// <summary>
+	/// 次のブロックを読み込み, 種別に応じていずれかの末尾に追加する
+	/// </summary>
+	/// <param name="detections">検出ログの追加先</param>
+	/// <param name="frames">フレームの処理結果の追加先</param>
+	/// <returns>終端か壊れたブロックならfalse</returns>
+	bool ReadBlock(std::vector<DetectionRecord>& detections, std::vector<FrameRecord>& frames);
+
+	/// <summary>
+	/// 検出ログ全体をCSVとして出力する. 検出ログ, フレームの処理結果の順に, それぞれ見出し行付きで出す
+	/// </summary>
+	/// <param name="path">検出ログのパス</param>
+	/// <param name="out">出力先</param>
+	/// <returns>開けないか書式が合わなければfalse</returns>
+	static bool DumpCsv(const std::string& path, std::ostream& out);
+
+private:
+	DetectionLogReader(const DetectionLogReader& other) = delete;
+
+	/// <summary>
+	/// 1列分の値を読み込む
+	/// </summary>
+	/// <param name="column">格納先, 行数分に伸ばす</param>
+	/// <param name="rows">行数</param>
+	/// <returns>読み切れなければfalse</returns>
+	template <typename T>
+	bool ReadColumn(std::vector<T>& column, const size_t& rows)
+	{
+		column.resize(rows);
+		return std::fread(column.data(), sizeof(T), rows, mFile) == rows;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "DetectionLogWriter.h"
+
+namespace ImgProc
+{
+	/// <summary>
+	/// 全列を空にする. 確保済みの領域は再利用のため残す
+	/// </summary>
+	void DetectionLogWriter::Block::Clear()
+	{
+		frameCount.clear();
+		roadIdx.clear();
+		carId.clear();
+		x.clear();
+		y.clear();
+		width.clear();
+		height.clear();
+		score.clear();
+		event.clear();
+		elapsed.clear();
+		carsNum.clear();
+	}
+
+	/// <summary>
+	/// 出力ファイルを開いてヘッダを書き, 書き出しスレッドを開始
+	/// </summary>
+	/// <param name="outputPath">出力パス</param>
+	/// <param name="params">検出ログパラメータ</param>
+	/// <returns>開けなければfalse</returns>
+	bool DetectionLogWriter::Open(const std::string& outputPath, const DetectionLogParams& params)
+	{
+		Close();
+
+		mFile = std::fopen(outputPath.c_str(), "wb");
+		if (mFile == nullptr)
+		{
+			std::cout << outputPath << ": can't create or overwrite" << std::endl;
+			return false;
+		}
+
+		/* ファイルヘッダ */
+		const uint32_t header[2] = { VERSION, 0 };
+		std::fwrite(MAGIC, 1, sizeof(MAGIC), mFile);
+		std::fwrite(header, sizeof(uint32_t), 2, mFile);
+		/* end */
+
+		mPath = outputPath;
+		mBlockRows = static_cast<size_t>(std::max(params.blockRows, 1));
+		mDetections = std::make_unique<Block>();
+		mDetections->type = BlockType::DETECTIONS;
+		mFrames = std::make_unique<Block>();
+		mFrames->type = BlockType::FRAMES;
+		mIsClosing = false;
+		mHasError = false;
+		mWorker = std::thread(&DetectionLogWriter::Work, this);
+		return true;
+	}
+
+	/// <summary>
+	/// 検出ログを追加. blockRows行たまったら書き出しスレッドへ渡す
+	/// </summary>
+	/// <param name="records">1フレーム分の検出ログ</param>
+	void DetectionLogWriter::Append(const std::vector<DetectionRecord>& records)
+	{
+		auto& refBlock = *mDetections;
+		for (const auto& record : records)
+		{
+			refBlock.frameCount.push_back(record.frameCount);
+			refBlock.roadIdx.push_back(record.roadIdx);
+			refBlock.carId.push_back(record.carId);
+			refBlock.x.push_back(static_cast<float>(record.position.x));
+			refBlock.y.push_back(static_cast<float>(record.position.y));
+			refBlock.width.push_back(static_cast<float>(record.position.width));
+			refBlock.height.push_back(static_cast<float>(record.position.height));
+			refBlock.score.push_back(record.score);
+			refBlock.event.push_back(static_cast<uint8_t>(record.event));
+		}
+
+		if (refBlock.Rows() >= mBlockRows)
+			Submit(mDetections);
+	}
+
+	/// <summary>
+	/// フレームの処理結果を追加. blockRows行たまったら書き出しスレッドへ渡す
+	/// </summary>
+	/// <param name="record">1フレーム分の処理結果</param>
+	void DetectionLogWriter::Append(const FrameRecord& record)
+	{
+		auto& refBlock = *mFrames;
+		refBlock.frameCount.push_back(record.frameCount);
+		refBlock.elapsed.push_back(record.elapsed);
+		refBlock.carsNum.push_back(record.carsNum);
+
+		if (refBlock.Rows() >= mBlockRows)
+			Submit(mFrames);
+	}
+
+	/// <summary>
+	/// 追加中のブロックを渡し, キューに残ったブロックを全て書き出してから書き出しスレッドを停止し, ファイルを閉じる
+	/// </summary>
+	void DetectionLogWriter::Close()
+	{
+		if (mFile == nullptr)
+			return;
+
+		Submit(mDetections);
+		Submit(mFrames);
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mIsClosing = true;
+		}
+		mCond.notify_all();
+		mWorker.join();
+
+		if ((std::fclose(mFile) != 0) || mHasError)
+			std::cout << mPath << ": failed to write detection log" << std::endl;
+		mFile = nullptr;
+		mQueue.clear();
+		mFreeBlocks.clear();
+	}
+
+	/// <summary>
+	/// 追加中のブロックを書き出しキューに積み, 再利用ブロックと入れ替える. 空なら何もしない
+	/// </summary>
+	/// <param name="block">追加中のブロック</param>
+	void DetectionLogWriter::Submit(std::unique_ptr<Block>& block)
+	{
+		if (block->Rows() == 0)
+			return;
+
+		const auto type = block->type;
+		std::unique_ptr<Block> freeBlock;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mQueue.push_back(std::move(block));
+			if (!mFreeBlocks.empty())
+			{
+				freeBlock = std::move(mFreeBlocks.back());
+				mFreeBlocks.pop_back();
+			}
+		}
+		mCond.notify_all();
+
+		block = freeBlock ? std::move(freeBlock) : std::make_unique<Block>();
+		block->type = type;
+	}
+
+	/// <summary>
+	/// 書き出しスレッド本体
+	/// </summary>
+	void DetectionLogWriter::Work()
+	{
+		std::unique_ptr<Block> block;
+		while (true)
+		{
+			/* 書き出し待ちブロックを取り出す, 終了要求があってもキューが空になるまでは続ける */
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mCond.wait(lock, [&] { return !mQueue.empty() || mIsClosing; });
+				if (mQueue.empty())
+					break;
+
+				block = std::move(mQueue.front());
+				mQueue.pop_front();
+			}
+			/* end */
+
+			if (!mHasError)
+				mHasError = !WriteBlock(*block);
+
+			/* 書き出し済みブロックを返却 */
+			block->Clear();
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mFreeBlocks.push_back(std::move(block));
+			}
+			/* end */
+		}
+	}
+
+	/// <summary>
+	/// 1ブロックをファイルへ書き込む
+	/// </summary>
+	/// <param name="block">ブロック</param>
+	/// <returns>書き込めなければfalse</returns>
+	bool DetectionLogWriter::WriteBlock(const Block& block)
+	{
+		const auto rows = block.Rows();
+		auto writeColumn = [&](const auto& column)
+		{
+			return std::fwrite(column.data(), sizeof(column[0]), rows, mFile) == rows;
+		};
+
+		const uint32_t blockHeader[2] = { static_cast<uint32_t>(block.type), static_cast<uint32_t>(rows) };
+		if (std::fwrite(blockHeader, sizeof(uint32_t), 2, mFile) != 2)
+			return false;
+
+		if (block.type == BlockType::FRAMES)
+			return writeColumn(block.frameCount) && writeColumn(block.elapsed) && writeColumn(block.carsNum);
+
+		return writeColumn(block.frameCount) && writeColumn(block.roadIdx) && writeColumn(block.carId)
+			&& writeColumn(block.x) && writeColumn(block.y) && writeColumn(block.width) && writeColumn(block.height)
+			&& writeColumn(block.score) && writeColumn(block.event);
+	}
+};
\ No newline at end of file
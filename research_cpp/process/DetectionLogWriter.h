@@ -0,0 +1,128 @@
+#pragma once
+#include "ImgProc.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/// <summary>
+/// 列指向の検出ログの非同期書き出し
+/// 処理スレッドは行を列ごとのバッファへ追加するだけで, blockRows行たまるごとにブロックとして書き出しスレッドへ渡す
+///
+/// 書式(リトルエンディアン)
+///   ファイルヘッダ: magic[8] "DETECLOG", uint32 version, uint32 予約
+///   ブロック: uint32 種別(BlockType), uint32 行数n, 続けて列ごとにn個の値を詰めて並べる
+///     DETECTIONS: uint64 frameCount, uint32 roadIdx, uint64 carId, float x, float y, float width, float height, float score, uint8 event
+///     FRAMES: uint64 frameCount, double elapsed, uint64 carsNum
+/// </summary>
+class ImgProc::DetectionLogWriter
+{
+public:
+	static constexpr char MAGIC[8] = { 'D', 'E', 'T', 'E', 'C', 'L', 'O', 'G' }; // 識別子
+	static constexpr uint32_t VERSION = 1;
+
+	/// <summary>
+	/// ブロックの種別
+	/// </summary>
+	enum class BlockType : uint32_t
+	{
+		DETECTIONS = 0, // DetectionRecordの列
+		FRAMES = 1, // FrameRecordの列
+	};
+
+	/// <summary>
+	/// 1ブロック分の列バッファ, 種別に対応する列のみ使う
+	/// </summary>
+	struct Block
+	{
+		BlockType type = BlockType::DETECTIONS;
+		std::vector<uint64_t> frameCount;
+		std::vector<uint32_t> roadIdx;
+		std::vector<uint64_t> carId;
+		std::vector<float> x;
+		std::vector<float> y;
+		std::vector<float> width;
+		std::vector<float> height;
+		std::vector<float> score;
+		std::vector<uint8_t> event;
+		std::vector<double> elapsed;
+		std::vector<uint64_t> carsNum;
+
+		size_t Rows() const { return frameCount.size(); }
+
+		/// <summary>
+		/// 全列を空にする. 確保済みの領域は再利用のため残す
+		/// </summary>
+		void Clear();
+	};
+
+private:
+	std::FILE* mFile = nullptr; // 出力ファイル, 開始後は書き出しスレッドのみが触る
+	std::string mPath; // 出力パス
+	size_t mBlockRows = 4096; // ブロックの行数
+	std::unique_ptr<Block> mDetections; // 処理スレッドが追加中の検出ブロック
+	std::unique_ptr<Block> mFrames; // 処理スレッドが追加中のフレームブロック
+
+	std::thread mWorker; // 書き出しスレッド
+	std::mutex mMutex; // mQueue, mFreeBlocks, mIsClosing の保護
+	std::condition_variable mCond; // キューの状態変化通知
+	std::deque<std::unique_ptr<Block>> mQueue; // 書き出し待ちブロック
+	std::vector<std::unique_ptr<Block>> mFreeBlocks; // 書き出し済みで再利用できるブロック
+	bool mIsClosing = false; // 終了要求
+	bool mHasError = false; // 書き込み失敗, 書き出しスレッドのみが触る
+
+public:
+	DetectionLogWriter() = default;
+	~DetectionLogWriter() { Close(); }
+
+	/// <summary>
+	/// 出力ファイルを開いてヘッダを書き, 書き出しスレッドを開始
+	/// </summary>
+	/// <param name="outputPath">出力パス</param>
+	/// <param name="params">検出ログパラメータ</param>
+	/// <returns>開けなければfalse</returns>
+	bool Open(const std::string& outputPath, const DetectionLogParams& params);
+
+	/// <summary>
+	/// 検出ログを追加. blockRows行たまったら書き出しスレッドへ渡す
+	/// </summary>
+	/// <param name="records">1フレーム分の検出ログ</param>
+	void Append(const std::vector<DetectionRecord>& records);
+
+	/// <summary>
+	/// フレームの処理結果を追加. blockRows行たまったら書き出しスレッドへ渡す
+	/// </summary>
+	/// <param name="record">1フレーム分の処理結果</param>
+	void Append(const FrameRecord& record);
+
+	/// <summary>
+	/// 追加中のブロックを渡し, キューに残ったブロックを全て書き出してから書き出しスレッドを停止し, ファイルを閉じる
+	/// </summary>
+	void Close();
+
+	bool IsOpened() const { return mFile != nullptr; }
+
+private:
+	DetectionLogWriter(const DetectionLogWriter& other) = delete;
+
+	/// <summary>
+	/// 追加中のブロックを書き出しキューに積み, 再利用ブロックと入れ替える. 空なら何もしない
+	/// </summary>
+	/// <param name="block">追加中のブロック</param>
+	void Submit(std::unique_ptr<Block>& block);
+
+	/// <summary>
+	/// 書き出しスレッド本体
+	/// </summary>
+	void Work();
+
+	/// <summary>
+	/// 1ブロックをファイルへ書き込む
+	/// </summary>
+	/// <param name="block">ブロック</param>
+	/// <returns>書き込めなければfalse</returns>
+	bool WriteBlock(const Block& block);
+};
\ No newline at end of file
@@ -0,0 +1,195 @@
+#include "FrameCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+namespace ImgProc
+{
+	/// <summary>
+	/// 動画の0番フレームから指定数のフレームをデコードしてキャッシュファイルを作る
+	/// 一時ファイルに書いてから置き換えるので, 途中で止まっても壊れたキャッシュは残らない
+	/// </summary>
+	/// <param name="videoCapture">先頭位置の入力ビデオキャプチャ</param>
+	/// <param name="videoPath">動画パス, 同一性の確認に使う</param>
+	/// <param name="cachePath">キャッシュファイルパス</param>
+	/// <param name="frameNum">格納するフレーム数, 動画の終端が先ならそこまで</param>
+	/// <returns>書き込めなければfalse</returns>
+	bool FrameCache::Build(cv::VideoCapture& videoCapture, const std::string& videoPath, const std::string& cachePath, const uint64_t& frameNum)
+	{
+		/* ヘッダ作成 */
+		Header header{};
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+		header.width = static_cast<int32_t>(videoCapture.get(cv::CAP_PROP_FRAME_WIDTH));
+		header.height = static_cast<int32_t>(videoCapture.get(cv::CAP_PROP_FRAME_HEIGHT));
+		header.fps = videoCapture.get(cv::CAP_PROP_FPS);
+		const auto frameBytes = static_cast<uint64_t>(header.width) * header.height * 3;
+		header.frameStride = (frameBytes + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+		header.dataOffset = PAGE_SIZE;
+		header.sourceFrameCount = static_cast<uint64_t>(videoCapture.get(cv::CAP_PROP_FRAME_COUNT));
+		if (!GetSourceStat(videoPath, header.sourceSize, header.sourceWriteTime))
+			return false;
+		/* end */
+
+		const auto tempPath = cachePath + ".tmp";
+		auto file = std::fopen(tempPath.c_str(), "wb");
+		if (file == nullptr)
+			return false;
+
+		/* ヘッダ領域は後で書き直すので, 先に0埋めで確保 */
+		std::vector<uchar> padding(static_cast<size_t>(PAGE_SIZE), 0);
+		bool isSucceeded = (std::fwrite(padding.data(), 1, padding.size(), file) == padding.size());
+		/* end */
+
+		/* 0番フレームから順にデコードして書き込む */
+		Image frame;
+		const auto paddingBytes = static_cast<size_t>(header.frameStride - frameBytes);
+		while (isSucceeded && (header.count < frameNum))
+		{
+			videoCapture >> frame;
+			if (frame.empty())
+			{
+				header.flags |= FLAG_END_OF_STREAM;
+				break;
+			}
+
+			if ((frame.cols != header.width) || (frame.rows != header.height) || (frame.type() != CV_8UC3))
+			{
+				isSucceeded = false;
+				break;
+			}
+			if (!frame.isContinuous())
+				frame = frame.clone();
+
+			isSucceeded = (std::fwrite(frame.data, 1, static_cast<size_t>(frameBytes), file) == frameBytes)
+				&& (std::fwrite(padding.data(), 1, paddingBytes, file) == paddingBytes);
+			header.count++;
+		}
+		/* end */
+
+		/* ヘッダを書き直して置き換える */
+		isSucceeded = isSucceeded && (std::fseek(file, 0, SEEK_SET) == 0)
+			&& (std::fwrite(&header, sizeof(header), 1, file) == 1);
+		isSucceeded = (std::fclose(file) == 0) && isSucceeded;
+
+		std::error_code error;
+		if (isSucceeded)
+			std::filesystem::rename(tempPath, cachePath, error);
+		if (!isSucceeded || error)
+		{
+			std::filesystem::remove(tempPath, error);
+			return false;
+		}
+		/* end */
+
+		std::cout << cachePath << ": cached " << header.count << " frames" << std::endl;
+		return true;
+	}
+
+	/// <summary>
+	/// キャッシュファイルをメモリマップする. 書式が合わないか動画が置き換えられていれば開かない
+	/// </summary>
+	/// <param name="cachePath">キャッシュファイルパス</param>
+	/// <param name="videoPath">動画パス</param>
+	/// <param name="sourceFrameCount">動画のフレーム数(CAP_PROP_FRAME_COUNT)</param>
+	/// <returns>開けないか古ければfalse</returns>
+	bool FrameCache::Open(const std::string& cachePath, const std::string& videoPath, const uint64_t& sourceFrameCount)
+	{
+		Close();
+
+		/* 先頭から順に読むので, 先読みを深くし読み終えたページは早めに捨てさせる */
+		if (!mFile.Open(cachePath, true) || (mFile.GetSize() < sizeof(Header)))
+		{
+			Close();
+			return false;
+		}
+		/* end */
+
+		/* ヘッダ確認 */
+		std::memcpy(&mHeader, mFile.GetData(), sizeof(Header));
+		const auto frameBytes = static_cast<uint64_t>(mHeader.width) * mHeader.height * 3;
+		const auto isValid = (std::memcmp(mHeader.magic, MAGIC, sizeof(MAGIC)) == 0)
+			&& (mHeader.version == VERSION)
+			&& (mHeader.frameStride >= frameBytes)
+			&& (mHeader.dataOffset + mHeader.frameStride * mHeader.count <= mFile.GetSize());
+		if (!isValid)
+		{
+			std::cout << cachePath << ": invalid frame cache" << std::endl;
+			Close();
+			return false;
+		}
+		/* end */
+
+		/* 動画の同一性の確認, 同じパスで置き換えられていれば作り直させる */
+		uint64_t sourceSize = 0;
+		int64_t sourceWriteTime = 0;
+		const auto isSameSource = GetSourceStat(videoPath, sourceSize, sourceWriteTime)
+			&& (mHeader.sourceSize == sourceSize)
+			&& (mHeader.sourceWriteTime == sourceWriteTime)
+			&& (mHeader.sourceFrameCount == sourceFrameCount);
+		if (!isSameSource)
+		{
+			std::cout << cachePath << ": stale frame cache (video changed), rebuild it." << std::endl;
+			Close();
+			return false;
+		}
+		/* end */
+
+		return true;
+	}
+
+	/// <summary>
+	/// 動画のファイルサイズと最終更新時刻を取得. キャッシュの作成時と比べて動画が置き換えられていないか確かめる
+	/// </summary>
+	/// <param name="videoPath">動画パス</param>
+	/// <param name="size">ファイルサイズの格納先</param>
+	/// <param name="writeTime">最終更新時刻の格納先</param>
+	/// <returns>取得できなければfalse</returns>
+	bool FrameCache::GetSourceStat(const std::string& videoPath, uint64_t& size, int64_t& writeTime)
+	{
+		std::error_code error;
+		size = static_cast<uint64_t>(std::filesystem::file_size(videoPath, error));
+		if (error)
+			return false;
+		writeTime = static_cast<int64_t>(std::filesystem::last_write_time(videoPath, error).time_since_epoch().count());
+		return !error;
+	}
+
+	/// <summary>
+	/// 指定フレーム数を満たしているか
+	/// </summary>
+	/// <param name="frameNum">必要なフレーム数</param>
+	/// <returns>格納フレーム数が足りているか, 動画の終端まで格納済みならtrue</returns>
+	bool FrameCache::Covers(const uint64_t& frameNum) const
+	{
+		return mFile.IsOpened() && ((mHeader.count >= frameNum) || (mHeader.flags & FLAG_END_OF_STREAM));
+	}
+
+	/// <summary>
+	/// マップを解除してファイルを閉じる
+	/// </summary>
+	void FrameCache::Close()
+	{
+		mFile.Close();
+		mHeader = Header{};
+	}
+
+	/// <summary>
+	/// フレームをコピーせずにマップ上のビューとして取り出す. 先読みのため, このフレームの読み込みをOSに依頼する
+	/// ビューはコピーオンライトのマップを指すので, 書き込んでもファイルは変わらない
+	/// </summary>
+	/// <param name="frameCount">フレーム番号</param>
+	/// <param name="frame">ビューの格納先</param>
+	/// <returns>格納範囲外ならfalse</returns>
+	bool FrameCache::GetFrame(const uint64_t& frameCount, Image& frame)
+	{
+		if (frameCount >= mHeader.count)
+			return false;
+
+		const auto offset = mHeader.dataOffset + mHeader.frameStride * frameCount;
+		mFile.Prefetch(offset, mHeader.frameStride); // 消費者が触る前にページを読み込ませる. 呼び出し元のデコード先読みスレッドはリング長分先行している
+		frame = Image(mHeader.height, mHeader.width, CV_8UC3, mFile.GetData() + offset); // ヘッダのみ作成, 画素はマップを直接参照
+		return true;
+	}
+};
\ No newline at end of file
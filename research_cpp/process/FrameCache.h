@@ -0,0 +1,114 @@
+#pragma once
+#include "ImgProc.h"
+#include "MappedFile.h"
+
+#include <string>
+
+/// <summary>
+/// デコード済みフレームのキャッシュファイル
+/// 動画ファイルと同じディレクトリに"(動画パス).framecache"として置き, 2回目以降の実行ではデコードせずメモリマップして読む
+/// 動画のファイルサイズ・最終更新時刻・フレーム数のいずれかが作成時と変わっていれば, 置き換えられたものとして使わない
+///
+/// 書式(リトルエンディアン)
+///   [0, PAGE_SIZE): Header, 残りは0埋め
+///   [dataOffset + frameStride * i, +width * height * 3): i番フレームのBGR24画素, 行間の詰め物なし
+///   frameStrideはページ境界に切り上げるので, 各フレームの先頭はページ境界に揃う
+/// </summary>
+class ImgProc::FrameCache
+{
+public:
+	static constexpr size_t PAGE_SIZE = 4096; // フレームの配置境界
+	static constexpr char MAGIC[8] = { 'F', 'R', 'M', 'C', 'A', 'C', 'H', 'E' }; // 識別子
+	static constexpr uint32_t VERSION = 2; // 2: 動画の同一性の確認を追加
+	static constexpr uint32_t FLAG_END_OF_STREAM = 1; // 動画の終端まで格納済み
+
+	/// <summary>
+	/// キャッシュファイルのヘッダ
+	/// </summary>
+	struct Header
+	{
+		char magic[8]; // "FRMCACHE"
+		uint32_t version; // 書式のバージョン
+		uint32_t flags; // FLAG_END_OF_STREAMなど
+		int32_t width; // フレームの横幅
+		int32_t height; // フレームの縦幅
+		uint64_t count; // 格納フレーム数, 0番フレームから連続
+		double fps; // フレームレート
+		uint64_t frameStride; // フレームの格納間隔
+		uint64_t dataOffset; // 0番フレームの位置
+		uint64_t sourceSize; // 動画のファイルサイズ
+		int64_t sourceWriteTime; // 動画の最終更新時刻
+		uint64_t sourceFrameCount; // 動画のフレーム数(CAP_PROP_FRAME_COUNT)
+	};
+
+private:
+	MappedFile mFile; // キャッシュファイルのマップ
+	Header mHeader{}; // 読み込んだヘッダ
+
+public:
+	FrameCache() = default;
+	~FrameCache() { Close(); }
+
+	/// <summary>
+	/// キャッシュファイルのパス
+	/// </summary>
+	/// <param name="videoPath">動画パス</param>
+	/// <returns>動画と同じディレクトリのキャッシュファイルパス</returns>
+	static std::string GetCachePath(const std::string& videoPath) { return videoPath + ".framecache"; }
+
+	/// <summary>
+	/// 動画の0番フレームから指定数のフレームをデコードしてキャッシュファイルを作る
+	/// 一時ファイルに書いてから置き換えるので, 途中で止まっても壊れたキャッシュは残らない
+	/// </summary>
+	/// <param name="videoCapture">先頭位置の入力ビデオキャプチャ</param>
+	/// <param name="videoPath">動画パス, 同一性の確認に使う</param>
+	/// <param name="cachePath">キャッシュファイルパス</param>
+	/// <param name="frameNum">格納するフレーム数, 動画の終端が先ならそこまで</param>
+	/// <returns>書き込めなければfalse</returns>
+	static bool Build(cv::VideoCapture& videoCapture, const std::string& videoPath, const std::string& cachePath, const uint64_t& frameNum);
+
+	/// <summary>
+	/// キャッシュファイルをメモリマップする. 書式が合わないか動画が置き換えられていれば開かない
+	/// </summary>
+	/// <param name="cachePath">キャッシュファイルパス</param>
+	/// <param name="videoPath">動画パス</param>
+	/// <param name="sourceFrameCount">動画のフレーム数(CAP_PROP_FRAME_COUNT)</param>
+	/// <returns>開けないか古ければfalse</returns>
+	bool Open(const std::string& cachePath, const std::string& videoPath, const uint64_t& sourceFrameCount);
+
+	/// <summary>
+	/// 指定フレーム数を満たしているか
+	/// </summary>
+	/// <param name="frameNum">必要なフレーム数</param>
+	/// <returns>格納フレーム数が足りているか, 動画の終端まで格納済みならtrue</returns>
+	bool Covers(const uint64_t& frameNum) const;
+
+	/// <summary>
+	/// マップを解除してファイルを閉じる
+	/// </summary>
+	void Close();
+
+	/// <summary>
+	/// フレームをコピーせずにマップ上のビューとして取り出す. 先読みのため, このフレームの読み込みをOSに依頼する
+	/// ビューはコピーオンライトのマップを指すので, 書き込んでもファイルは変わらない
+	/// </summary>
+	/// <param name="frameCount">フレーム番号</param>
+	/// <param name="frame">ビューの格納先</param>
+	/// <returns>格納範囲外ならfalse</returns>
+	bool GetFrame(const uint64_t& frameCount, Image& frame);
+
+	/// <summary>
+	/// 動画のファイルサイズと最終更新時刻を取得. キャッシュの作成時と比べて動画が置き換えられていないか確かめる
+	/// </summary>
+	/// <param name="videoPath">動画パス</param>
+	/// <param name="size">ファイルサイズの格納先</param>
+	/// <param name="writeTime">最終更新時刻の格納先</param>
+	/// <returns>取得できなければfalse</returns>
+	static bool GetSourceStat(const std::string& videoPath, uint64_t& size, int64_t& writeTime);
+
+	bool IsOpened() const { return mFile.IsOpened(); }
+	const Header& GetHeader() const { return mHeader; }
+
+private:
+	FrameCache(const FrameCache& other) = delete;
+};
\ No newline at end of file
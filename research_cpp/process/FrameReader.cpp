@@ -0,0 +1,256 @@
+#include "FrameReader.h"
+
+namespace ImgProc
+{
+	/// <summary>
+	/// フレームバッファを確保し, デコードスレッドを開始
+	/// </summary>
+	/// <param name="videoCapture">入力ビデオキャプチャ</param>
+	/// <param name="frameSize">フレームサイズ</param>
+	/// <param name="params">リングバッファの要素数, 読み飛ばし方法</param>
+	void FrameReader::Start(cv::VideoCapture& videoCapture, const cv::Size& frameSize, const FrameReaderParams& params)
+	{
+		Stop();
+
+		mVideoCapture = &videoCapture;
+		mRawFrameSource = nullptr;
+		mFrameCache = nullptr;
+		mSeekMode = params.seekMode;
+		mSlots.resize(static_cast<size_t>(std::max(params.ringSize, 2)));
+		for (auto& slot : mSlots)
+			slot.frame.create(frameSize, CV_8UC3); // デコード時に再確保が起きないよう先に確保
+
+		StartProducer();
+	}
+
+	/// <summary>
+	/// 生フレーム入力用にページ境界に揃えたフレームバッファを確保し, 読み込みスレッドを開始
+	/// </summary>
+	/// <param name="rawFrameSource">生フレーム入力</param>
+	/// <param name="params">リングバッファの要素数, 生フレーム入力では読み飛ばし方法は使わない</param>
+	void FrameReader::Start(RawFrameSource& rawFrameSource, const FrameReaderParams& params)
+	{
+		Stop();
+
+		mVideoCapture = nullptr;
+		mRawFrameSource = &rawFrameSource;
+		mFrameCache = nullptr;
+		mSlots.resize(static_cast<size_t>(std::max(params.ringSize, 2)));
+		for (auto& slot : mSlots)
+			slot.frame = rawFrameSource.AllocateFrame(slot.buffer); // 以降このバッファへ直接読み込む
+
+		StartProducer();
+	}
+
+	/// <summary>
+	/// キャッシュファイルから読み込むスレッドを開始. フレームはマップ上のビューなのでバッファは確保しない
+	/// </summary>
+	/// <param name="frameCache">開いたキャッシュファイル</param>
+	/// <param name="params">リングバッファの要素数, キャッシュは直接目的のフレームを指せるので読み飛ばし方法は使わない</param>
+	void FrameReader::Start(FrameCache& frameCache, const FrameReaderParams& params)
+	{
+		Stop();
+
+		mVideoCapture = nullptr;
+		mRawFrameSource = nullptr;
+		mFrameCache = &frameCache;
+		mSlots.resize(static_cast<size_t>(std::max(params.ringSize, 2)));
+
+		StartProducer();
+	}
+
+	/// <summary>
+	/// リングバッファの位置を初期化し, デコードスレッドを開始
+	/// </summary>
+	void FrameReader::StartProducer()
+	{
+		mHead = 0;
+		mTail = 0;
+		mAcquired = 0;
+		mIsStopped = false;
+		mProducer = std::thread(&FrameReader::Produce, this);
+	}
+
+	/// <summary>
+	/// デコードスレッドを停止
+	/// </summary>
+	void FrameReader::Stop()
+	{
+		if (!mProducer.joinable())
+			return;
+
+		mIsStopped = true;
+		/* 満杯待ちの生産者を起こす */
+		mTail.fetch_add(1, std::memory_order_release);
+		mTail.notify_one();
+		/* end */
+		mProducer.join();
+	}
+
+	/// <summary>
+	/// 最も古いデコード済みフレームを取り出す. コピーは行わず, リング内のバッファを参照する
+	/// 取り出したフレームはRelease()を呼ぶまで上書きされない
+	/// </summary>
+	/// <param name="frame">フレームの参照先</param>
+	/// <param name="frameCount">フレーム番号の格納先, 終端ならフレーム総数</param>
+	/// <returns>ストリーム終端ならfalse</returns>
+	bool FrameReader::Acquire(Image& frame, uint64_t& frameCount)
+	{
+		/* 空なら生産者の書き込みを待つ */
+		auto head = mHead.load(std::memory_order_acquire);
+		while (head == mAcquired)
+		{
+			mHead.wait(head, std::memory_order_acquire);
+			head = mHead.load(std::memory_order_acquire);
+		}
+		/* end */
+
+		const auto& crefSlot = mSlots[mAcquired % mSlots.size()];
+		frameCount = crefSlot.frameCount;
+		if (crefSlot.frame.empty()) // 終端は取り出さずに残し, 以降の呼び出しも終端を返す
+		{
+			frame = Image();
+			return false;
+		}
+
+		frame = crefSlot.frame; // ヘッダのみのシャローコピー
+		mAcquired++;
+		return true;
+	}
+
+	/// <summary>
+	/// 取り出し済みのフレームのうち最も古いものを生産者に返却
+	/// </summary>
+	void FrameReader::Release()
+	{
+		mTail.fetch_add(1, std::memory_order_release);
+		mTail.notify_one();
+	}
+
+	/// <summary>
+	/// デコードスレッド本体
+	/// </summary>
+	void FrameReader::Produce()
+	{
+		const auto ringSize = mSlots.size();
+		uint64_t head = 0;
+		uint64_t frameCount = 0;
+
+		while (!mIsStopped)
+		{
+			/* 満杯なら消費者の解放を待つ */
+			auto tail = mTail.load(std::memory_order_acquire);
+			if (head >= tail + ringSize)
+			{
+				mTail.wait(tail, std::memory_order_acquire);
+				continue;
+			}
+			/* end */
+
+			if ((frameCount >= mSkipBegin) && (frameCount < mSkipEnd))
+				Seek(frameCount, mSkipEnd);
+
+			auto& refSlot = mSlots[head % ringSize];
+			if (mFrameCache != nullptr)
+			{
+				if (!mFrameCache->GetFrame(frameCount, refSlot.frame))
+					refSlot.frame = Image();
+			}
+			else if (mRawFrameSource != nullptr)
+			{
+				if (!mRawFrameSource->Read(refSlot.frame))
+					refSlot.frame = Image(); // バッファはslot.bufferが保持したまま
+			}
+			else
+				*mVideoCapture >> refSlot.frame; // サイズが同じなら確保済みバッファにそのままデコードされる
+			refSlot.frameCount = frameCount++;
+
+			mHead.store(++head, std::memory_order_release);
+			mHead.notify_one();
+
+			if (refSlot.frame.empty()) // 終端を書き込んだら終了
+				break;
+		}
+	}
+
+	/// <summary>
+	/// 指定フレームの直前まで読み飛ばす. KEYFRAMEではSeekToFrame()でシークし,
+	/// 着地位置が確認できなければGRABと同じく先頭から逐次読み飛ばす. 生フレーム入力は常に読み捨て, キャッシュは番号を進めるのみ
+	/// </summary>
+	/// <param name="frameCount">現在のフレーム番号, 読み飛ばし後の番号に更新される</param>
+	/// <param name="target">次に読み込むフレーム番号</param>
+	void FrameReader::Seek(uint64_t& frameCount, const uint64_t& target)
+	{
+		/* キャッシュはフレーム番号から直接位置が決まる */
+		if (mFrameCache != nullptr)
+		{
+			frameCount = target;
+			return;
+		}
+		/* end */
+
+		/* パイプはシークできないので読み捨てる */
+		if (mRawFrameSource != nullptr)
+		{
+			for (; frameCount < target; frameCount++)
+			{
+				if (!mRawFrameSource->Skip())
+					break;
+			}
+			return;
+		}
+		/* end */
+
+		/* キーフレームシーク. FFmpegバックエンドは直前のキーフレームへ戻ってから, 色変換なしのgrabで目標位置まで送る */
+		if (mSeekMode == SeekMode::KEYFRAME)
+		{
+			if (SeekToFrame(*mVideoCapture, target))
+			{
+				frameCount = target;
+				return;
+			}
+
+			/* 位置が合わないストリームは先頭から数え直す. 報告は消費者スレッドに任せる */
+			mIsSeekFallenBack = true;
+			mVideoCapture->set(cv::CAP_PROP_POS_FRAMES, 0.0);
+			frameCount = 0;
+			/* end */
+		}
+		/* end */
+
+		/* 逐次読み飛ばし, grab()はデコードのみで色変換・コピーを行わない */
+		for (; frameCount < target; frameCount++)
+		{
+			if (!mVideoCapture->grab())
+				break;
+		}
+		/* end */
+	}
+
+	/// <summary>
+	/// 次に読み込むフレームが指定フレームになるようシークし, 着地位置を確かめる
+	/// CAP_PROP_POS_FRAMESはsetした値を返すだけのバックエンドがあるので, 直前のフレームをgrab()してその時刻をfpsから求めた時刻と比べる
+	/// </summary>
+	/// <param name="capture">入力ビデオ</param>
+	/// <param name="target">次に読み込むフレーム番号</param>
+	/// <returns>シークできないか着地位置がずれていればfalse, このときの位置は不定</returns>
+	bool FrameReader::SeekToFrame(cv::VideoCapture& capture, const uint64_t& target)
+	{
+		if (target == 0)
+			return capture.set(cv::CAP_PROP_POS_FRAMES, 0.0);
+
+		const auto fps = capture.get(cv::CAP_PROP_FPS);
+		if (fps <= 0.0)
+			return false;
+
+		/* 直前のフレームへシークしてgrab()し, デコードしたフレームの時刻で着地位置を確かめる */
+		const auto previous = target - 1;
+		if (!capture.set(cv::CAP_PROP_POS_FRAMES, static_cast<double>(previous)) || !capture.grab())
+			return false;
+
+		const auto framePeriod = 1000.0 / fps;
+		const auto expectedMsec = static_cast<double>(previous) * framePeriod;
+		return std::abs(capture.get(cv::CAP_PROP_POS_MSEC) - expectedMsec) < framePeriod * 0.5;
+		/* end */
+	}
+};
\ No newline at end of file
@@ -0,0 +1,128 @@
+#pragma once
+#include "ImgProc.h"
+#include "RawFrameSource.h"
+#include "FrameCache.h"
+
+#include <atomic>
+#include <thread>
+
+/// <summary>
+/// デコード先読みスレッド
+/// 事前確保したフレームバッファ群に別スレッドでデコードし, 単一生産者・単一消費者のロックフリーリングバッファで受け渡す
+/// </summary>
+class ImgProc::FrameReader
+{
+private:
+	/// <summary>
+	/// リングバッファの1要素
+	/// </summary>
+	struct FrameSlot
+	{
+		Image frame; // デコード済みフレーム, 空ならストリーム終端
+		uint64_t frameCount = 0; // 先頭を0とするフレーム番号
+		RawFrameSource::AlignedBuffer buffer; // 生フレーム入力のときframeが包むバッファ
+	};
+
+	std::vector<FrameSlot> mSlots; // 事前確保したフレームバッファ群
+	std::atomic<uint64_t> mHead = 0; // 生産者が次に書き込む位置(単調増加)
+	std::atomic<uint64_t> mTail = 0; // 消費者が解放済みの位置(単調増加)
+	uint64_t mAcquired = 0; // 消費者が取り出し済みの位置, 消費者スレッドのみが触る
+	std::atomic<bool> mIsStopped = false; // 生産者スレッドの停止要求
+	std::thread mProducer; // デコードスレッド
+	cv::VideoCapture* mVideoCapture = nullptr; // 入力ビデオキャプチャ, 開始後はデコードスレッドが専有する
+	RawFrameSource* mRawFrameSource = nullptr; // 生フレーム入力, 開始後は読み込みスレッドが専有する. nullptrならmVideoCaptureを使う
+	FrameCache* mFrameCache = nullptr; // デコード済みフレームのキャッシュ, 開始後は読み込みスレッドが専有する. nullptrならmVideoCaptureを使う
+	SeekMode mSeekMode = SeekMode::KEYFRAME; // 読み飛ばし方法
+	uint64_t mSkipBegin = 0; // 読み飛ばすフレーム番号の先頭
+	uint64_t mSkipEnd = 0; // 読み飛ばすフレーム番号の終端(この番号は読み込む)
+	std::atomic<bool> mIsSeekFallenBack = false; // キーフレームシークの位置が合わず逐次読み飛ばしに切り替えたか, 消費者が報告したら下ろす
+
+public:
+	FrameReader() = default;
+	~FrameReader() { Stop(); }
+
+	/// <summary>
+	/// フレームバッファを確保し, デコードスレッドを開始
+	/// </summary>
+	/// <param name="videoCapture">入力ビデオキャプチャ</param>
+	/// <param name="frameSize">フレームサイズ</param>
+	/// <param name="params">リングバッファの要素数, 読み飛ばし方法</param>
+	void Start(cv::VideoCapture& videoCapture, const cv::Size& frameSize, const FrameReaderParams& params);
+
+	/// <summary>
+	/// 生フレーム入力用にページ境界に揃えたフレームバッファを確保し, 読み込みスレッドを開始
+	/// </summary>
+	/// <param name="rawFrameSource">生フレーム入力</param>
+	/// <param name="params">リングバッファの要素数, 生フレーム入力では読み飛ばし方法は使わない</param>
+	void Start(RawFrameSource& rawFrameSource, const FrameReaderParams& params);
+
+	/// <summary>
+	/// キャッシュファイルから読み込むスレッドを開始. フレームはマップ上のビューなのでバッファは確保しない
+	/// </summary>
+	/// <param name="frameCache">開いたキャッシュファイル</param>
+	/// <param name="params">リングバッファの要素数, キャッシュは直接目的のフレームを指せるので読み飛ばし方法は使わない</param>
+	void Start(FrameCache& frameCache, const FrameReaderParams& params);
+
+	/// <summary>
+	/// 読み飛ばすフレーム番号の範囲を設定, Start()より前に呼ぶ
+	/// 範囲内のフレームは色変換もデコード結果の受け渡しも行わず, フレーム番号だけを進める
+	/// </summary>
+	/// <param name="skipBegin">読み飛ばすフレーム番号の先頭</param>
+	/// <param name="skipEnd">読み飛ばすフレーム番号の終端(この番号は読み込む)</param>
+	void SetSkipRange(const uint64_t& skipBegin, const uint64_t& skipEnd) { mSkipBegin = skipBegin; mSkipEnd = skipEnd; }
+
+	/// <summary>
+	/// デコードスレッドを停止
+	/// </summary>
+	void Stop();
+
+	/// <summary>
+	/// 最も古いデコード済みフレームを取り出す. コピーは行わず, リング内のバッファを参照する
+	/// 取り出したフレームはRelease()を呼ぶまで上書きされない
+	/// </summary>
+	/// <param name="frame">フレームの参照先</param>
+	/// <param name="frameCount">フレーム番号の格納先, 終端ならフレーム総数</param>
+	/// <returns>ストリーム終端ならfalse</returns>
+	bool Acquire(Image& frame, uint64_t& frameCount);
+
+	/// <summary>
+	/// 取り出し済みのフレームのうち最も古いものを生産者に返却
+	/// </summary>
+	void Release();
+
+	/// <summary>
+	/// キーフレームシークが逐次読み飛ばしに切り替わったかを取得し, 状態を下ろす. 報告は消費者スレッドで1回だけ行う
+	/// </summary>
+	/// <returns>前回の取得以降に切り替わっていればtrue</returns>
+	bool TakeSeekFallback() { return mIsSeekFallenBack.exchange(false); }
+
+	/// <summary>
+	/// 次に読み込むフレームが指定フレームになるようシークし, 着地位置を確かめる
+	/// CAP_PROP_POS_FRAMESはsetした値を返すだけのバックエンドがあるので, 直前のフレームをgrab()してその時刻をfpsから求めた時刻と比べる
+	/// </summary>
+	/// <param name="capture">入力ビデオ</param>
+	/// <param name="target">次に読み込むフレーム番号</param>
+	/// <returns>シークできないか着地位置がずれていればfalse, このときの位置は不定</returns>
+	static bool SeekToFrame(cv::VideoCapture& capture, const uint64_t& target);
+
+private:
+	FrameReader(const FrameReader& other) = delete;
+
+	/// <summary>
+	/// リングバッファの位置を初期化し, デコードスレッドを開始
+	/// </summary>
+	void StartProducer();
+
+	/// <summary>
+	/// デコードスレッド本体
+	/// </summary>
+	void Produce();
+
+	/// <summary>
+	/// 指定フレームの直前まで読み飛ばす. KEYFRAMEではSeekToFrame()でシークし,
+	/// 着地位置が確認できなければGRABと同じく先頭から逐次読み飛ばす. 生フレーム入力は常に読み捨て, キャッシュは番号を進めるのみ
+	/// </summary>
+	/// <param name="frameCount">現在のフレーム番号, 読み飛ばし後の番号に更新される</param>
+	/// <param name="target">次に読み込むフレーム番号</param>
+	void Seek(uint64_t& frameCount, const uint64_t& target);
+};
\ No newline at end of file
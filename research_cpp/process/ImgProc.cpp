@@ -1,251 +1,141 @@
 #include "ImgProc.h"
-#include "CarsExtractor.h"
-#include "CarsTracer.h"
+#include "PipelineContext.h"
+#include "ShardStitcher.h"
+#include "ParamSweeper.h"
+#include "ThreadPool.h"
+
+#include <cfloat>
+#include <future>
 
 namespace ImgProc
 {
 	/* ImgProcToolkit */
 
 	/* static変数再宣言 */
-	// 入力ビデオキャプチャ
-	cv::VideoCapture ImgProcToolkit::sVideoCapture;
-	// ビデオレコーダー
-	cv::VideoWriter ImgProcToolkit::sVideoWriter;
-	// 入力ビデオの横幅
-	int ImgProcToolkit::sVideoWidth = 0;
-	// 入力ビデオの縦幅
-	int ImgProcToolkit::sVideoHeight = 0;
-	// 入力フレーム
-	Image ImgProcToolkit::sFrame;
-	// 結果画像
-	Image ImgProcToolkit::sResultImg;
-	// 車両二値画像
-	Image ImgProcToolkit::sCarsImg;
-	// 背景画像
-	Image ImgProcToolkit::sBackImg;
-	// 道路マスク画像
-	Image ImgProcToolkit::sRoadMaskGray;
-	// 道路マスク画像(テンプレートマッチング)
-	std::vector<Image> ImgProcToolkit::sRoadMasksGray;
-	/* end */
-
-	/* テンプレート処理に用いる変数 */
-	// 抽出したテンプレートを保存, 車線ごとに保存
-	std::vector<std::unordered_map<uint64_t, Image>> ImgProcToolkit::sTemplatesList;
-	// テンプレートの抽出位置を保存, 車線ごとに保存
-	std::vector<std::unordered_map<uint64_t, cv::Rect2d>> ImgProcToolkit::sTemplatePositionsList;
-	// 車線ごとの車の移動方向を保存
-	std::unordered_map<size_t, RoadDirect> ImgProcToolkit::sRoadCarsDirections;
-	// 車線ごとに検出境界に最も近い(高さの大小)車両IDを保存
-	std::vector<std::unordered_set<uint64_t>> ImgProcToolkit::sBoundaryCarIdLists;
-	/* end */
-
-	// 道路数
-	size_t ImgProcToolkit::sRoadMasksNum = 0;
-
-	// 読み込んだフレーム数
-	uint64_t ImgProcToolkit::sFrameCount = 0;
-	// 初期フレーム
-	uint64_t ImgProcToolkit::sStartFrame = 0;
-	// 終了フレーム
-	uint64_t ImgProcToolkit::sEndFrame = 0;
-	// 検出・追跡中車両台数
-	uint64_t ImgProcToolkit::sCarsNum = 0;
-	// 全フレーム中の検出・追跡中車両台数(前フレームのもの)
-	uint64_t ImgProcToolkit::sCarsNumPrev = 0;
-	// 現在のフレーム中の車両台数
-	uint64_t ImgProcToolkit::sFrameCarsNum = 0;
-	// 検出車両のうち, もっとも最初に検出した車両のID
-	uint64_t ImgProcToolkit::sFrontCarId = 0;
-	/* end */
-
-	/* パラメータ構造体初期化 */
-	DetectAreaInf ImgProcToolkit::sDetectAreaInf{};
-	ExtractorParams ImgProcToolkit::sExtractorParams{};
-	TracerParams ImgProcToolkit::sTracerParams{};
-	TemplateHandleParams ImgProcToolkit::sTemplateHandleParams{};
-	BackImgHandleParams ImgProcToolkit::sBackImgHandleParams{};
+	// テストケースごとの実行コンテキスト
+	std::vector<std::unique_ptr<PipelineContext>> ImgProcToolkit::sContexts;
+	// パラメータ探索を指定したテストケースごとの探索器
+	std::vector<std::unique_ptr<ParamSweeper>> ImgProcToolkit::sSweepers;
 	/* end */
 
-	std::string ImgProcToolkit::sOutputBasePath{};
-
 	/// <summary>
-	/// ビデオリソース読み込み・書き出し設定
+	/// リソース読み込み, executeCaseNumが0以下なら全テストケース, それ以外はその番号のテストケースのみ
 	/// </summary>
-	/// <param name="inputPath">入力ビデオパス</param>
-	/// <param name="outputPath">出力パス</param>
-	void ImgProcToolkit::CreateVideoResource(const std::string& inputPath, const std::string& outputPath)
+	void ImgProcToolkit::SetResourcesAndParams()
 	{
-		sVideoCapture.open(inputPath);
-		if (!sVideoCapture.isOpened())
-		{
-			std::cout << inputPath << ": doesn't exist" << std::endl;
-			assert("failed to read video");
-		}
-
-		auto fourcc = cv::VideoWriter::fourcc('m', 'p', '4', 'v');
-		sVideoWidth = static_cast<int>(sVideoCapture.get(cv::CAP_PROP_FRAME_WIDTH));
-		sVideoHeight = static_cast<int>(sVideoCapture.get(cv::CAP_PROP_FRAME_HEIGHT));
-		auto videoFps = sVideoCapture.get(cv::CAP_PROP_FPS);
+		cv::FileStorage fstorage("./execute.json", 0); // json読み込み
+		const auto executeCaseNum = static_cast<int>(fstorage["executeCaseNum"]); // 実行テストケース番号(1始まり)
+		const auto testCases = fstorage["TestCases"];
 
-		sVideoWriter.open(outputPath, fourcc, videoFps, cv::Size(sVideoWidth, sVideoHeight));
-		if (!sVideoWriter.isOpened())
+		/* 実行するテストケース番号(0始まり)を列挙 */
+		std::vector<int> testCaseNums;
+		if (executeCaseNum <= 0)
 		{
-			std::cout << outputPath << ": can't create or overwrite" << std::endl;
-			assert("failed to overwrite video");
+			for (int testCaseNum = 0; testCaseNum < static_cast<int>(testCases.size()); testCaseNum++)
+				testCaseNums.push_back(testCaseNum);
 		}
-	}
-
-	/// <summary>
-	/// マスク画像等読み込み
-	/// </summary>
-	/// <param name="roadMaskPath">マスク画像（全体）パス</param>
-	/// <param name="roadMasksBasePath">道路マスク画像ベースパス</param>
-	void ImgProcToolkit::CreateImageResource(const std::string& roadMaskPath, const std::string& roadMasksBasePath)
-	{
-		sRoadMaskGray = cv::imread(roadMaskPath);
-		if (sRoadMaskGray.empty())
-		{
-			std::cout << roadMaskPath << ": can't read this." << std::endl;
-			assert("failed to read roadMask");
-		}
-		binarizeImage(sRoadMaskGray);
+		else
+			testCaseNums.push_back(executeCaseNum - 1);
+		/* end */
 
-		size_t idx = 0;
-		while (true)
-		{
-			const auto filePath = roadMasksBasePath + std::to_string(idx) + ".png";
-			auto mask = cv::imread(filePath);
-			if (mask.empty())
-			{
-				if (idx == 0)
-				{
-					std::cout << filePath << ": can't read this." << std::endl;
-					assert("failed to read some roadMasks");
-				}
-				break;
-			}
-			binarizeImage(mask);
-			sRoadMasksGray.push_back(mask.clone());
-			idx++;
-		}
-		sRoadMasksNum = idx;
-		sBoundaryCarIdLists.resize(idx);
-		sTemplatesList.resize(idx);
-		sTemplatePositionsList.resize(idx);
+		sContexts.clear();
+		sSweepers.clear();
+		for (const auto& testCaseNum : testCaseNums)
+			AddContexts(testCases[testCaseNum], testCaseNum);
 	}
 
 	/// <summary>
-	/// 車線ごとの車の移動方向を設定
+	/// 1テストケース分のコンテキストを追加. ShardParamsで分割が指定されていればチャンク数分追加する
+	/// SweepParamsでパラメータ探索が指定されていれば, コンテキストの代わりに探索器を追加する
 	/// </summary>
-	/// <param name="directions">"L"か"R"が格納された配列</param>
-	void ImgProcToolkit::SetRoadCarsDirections(const std::vector<std::string>& directions)
+	/// <param name="root">テストケースパラメータハッシュ</param>
+	/// <param name="testCaseNum">テストケース番号(0始まり)</param>
+	void ImgProcToolkit::AddContexts(const cv::FileNode& root, const int& testCaseNum)
 	{
-		size_t idx = 0;
-		RoadDirect directTemp{};
-		for (const auto& direct : directions)
+		/* パラメータ探索, 共有段とパラメータ組ごとのコンテキストは探索器が持つ. 分割はしない */
+		if (ParamSweeper::IsEnabled(root))
 		{
-			if (direct == "L")
-				directTemp = RoadDirect::LEAVE;
-			else
-				directTemp = RoadDirect::APPROACH;
-
-			sRoadCarsDirections[idx] = directTemp;
-			idx++;
+			sSweepers.push_back(std::make_unique<ParamSweeper>());
+			sSweepers.back()->SetResourcesAndParams(root, testCaseNum);
+			return;
 		}
-	}
+		/* end */
 
-	/// <summary>
-	/// リソース画像表示
-	/// </summary>
-	/// <param name="interval">待機時間[ms]</param>
-	void ImgProcToolkit::ShowResourceImgs(const int& interval)
-	{
-		cv::imshow("", sBackImg);
-		cv::waitKey(interval);
-		cv::imshow("", sRoadMaskGray);
-		cv::waitKey(interval);
-		for (auto itr = sRoadMasksGray.begin(); itr != sRoadMasksGray.end(); itr++)
+		/* 分割指定 */
+		ShardParams shardParams{};
+		const auto shardNode = root["ShardParams"];
+		if (!shardNode.empty())
 		{
-			cv::imshow("", *itr);
-			cv::waitKey(interval);
+			shardParams.shardsNum = static_cast<int>(shardNode["shardsNum"].real());
+			shardParams.overlap = static_cast<int>(shardNode["overlap"].real());
+			shardParams.preRoll = static_cast<int>(shardNode["preRoll"].real());
 		}
-	}
-
-	/// <summary>
-	/// リソース読み込み
-	/// </summary>
-	void ImgProcToolkit::SetResourcesAndParams()
-	{
-		cv::FileStorage fstorage("./execute.json", 0); // json読み込み
-		const auto testCaseNum = static_cast<int>(fstorage["executeCaseNum"]) - 1; // 実行テストケース番号
-		const auto root = fstorage["TestCases"][testCaseNum]; // テストケースパラメータハッシュ
-
-		/* 処理フレーム指定 */
-		sStartFrame = static_cast<uint64_t>(root["startFrame"].real());
-		sEndFrame = static_cast<uint64_t>(root["endFrame"].real());
-		/* end */
-		
-		/* リソース指定 */
-		const auto resources = root["Resources"];
-
-		const auto inputPath = resources["video"].string();
-		sOutputBasePath = resources["result"].string() + "_" + std::to_string(testCaseNum);
-		const auto outputPath = sOutputBasePath + ".mp4";
-		const auto roadMaskPath = resources["mask"].string();
-		const auto roadMasksBasePath = resources["roadMasksBase"].string();
-
-		std::vector<std::string> directions{};
-		const auto roadDirections = resources["roadDirections"];
-		for (int i = 0; i < roadDirections.size(); i++)
-			directions.push_back(roadDirections[i].string());
-
-		CreateVideoResource(inputPath, outputPath);
-		CreateImageResource(roadMaskPath, roadMasksBasePath);
-		SetRoadCarsDirections(directions);
 		/* end */
 
-		/* パラメータ指定 */
-		/* その1 */
-		const auto detectAreaInf = root["DetectAreaInf"];
-		sDetectAreaInf.top = static_cast<int>(detectAreaInf["top"].real());
-		sDetectAreaInf.bottom = static_cast<int>(detectAreaInf["bottom"].real());
-		sDetectAreaInf.mergin = static_cast<int>(detectAreaInf["mergin"].real());
-		sDetectAreaInf.merginPad = static_cast<int>(detectAreaInf["merginPad"].real());
-		sDetectAreaInf.nearOffset = static_cast<int>(detectAreaInf["nearOffset"].real());
+		/* 逐次実行での処理範囲, 初期背景画像の作成に使ったフレームの次から終了フレームまで */
+		BackImgHandleParams backImgHandleParams{};
+		const auto warmupFrames = root["BackImgHandleParams"]["warmupFrames"];
+		if (!warmupFrames.empty())
+			backImgHandleParams.warmupFrames = static_cast<int>(warmupFrames.real());
+		const auto processBegin = static_cast<uint64_t>(root["startFrame"].real()) + backImgHandleParams.warmupFrames;
+		const auto processEnd = static_cast<uint64_t>(root["endFrame"].real());
 		/* end */
 
-		/* その2 */
-		const auto extractorParams = root["ExtractorParams"];
-		sExtractorParams.shadowThrL = static_cast<int>(extractorParams["shadowThrL"].real());
-		sExtractorParams.shadowThrB = static_cast<int>(extractorParams["shadowThrB"].real());
-		sExtractorParams.closeCount = static_cast<int>(extractorParams["closeCount"].real());
-		sExtractorParams.kernelSize = static_cast<int>(extractorParams["kernelSize"].real());
-		sExtractorParams.reshadowAreaThr = static_cast<int>(extractorParams["reshadowAreaThr"].real());
-		sExtractorParams.reshadowAspectThr = static_cast<float>(extractorParams["reshadowAspectThr"].real());
+		/* チャンク数の決定, 重なりの照合ができるよう各チャンクは重なりの2倍以上の長さにする */
+		const auto overlap = static_cast<uint64_t>(std::max(shardParams.overlap, 1));
+		// 生フレーム入力はシークも複数回の読み込みもできないので分割しない
+		const auto isRawInput = (root["InputParams"]["type"].string() == "raw");
+		uint64_t shardsNum = 1;
+		if (shardParams.shardsNum > 1 && processEnd > processBegin && !isRawInput)
+			shardsNum = std::max<uint64_t>(std::min<uint64_t>(shardParams.shardsNum, (processEnd - processBegin + 1) / (overlap * 2)), 1);
 		/* end */
 
-		/* その3 */
-		const auto tracerParams = root["TracerParams"];
-		sTracerParams.minAreaRatio = tracerParams["minAreaRatio"].real();
-		sTracerParams.detectAreaThr = static_cast<int>(tracerParams["detectAreaThr"].real());
-		sTracerParams.minMatchingThr = tracerParams["minMatchingThr"].real();
-		/* end */
+		if (shardsNum == 1)
+		{
+			sContexts.push_back(std::make_unique<PipelineContext>());
+			sContexts.back()->SetResourcesAndParams(root, testCaseNum);
+			return;
+		}
 
-		/* その4 */
-		const auto templateHandleParams = root["TemplateHandleParams"];
-		sTemplateHandleParams.mergin = static_cast<int>(templateHandleParams["mergin"].real());
-		sTemplateHandleParams.magni = templateHandleParams["magni"].real();
-		sTemplateHandleParams.kernelSize = static_cast<int>(templateHandleParams["kernelSize"].real());
-		sTemplateHandleParams.closeCount = static_cast<int>(templateHandleParams["closeCount"].real());
-		sTemplateHandleParams.minAreaRatio = templateHandleParams["minAreaRatio"].real();
-		sTemplateHandleParams.areaThr = static_cast<int>(templateHandleParams["areaThr"].real());
-		/* end */
+		/* チャンクごとにコンテキストを作成 */
+		// 2番目以降のチャンクは重なりの直前のpreRollフレームで初期背景画像を作る
+		const auto shardLength = (processEnd - processBegin + 1) / shardsNum;
+		const auto firstIdx = sContexts.size();
+		for (uint64_t shardIdx = 0; shardIdx < shardsNum; shardIdx++)
+		{
+			ShardRange shard{};
+			shard.shardIdx = static_cast<int>(shardIdx);
+			shard.shardsNum = static_cast<int>(shardsNum);
+			shard.ownedBegin = processBegin + shardIdx * shardLength;
+			shard.ownedEnd = (shardIdx == shardsNum - 1) ? processEnd : shard.ownedBegin + shardLength - 1;
+			shard.processBegin = (shardIdx == 0) ? shard.ownedBegin : shard.ownedBegin - overlap;
+			shard.processEnd = (shardIdx == shardsNum - 1) ? processEnd : shard.ownedEnd + overlap;
+			if (shardIdx == 0)
+				shard.preRoll = backImgHandleParams.warmupFrames;
+			else
+			{
+				const auto preRoll = (shardParams.preRoll > 0) ? shardParams.preRoll : backImgHandleParams.warmupFrames;
+				shard.preRoll = static_cast<int>(std::min<uint64_t>(preRoll, shard.processBegin - 1)); // 0番フレームは使えない
+			}
 
-		/* その5 */
-		const auto backImgHandleParams = root["BackImgHandleParams"];
-		sBackImgHandleParams.blendAlpha = backImgHandleParams["blendAlpha"].real();
+			sContexts.push_back(std::make_unique<PipelineContext>());
+			sContexts.back()->SetShard(shard);
+			sContexts.back()->SetResourcesAndParams(root, testCaseNum);
+		}
 		/* end */
+
+		/* 境界の前後のチャンクで, 境界フレームから重なりの最後のフレームまでの追跡状態を記録する */
+		// 重なりの間に追跡を終えた車両も, 追跡を終えたフレームで照合できるよう毎フレーム記録する
+		for (size_t shardIdx = 0; shardIdx + 1 < shardsNum; shardIdx++)
+		{
+			auto& refTail = *sContexts[firstIdx + shardIdx];
+			auto& refHead = *sContexts[firstIdx + shardIdx + 1];
+			for (auto frameCount = refTail.GetShard().ownedEnd; frameCount <= refTail.GetShard().processEnd; frameCount++)
+			{
+				refTail.RequestTrackSnapshot(frameCount);
+				refHead.RequestTrackSnapshot(frameCount);
+			}
+		}
 		/* end */
 	}
 
@@ -254,58 +144,81 @@ namespace ImgProc
 	/// </summary>
 	void ImgProcToolkit::ShowResourcesAndParams()
 	{
-		std::cout << sStartFrame << std::endl;
-		std::cout << sEndFrame << std::endl;
-
-		//cv::imshow("", sRoadMaskGray);
-		//cv::waitKey(1000);
+		for (auto& context : sContexts)
+			context->ShowResourcesAndParams();
 	}
 
 	/// <summary>
-	/// 処理実行
+	/// 処理実行, 複数のテストケース・チャンクは共有スレッドプール上で並列に実行する
+	/// パラメータ探索はそれより先に1テストケースずつ実行する
 	/// </summary>
 	void ImgProcToolkit::RunImageProcedure()
 	{
-		std::ios::sync_with_stdio(false); // デバッグ出力高速化
-
-		double tick = cv::getTickFrequency(); // 1秒あたりのフレーム数
-
-		CarsExtractor extractor; // 抽出器
-		CarsTracer tracer; // 検出器
-
-		extractor.InitBackgroundImage();
+		// OpenCV内部の並列数はプロセス全体で1つなので, 実行を始める前にここで1回だけ設定する
+		// コンテキストごとの配分はPipelineContext::SetThreadsNum()で行い, 以降は変更しない
+		auto& refThreadPool = GetThreadPool();
+		cv::setNumThreads(static_cast<int>(refThreadPool.GetThreadsNum()));
+
+		/* パラメータ探索, 各探索器が内部で共有スレッドプールを使うので順に実行する */
+		for (auto& sweeper : sSweepers)
+			sweeper->Run();
+		if (sContexts.empty())
+			return;
+		/* end */
 
-		while (true)
+		/* 1テストケースならこのスレッドでそのまま実行 */
+		if (sContexts.size() == 1)
 		{
-			// 実行時間計測開始
-			auto startTime = cv::getTickCount();
+			std::ios::sync_with_stdio(false); // デバッグ出力高速化, 並列実行時はstd::coutの排他が外れるので行わない
+			sContexts.front()->SetThreadsNum(refThreadPool.GetThreadsNum());
+			sContexts.front()->RunImageProcedure();
+			return;
+		}
+		/* end */
 
-			/* ビデオフレーム読み込み */
-			sFrameCount++;
-			sVideoCapture >> sFrame;
-			if (sFrame.empty())
-				break;
-			/* end */
+		/* テストケース単位で並列実行 */
+		// コンテキストごとの並列数を抑え, コア数以上にスレッドが立たないようにする
+		const auto contextsNum = std::max<size_t>(sContexts.size(), 1);
+		std::vector<std::future<void>> runs;
+		for (auto& context : sContexts)
+		{
+			context->SetThreadsNum(refThreadPool.GetThreadsNum() / contextsNum);
+			runs.push_back(refThreadPool.Submit([&context]() { context->RunImageProcedure(); }));
+		}
+		for (auto& run : runs)
+			run.get();
+		/* end */
 
-			if (sFrameCount < sStartFrame)
+		/* 時間方向に分割したテストケースの車両台数を統合 */
+		for (size_t idx = 0; idx < sContexts.size();)
+		{
+			const auto shardsNum = static_cast<size_t>(sContexts[idx]->GetShard().shardsNum);
+			if (shardsNum <= 1)
+			{
+				idx++;
 				continue;
-			else if (sFrameCount > sEndFrame)
-				break;
-
-			/* メイン処理 */
-			extractor.ExtractCars(); // 車両抽出
-			tracer.DetectCars(); // 車両検出・追跡
-			/* end */
-
-			/* 結果出力・実行時間計測 */
-			sVideoWriter << sResultImg;
-			std::cout << sFrameCount << std::endl;
-			auto endTime = cv::getTickCount();
-			std::cout << (double)(endTime - startTime) / tick << std::endl;
-			/* end */
+			}
+
+			std::vector<PipelineContext*> shards;
+			for (size_t shardIdx = 0; shardIdx < shardsNum; shardIdx++)
+				shards.push_back(sContexts[idx + shardIdx].get());
+			ShardStitcher::Stitch(shards);
+			idx += shardsNum;
 		}
+		/* end */
 	}
 
+	/// <summary>
+	/// プロセス全体で共有するスレッドプール
+	/// </summary>
+	/// <returns>初回呼び出し時に生成したスレッドプール</returns>
+	ThreadPool& ImgProcToolkit::GetThreadPool()
+	{
+		static ThreadPool sThreadPool;
+		return sThreadPool;
+	}
+	/* end */
+
 	/* ImgProcToolkit外 */
 	/// <summary>
 	/// 画像の二値化
@@ -318,6 +231,46 @@ namespace ImgProc
 		cv::threshold(inputImg, inputImg, 0, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
 	}
 
+	/// <summary>
+	/// 8bit画像のヒストグラムから大津の閾値を求める. cv::thresholdのTHRESH_OTSUと同じ計算
+	/// </summary>
+	/// <param name="hist">画素値ごとの画素数</param>
+	/// <param name="pixelsNum">画素数</param>
+	/// <returns>閾値, これより大きい画素を前景とする</returns>
+	int calcOtsuThreshold(const uint32_t(&hist)[256], const uint64_t& pixelsNum)
+	{
+		/* OpenCVの実装と同じ順序で計算する */
+		const auto scale = 1.0 / static_cast<double>(pixelsNum);
+		double mu = 0.0;
+		for (int i = 0; i < 256; i++)
+			mu += i * static_cast<double>(hist[i]);
+		mu *= scale;
+
+		double mu1 = 0.0, q1 = 0.0, maxSigma = 0.0;
+		int maxVal = 0;
+		for (int i = 0; i < 256; i++)
+		{
+			const auto pi = hist[i] * scale;
+			mu1 *= q1;
+			q1 += pi;
+			const auto q2 = 1.0 - q1;
+			if ((std::min(q1, q2) < FLT_EPSILON) || (std::max(q1, q2) > 1.0 - FLT_EPSILON))
+				continue;
+
+			mu1 = (mu1 + i * pi) / q1;
+			const auto mu2 = (mu - q1 * mu1) / q2;
+			const auto sigma = q1 * q2 * (mu1 - mu2) * (mu1 - mu2);
+			if (sigma > maxSigma)
+			{
+				maxSigma = sigma;
+				maxVal = i;
+			}
+		}
+		/* end */
+
+		return maxVal;
+	}
+
 	/// <summary>
 	///	画像の部分参照
 	/// </summary>
@@ -2,6 +2,8 @@
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/opencv_modules.hpp>
+#include <array>
+#include <memory>
 #include <unordered_set>
 
 namespace ImgProc
@@ -33,128 +35,253 @@ namespace ImgProc
 		float reshadowAspectThr = 0.0f;
 	};
 
+	enum class MatchMode
+	{
+		CCOEFF = 0, // 探索範囲全体を原寸でcv::TM_CCOEFF_NORMED
+		PYRAMID = 1, // 縮小したフレームとテンプレートで粗く探し, 原寸では近傍だけ探す
+		SAD = 2, // 整数の差の絶対値和, 行和の下界で見込みのない位置を飛ばす
+	};
+
 	struct TracerParams
 	{
 		double minAreaRatio = 0.0;
 		double minMatchingThr = 0.0;
 		int detectAreaThr = 0;
+		MatchMode matchMode = MatchMode::CCOEFF; // テンプレートマッチングの方式
+		int pyramidMinSize = 16; // PYRAMIDで, 最も縮小した段でもテンプレートの短辺がこれ以上になる段数まで縮小する
+		bool binaryEdge = false; // エッジによるマッチングを二値エッジのXORとpopcountで行うか
+		int edgeBinThr = 32; // 二値エッジの閾値, ラプラシアンがこれより大きい画素をエッジとする
 	};
 
 	struct TemplateHandleParams
 	{
 		int mergin = 0;
 		double magni = 0.0;
+		double scaleStep = 1.02; // テンプレートの拡大・縮小段の間隔, 累積倍率に最も近い段を使う
+		double motionGain = 0.0; // 運動モデルの平滑化の重み, 0なら探索範囲は常に前回位置の周囲merginとする
+		int minMergin = 2; // 予測位置の周囲に取る探索範囲の最小幅
 		int kernelSize = 0;
 		int closeCount = 0;
 		double minAreaRatio = 0.0;
 		int areaThr = 0;
 	};
 
+	enum class WarmupMode
+	{
+		MOG2 = 0, // 全フレームをMOG2に通し, 動体を除いて累積する
+		MEDIAN = 1, // warmupStrideおきに抜き出したフレームの画素ごとの時間方向メディアン
+	};
+
 	struct BackImgHandleParams
 	{
 		double blendAlpha = 0.0;
+		int warmupFrames = 500; // 初期背景画像の作成に使うフレーム数, MOG2の履歴長にもなる
+		WarmupMode warmupMode = WarmupMode::MOG2; // 初期背景画像の作成方法
+		int warmupStride = 10; // MEDIANのみ使用, 何フレームおきに抜き出すか. 抜き出したフレームはすべてメモリに載る
+	};
+
+	enum class InputType
+	{
+		VIDEO = 0, // cv::VideoCaptureで開く動画ファイル
+		RAW = 1, // 標準入力・名前付きパイプからの生フレーム
+	};
+
+	enum class RawFormat
+	{
+		BGR24 = 0, // 1画素3バイトのBGR
+		YUV420 = 1, // I420(Y面, U面, V面の順)
+	};
+
+	struct InputParams
+	{
+		InputType type = InputType::VIDEO;
+		RawFormat rawFormat = RawFormat::BGR24; // 以下はRAWのみ使用, 生フレームにはヘッダがないので指定する
+		int width = 0;
+		int height = 0;
+		double fps = 0.0;
+		bool frameCache = false; // VIDEOのみ使用, デコード済みフレームをキャッシュファイルに保存し次回以降はそこから読む
+	};
+
+	enum class SeekMode
+	{
+		KEYFRAME = 0, // 直前のキーフレームへシークしてから読み飛ばす
+		GRAB = 1, // 先頭から色変換なしで逐次読み飛ばす
+	};
+
+	struct FrameReaderParams
+	{
+		int ringSize = 0;
+		SeekMode seekMode = SeekMode::KEYFRAME;
+	};
+
+	enum class WriterBackpressure
+	{
+		BLOCK = 0, // キューが空くまで処理スレッドを待たせる
+		DROP_DEBUG = 1, // 途中結果の出力のみ, キュー満杯ならそのフレームを捨てる
+	};
+
+	struct VideoWriterParams
+	{
+		int queueSize = 0;
+		WriterBackpressure backpressure = WriterBackpressure::BLOCK;
+	};
+
+	/// <summary>
+	/// 途中結果・結果画像の出力箇所
+	/// </summary>
+	enum class TapPoint
+	{
+		SUBTRACTED = 0, // 背景差分画像
+		SHADOW = 1, // 車影画像
+		RESHADOW = 2, // 車影再抽出画像
+		PRE_CARS = 3, // モルフォロジ前の車両抽出画像
+		CARS = 4, // 車両二値画像
+		RESULT = 5, // 結果画像
+	};
+	constexpr size_t TAP_POINT_NUM = 6;
+
+	struct TapPointParams
+	{
+		bool enable = false;
+		int decimation = 1; // nフレームに1回出力
+		cv::Rect roi{}; // 出力範囲, 幅か高さが0ならフレーム全体
+	};
+
+	/// <summary>
+	/// 検出ログに記録する車両ごとのイベント
+	/// </summary>
+	enum class TrackEvent : uint8_t
+	{
+		NEW = 0, // 新規検出
+		TRACED = 1, // 追跡継続
+		LOST = 2, // テンプレートの相関が閾値未満で追跡停止
+		FINISHED = 3, // 検出範囲を抜けて追跡終了
+	};
+
+	/// <summary>
+	/// 検出ログの1行, 1フレーム中の車両1台分のイベント
+	/// </summary>
+	struct DetectionRecord
+	{
+		uint64_t frameCount = 0; // フレーム番号
+		uint32_t roadIdx = 0; // 道路マスク番号
+		uint64_t carId = 0; // 車両ID
+		cv::Rect2d position; // 車両位置, LOSTでは最後に追跡できた位置
+		float score = 0.0f; // テンプレートの相関, NEWでは0
+		TrackEvent event = TrackEvent::NEW; // イベント種別
+	};
+
+	/// <summary>
+	/// 検出ログの1行, 1フレーム分の処理結果
+	/// </summary>
+	struct FrameRecord
+	{
+		uint64_t frameCount = 0; // フレーム番号
+		double elapsed = 0.0; // 処理時間[s]
+		uint64_t carsNum = 0; // このフレームまでの検出台数
+	};
+
+	struct SnapshotParams
+	{
+		bool enable = false;
+		std::string path; // スナップショットのパス, 空なら結果のベースパスに".snapshot"を付けたもの
+		std::string cameraId; // カメラを識別する文字列, 空なら入力パス
+	};
+
+	struct DetectionLogParams
+	{
+		bool enable = false;
+		int blockRows = 4096; // 書き出しスレッドへまとめて渡す行数
+		bool printFrameTimes = true; // フレームごとのフレーム番号と処理時間を標準出力へ出すか
+	};
+
+	/// <summary>
+	/// パイプライン中の1フレーム分のバッファ. 処理中のフレームはそれぞれ専用のものを持つ
+	/// </summary>
+	struct FrameData
+	{
+		Image frame; // 入力フレーム, デコード先読みスレッドのリング内バッファを参照
+		Image backImg; // このフレームで更新した背景画像
+		Image carsImg; // 車両二値画像, 処理範囲の大きさ
+		Image resultImg; // 結果画像
+		std::vector<DetectionRecord> records; // このフレームの検出ログ, 検出ログが無効なら空のまま
+		uint64_t frameCount = 0; // フレーム番号
+	};
+
+	struct ShardParams
+	{
+		int shardsNum = 1; // 処理範囲の分割数, 1以下なら分割しない
+		int overlap = 0; // 隣接チャンクと重ねて処理するフレーム数, 境界をまたぐ車両の照合に使う
+		int preRoll = 0; // 2番目以降のチャンクの初期背景画像の作成に使うフレーム数
+	};
+
+	/// <summary>
+	/// 長い動画を時間方向に分割したときの, 1チャンク分の処理範囲
+	/// </summary>
+	struct ShardRange
+	{
+		int shardIdx = 0; // チャンク番号
+		int shardsNum = 1; // チャンク数, 1なら分割なし
+		uint64_t processBegin = 0; // 処理開始フレーム, 前のチャンクとの重なりを含む
+		uint64_t processEnd = 0; // 処理終了フレーム, 次のチャンクとの重なりを含む
+		uint64_t ownedBegin = 0; // このチャンクが台数に数える車両の初検出フレームの範囲
+		uint64_t ownedEnd = 0;
+		int preRoll = 0; // 初期背景画像の作成に使うフレーム数
+	};
+
+	/// <summary>
+	/// 指定フレームで追跡中だった1台分の状態. チャンク境界での車両の照合に使う
+	/// </summary>
+	struct TrackSnapshot
+	{
+		size_t roadIdx = 0; // 道路マスク番号
+		uint64_t carId = 0; // チャンク内の車両ID
+		uint64_t firstFrame = 0; // 初検出フレーム
+		cv::Rect2d position; // 車両位置
+		Image templ; // テンプレート(クローン)
 	};
 
 	class CarsExtractor;
 	class CarsTracer;
+	class FrameReader;
+	class RawFrameSource;
+	class FrameCache;
+	class MappedFile;
+	class BackgroundSnapshot;
+	class VideoWriterPool;
+	class PipelineContext;
+	class ThreadPool;
+	class ShardStitcher;
+	class DetectionLogWriter;
+	class DetectionLogReader;
+	class ParamSweeper;
+	class LabelFilter;
+	class LaneLabeler;
 
+	/// <summary>
+	/// execute.jsonのテストケースごとにPipelineContextを作り, 実行する
+	/// </summary>
 	class ImgProcToolkit
 	{
 		ImgProcToolkit() = delete; //staticクラスなので
 	private:
-		// 入力ビデオキャプチャ
-		static cv::VideoCapture sVideoCapture;
-		// ビデオレコーダー
-		static cv::VideoWriter sVideoWriter;
-		// 入力ビデオの横幅
-		static int sVideoWidth;
-		// 入力ビデオの縦幅
-		static int sVideoHeight;
-		// 入力フレーム
-		static Image sFrame;
-		// 結果画像
-		static Image sResultImg;
-		// 車両二値画像
-		static Image sCarsImg;
-		// 背景画像
-		static Image sBackImg;
-		// 道路マスク画像
-		static Image sRoadMaskGray;
-		// 道路マスク画像(テンプレートマッチング)
-		static std::vector<Image> sRoadMasksGray;
-		/* end */
-
-		/* テンプレート処理に用いる変数 */
-		// 抽出したテンプレートを保存, 車線ごとに保存
-		static std::vector<std::unordered_map<uint64_t, Image>> sTemplatesList;
-		// テンプレートの抽出位置を保存, 車線ごとに保存
-		static std::vector<std::unordered_map<uint64_t, cv::Rect2d>> sTemplatePositionsList;
-		// 車線ごとの車の移動方向を保存
-		static std::unordered_map<size_t, RoadDirect> sRoadCarsDirections;
-		// 車線ごとに検出境界に最も近い(高さの大小)車両IDを保存
-		static std::vector<std::unordered_set<uint64_t>> sBoundaryCarIdLists;
-		/* end */
-
-		/* ファイルパス関連 */
-		// sRoadMasksのsize数
-		static size_t sRoadMasksNum;
-		/* end */
-
-		// 読み込んだフレーム数
-		static uint64_t sFrameCount;
-		// 初期フレーム
-		static uint64_t sStartFrame;
-		// 終了フレーム
-		static uint64_t sEndFrame;
-		// 全フレーム中の検出・追跡中車両台数
-		static uint64_t sCarsNum;
-		// 全フレーム中の検出・追跡中車両台数(前フレームのもの)
-		static uint64_t sCarsNumPrev;
-		// 現在のフレーム中の車両台数
-		static uint64_t sFrameCarsNum;
-		// 検出車両のうち, もっとも最初に検出した車両のID
-		static uint64_t sFrontCarId;
-
-		/* パラメータ構造体 */
-		static DetectAreaInf sDetectAreaInf; // 検出範囲
-		static ExtractorParams sExtractorParams; // 車両抽出パラメータ
-		static TracerParams sTracerParams; // 車両追跡パラメータ
-		static TemplateHandleParams sTemplateHandleParams; // テンプレート操作パラメータ
-		static BackImgHandleParams sBackImgHandleParams; // 背景処理パラメータ
-		/* end */
-
-		static std::string sOutputBasePath; // 出力動画のベースパス
+		// テストケースごとの実行コンテキスト
+		static std::vector<std::unique_ptr<PipelineContext>> sContexts;
+		// パラメータ探索を指定したテストケースごとの探索器
+		static std::vector<std::unique_ptr<ParamSweeper>> sSweepers;
 
 	private:
 		/// <summary>
-		/// ビデオリソース読み込み・書き出し設定
-		/// </summary>
-		/// <param name="inputPath">入力ビデオパス</param>
-		/// <param name="outputPath">出力パス</param>
-		static void CreateVideoResource(const std::string& inputPath, const std::string& outputPath);
-
-		/// <summary>
-		/// マスク画像等読み込み
+		/// 1テストケース分のコンテキストを追加. ShardParamsで分割が指定されていればチャンク数分追加する
+		/// SweepParamsでパラメータ探索が指定されていれば, コンテキストの代わりに探索器を追加する
 		/// </summary>
-		/// <param name="roadMaskPath">マスク画像（全体）パス</param>
-		/// <param name="roadMasksBasePath">道路マスク画像ベースパス</param>
-		static void CreateImageResource(const std::string& roadMaskPath, const std::string& roadMasksBasePath);
-
-		/// <summary>
-		/// 車線ごとの車の移動方向を設定
-		/// </summary>
-		/// <param name="directions">"L"か"R"が格納された配列</param>
-		static void SetRoadCarsDirections(const std::vector<std::string>& directions);
-
-		/// <summary>
-		/// リソース画像表示
-		/// </summary>
-		/// <param name="interval">待機時間[ms]</param>
-		static void ShowResourceImgs(const int& interval);
+		/// <param name="root">テストケースパラメータハッシュ</param>
+		/// <param name="testCaseNum">テストケース番号(0始まり)</param>
+		static void AddContexts(const cv::FileNode& root, const int& testCaseNum);
 
 	public:
 		/// <summary>
-		/// リソース読み込み
+		/// リソース読み込み, executeCaseNumが0以下なら全テストケース, それ以外はその番号のテストケースのみ
 		/// </summary>
 		static void SetResourcesAndParams();
 
@@ -164,46 +291,16 @@ namespace ImgProc
 		static void ShowResourcesAndParams();
 
 		/// <summary>
-		/// 処理実行
+		/// 処理実行, 複数のテストケース・チャンクは共有スレッドプール上で並列に実行する
+		/// パラメータ探索はそれより先に1テストケースずつ実行する
 		/// </summary>
 		static void RunImageProcedure();
 
-		/* セッタ・ゲッタ */
-		/* セッタ */
-		static void SetCarsNum(const uint64_t& carsNum) { sCarsNum = carsNum; }
-		static void SetCarsNumPrev(const uint64_t& carsNumPrev) { sCarsNumPrev = carsNumPrev; }
-		static void SetFrameCarsNum(const uint64_t& frameCarsNum) { sFrameCarsNum = frameCarsNum; }
-		/* end */
-		/* ゲッタ */
-		static cv::VideoCapture& GetVideoCapture() { return sVideoCapture; }
-		static cv::VideoWriter& GetVideoWriter() { return sVideoWriter; }
-		static std::pair<int, int> GetVideoWidAndHigh() { return std::make_pair(sVideoWidth, sVideoHeight); }
-		static uint64_t& GetStartFrame() { return sStartFrame; }
-		static uint64_t& GetEndFrame() { return sEndFrame; }
-		static Image& GetFrame() { return sFrame; }
-		static Image& GetResult() { return sResultImg; }
-		static Image& GetCars() { return sCarsImg; }
-		static Image& GetBackImg() { return sBackImg; }
-		static const size_t& GetRoadMasksNum() { return sRoadMasksNum; }
-		static Image& GetRoadMaskGray() { return sRoadMaskGray; }
-		static std::vector<Image>& GetRoadMasksGray() { return sRoadMasksGray; }
-		static uint64_t& GetFrameCount() { return sFrameCount; }
-		static uint64_t& GetFrontCarId() { return sFrontCarId; }
-		static uint64_t& GetCarsNum() { return sCarsNum; }
-		static uint64_t& GetFrameCarsNum() { return sFrameCarsNum; }
-		static const uint64_t& GetCarsNumPrev() { return sCarsNumPrev; }
-		static std::vector<std::unordered_map<uint64_t, Image>>& GetTemplatesList() { return sTemplatesList; }
-		static std::vector<std::unordered_map<uint64_t, cv::Rect2d>>& GetTemplatePositionsList() { return sTemplatePositionsList; }
-		static std::unordered_map<size_t, RoadDirect>& GetRoadCarsDirections() { return sRoadCarsDirections; }
-		static std::vector<std::unordered_set<uint64_t>>& GetBoundaryCarIdLists() { return sBoundaryCarIdLists; }
-		static const DetectAreaInf& GetDetectAreaInf() { return sDetectAreaInf; }
-		static const ExtractorParams& GetExtractorParams() { return sExtractorParams; }
-		static const TracerParams& GetTracerParams() { return sTracerParams; }
-		static const TemplateHandleParams& GetTemplateHandleParams() { return sTemplateHandleParams; }
-		static const BackImgHandleParams& GetBackImgHandleParams() { return sBackImgHandleParams; }
-		static const std::string& GetOutputBasePath() { return sOutputBasePath; }
-		/* end */
-		/* end */
+		/// <summary>
+		/// プロセス全体で共有するスレッドプール
+		/// </summary>
+		/// <returns>初回呼び出し時に生成したスレッドプール</returns>
+		static ThreadPool& GetThreadPool();
 	};
 
 	/// <summary>
@@ -212,6 +309,14 @@ namespace ImgProc
 	/// <param name="inputImg">二値化画像</param>
 	void binarizeImage(Image& inputImg);
 
+	/// <summary>
+	/// 8bit画像のヒストグラムから大津の閾値を求める. cv::thresholdのTHRESH_OTSUと同じ計算
+	/// </summary>
+	/// <param name="hist">画素値ごとの画素数</param>
+	/// <param name="pixelsNum">画素数</param>
+	/// <returns>閾値, これより大きい画素を前景とする</returns>
+	int calcOtsuThreshold(const uint32_t(&hist)[256], const uint64_t& pixelsNum);
+
 	/// <summary>
 	///	画像の部分参照
 	/// </summary>
@@ -271,4 +376,4 @@ namespace ImgProc
 	/// <param name="rect">抽出範囲矩形</param>
 	/// <returns>指定範囲の抽出画像(クローン後)</returns>
 	Image ExtractTemplate(const Image& inputImg, const cv::Rect2d& rect);
-};
+};
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include "LabelFilter.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace ImgProc
+{
+	/// <summary>
+	/// ラベル画像を表で引き, 残すラベルの画素のみsrcを写して他を0にする
+	/// </summary>
+	/// <param name="labels">ラベル画像, CV_32SC1</param>
+	/// <param name="src">ラベリングした画像, CV_8UC1</param>
+	/// <param name="dst">出力画像, srcと同じでもよい</param>
+	void LabelFilter::Apply(const Image& labels, const Image& src, Image& dst) const
+	{
+		dst.create(src.size(), CV_8UC1);
+		const auto table = mTable.data();
+		for (int y = 0; y < src.rows; y++)
+		{
+			const auto labelsPtr = labels.ptr<int>(y);
+			const auto srcPtr = src.ptr<uchar>(y);
+			auto dstPtr = dst.ptr<uchar>(y);
+			int x = 0;
+#if CV_SIMD
+			constexpr int lanes = cv::v_uint8::nlanes;
+			for (; x <= src.cols - lanes; x += lanes)
+				cv::v_store(dstPtr + x, cv::v_lut(table, labelsPtr + x) & cv::vx_load(srcPtr + x));
+#endif
+			for (; x < src.cols; x++)
+				dstPtr[x] = table[labelsPtr[x]] & srcPtr[x];
+		}
+#if CV_SIMD
+		cv::vx_cleanup();
+#endif
+	}
+};
\ No newline at end of file
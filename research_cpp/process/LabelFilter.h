@@ -0,0 +1,81 @@
+#pragma once
+#include "ImgProc.h"
+
+/// <summary>
+/// ラベリング後のラベルごとの取捨選択
+/// 統計情報の各行を判定して残す・除くの表を作り, 画素の書き換えはラベル画像を表で引く1回の走査で行う
+/// ラベルごとに全画素を比較して書き換えるとラベル数×画素数かかるので, ラベル数が多いフレームで遅くなる
+/// </summary>
+class ImgProc::LabelFilter
+{
+public:
+	/// <summary>
+	/// 統計情報の1行分
+	/// </summary>
+	struct Stats
+	{
+		int label = 0; // ラベル番号
+		int x = 0; // 外接矩形の左上座標のx成分
+		int y = 0; // 外接矩形の左上座標のy成分
+		int width = 0; // 外接矩形の横幅
+		int height = 0; // 外接矩形の縦幅
+		int area = 0; // 面積
+	};
+
+private:
+	std::vector<uchar> mTable; // ラベル番号ごとに, 残すなら255, 除くなら0
+	std::vector<int> mKeptLabels; // 残すラベル番号, 昇順
+
+public:
+	LabelFilter() = default;
+
+	/// <summary>
+	/// 統計情報の1行を取り出す
+	/// </summary>
+	/// <param name="stats">cv::connectedComponentsWithStatsの統計情報</param>
+	/// <param name="label">ラベル番号</param>
+	/// <returns>統計情報</returns>
+	static Stats ReadStats(const Image& stats, const int& label)
+	{
+		const auto statsPtr = stats.ptr<int>(label);
+		return Stats{ label,
+			statsPtr[cv::ConnectedComponentsTypes::CC_STAT_LEFT],
+			statsPtr[cv::ConnectedComponentsTypes::CC_STAT_TOP],
+			statsPtr[cv::ConnectedComponentsTypes::CC_STAT_WIDTH],
+			statsPtr[cv::ConnectedComponentsTypes::CC_STAT_HEIGHT],
+			statsPtr[cv::ConnectedComponentsTypes::CC_STAT_AREA] };
+	}
+
+	/// <summary>
+	/// 統計情報の各行を判定し, 残すラベルの表を作る. 0番(背景)は常に除く
+	/// </summary>
+	/// <param name="stats">cv::connectedComponentsWithStatsの統計情報</param>
+	/// <param name="labelNum">ラベル数</param>
+	/// <param name="isKept">残すならtrueを返す判定, 引数はconst Stats&</param>
+	template <class Predicate>
+	void Build(const Image& stats, const int& labelNum, Predicate isKept)
+	{
+		mTable.assign(static_cast<size_t>(std::max(labelNum, 1)), 0);
+		mKeptLabels.clear();
+		for (int label = 1; label < labelNum; label++)
+		{
+			if (!isKept(ReadStats(stats, label)))
+				continue;
+			mTable[label] = 255;
+			mKeptLabels.push_back(label);
+		}
+	}
+
+	/// <summary>
+	/// ラベル画像を表で引き, 残すラベルの画素のみsrcを写して他を0にする
+	/// </summary>
+	/// <param name="labels">ラベル画像, CV_32SC1</param>
+	/// <param name="src">ラベリングした画像, CV_8UC1</param>
+	/// <param name="dst">出力画像, srcと同じでもよい</param>
+	void Apply(const Image& labels, const Image& src, Image& dst) const;
+
+	const std::vector<int>& GetKeptLabels() const { return mKeptLabels; }
+
+private:
+	LabelFilter(const LabelFilter& other) = delete;
+};
\ No newline at end of file
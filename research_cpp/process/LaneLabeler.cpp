@@ -0,0 +1,174 @@
+#include "LaneLabeler.h"
+
+namespace ImgProc
+{
+	/// <summary>
+	/// 道路マスク画像から車線番号の画像を作る
+	/// </summary>
+	/// <param name="roadMasksGray">二値化済み道路マスク画像, フレーム全体の大きさ</param>
+	/// <param name="roi">処理範囲</param>
+	/// <returns>道路マスク画像が重なっているか車線が多すぎればfalse, このときは使わない</returns>
+	bool LaneLabeler::Build(const std::vector<Image>& roadMasksGray, const cv::Rect& roi)
+	{
+		mLaneIdx.release();
+		if (roadMasksGray.empty() || (roadMasksGray.size() > MAX_LANES_NUM))
+			return false;
+
+		Image laneIdx = Image::zeros(roi.size(), CV_8UC1);
+		for (size_t lane = 0; lane < roadMasksGray.size(); lane++)
+		{
+			const auto mask = roadMasksGray[lane](roi);
+			for (int y = 0; y < roi.height; y++)
+			{
+				const auto maskPtr = mask.ptr<uchar>(y);
+				auto laneIdxPtr = laneIdx.ptr<uchar>(y);
+				for (int x = 0; x < roi.width; x++)
+				{
+					if (maskPtr[x] == 0)
+						continue;
+					if (laneIdxPtr[x] != 0) // 重なっている
+						return false;
+					laneIdxPtr[x] = static_cast<uchar>(lane + 1);
+				}
+			}
+		}
+
+		mLaneIdx = laneIdx;
+		mLanesNum = roadMasksGray.size();
+		mLaneStats.resize(mLanesNum);
+		mLabelNums.assign(mLanesNum, 1);
+		return true;
+	}
+
+	/// <summary>
+	/// 車両二値画像を車線ごとにラベリングし, 車線ごとの統計情報を作る
+	/// </summary>
+	/// <param name="carsImg">車両二値画像, 処理範囲の大きさ</param>
+	void LaneLabeler::Label(const Image& carsImg)
+	{
+		const auto cols = mLaneIdx.cols;
+		mPrevRow.assign(cols, 0);
+		mCurRow.assign(cols, 0);
+		mParents.assign(1, 0); // 0番は使わない
+		mLabelLanes.assign(1, 0);
+		mBoxes.assign(1, std::array<int, 5>{});
+
+		/* 仮ラベル付け, 上と左の画素が同じ車線の前景なら同じ連結成分とする */
+		for (int y = 0; y < mLaneIdx.rows; y++)
+		{
+			const auto carsPtr = carsImg.ptr<uchar>(y);
+			const auto lanePtr = mLaneIdx.ptr<uchar>(y);
+			const auto prevLanePtr = (y > 0) ? mLaneIdx.ptr<uchar>(y - 1) : nullptr;
+			for (int x = 0; x < cols; x++)
+			{
+				const auto lane = lanePtr[x];
+				if ((carsPtr[x] == 0) || (lane == 0))
+				{
+					mCurRow[x] = 0;
+					continue;
+				}
+
+				const auto up = ((prevLanePtr != nullptr) && (prevLanePtr[x] == lane)) ? mPrevRow[x] : 0;
+				const auto left = ((x > 0) && (lanePtr[x - 1] == lane)) ? mCurRow[x - 1] : 0;
+				int label = 0;
+				if ((up != 0) && (left != 0))
+				{
+					const auto upRoot = FindRoot(up);
+					const auto leftRoot = FindRoot(left);
+					label = std::min(upRoot, leftRoot);
+					mParents[std::max(upRoot, leftRoot)] = label; // 根は小さい方, 最終的なラベル順を先に現れた順に揃える
+				}
+				else if ((up != 0) || (left != 0))
+					label = (up != 0) ? up : left;
+				else
+				{
+					label = static_cast<int>(mParents.size());
+					mParents.push_back(label);
+					mLabelLanes.push_back(lane);
+					mBoxes.push_back(std::array<int, 5>{ x, y, x, y, 0 });
+				}
+
+				auto& refBox = mBoxes[label];
+				refBox[0] = std::min(refBox[0], x);
+				refBox[2] = std::max(refBox[2], x);
+				refBox[3] = y; // 行は昇順に走査するので常に下端
+				refBox[4]++;
+				mCurRow[x] = label;
+			}
+			std::swap(mPrevRow, mCurRow);
+		}
+		/* end */
+
+		/* 根の仮ラベルの小さい順に, 車線内のラベル番号を振る */
+		mLabelNums.assign(mLanesNum, 1);
+		mFinalLabels.assign(mParents.size(), 0);
+		for (size_t label = 1; label < mParents.size(); label++)
+		{
+			if (FindRoot(static_cast<int>(label)) == static_cast<int>(label))
+				mFinalLabels[label] = mLabelNums[mLabelLanes[label] - 1]++;
+		}
+		/* end */
+
+		/* 仮ラベルの外接矩形と面積を根にまとめて, 統計情報に書き込む */
+		for (size_t lane = 0; lane < mLanesNum; lane++)
+		{
+			auto& refStats = mLaneStats[lane];
+			refStats.create(mLabelNums[lane], cv::ConnectedComponentsTypes::CC_STAT_MAX, CV_32SC1);
+			for (int label = 0; label < mLabelNums[lane]; label++)
+			{
+				auto statsPtr = refStats.ptr<int>(label);
+				statsPtr[cv::ConnectedComponentsTypes::CC_STAT_LEFT] = std::numeric_limits<int>::max();
+				statsPtr[cv::ConnectedComponentsTypes::CC_STAT_TOP] = std::numeric_limits<int>::max();
+				statsPtr[cv::ConnectedComponentsTypes::CC_STAT_WIDTH] = std::numeric_limits<int>::min(); // 集計中は右端
+				statsPtr[cv::ConnectedComponentsTypes::CC_STAT_HEIGHT] = std::numeric_limits<int>::min(); // 集計中は下端
+				statsPtr[cv::ConnectedComponentsTypes::CC_STAT_AREA] = 0;
+			}
+		}
+		for (size_t label = 1; label < mParents.size(); label++)
+		{
+			const auto root = mParents[label]; // FindRootで経路は縮めてある
+			const auto& crefBox = mBoxes[label];
+			auto statsPtr = mLaneStats[mLabelLanes[root] - 1].ptr<int>(mFinalLabels[root]);
+			auto& left = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_LEFT];
+			auto& top = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_TOP];
+			auto& right = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_WIDTH];
+			auto& bottom = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_HEIGHT];
+			left = std::min(left, crefBox[0]);
+			top = std::min(top, crefBox[1]);
+			right = std::max(right, crefBox[2]);
+			bottom = std::max(bottom, crefBox[3]);
+			statsPtr[cv::ConnectedComponentsTypes::CC_STAT_AREA] += crefBox[4];
+		}
+		for (size_t lane = 0; lane < mLanesNum; lane++)
+		{
+			auto& refStats = mLaneStats[lane];
+			refStats.row(0).setTo(0); // 背景は使わない
+			for (int label = 1; label < mLabelNums[lane]; label++)
+			{
+				auto statsPtr = refStats.ptr<int>(label);
+				statsPtr[cv::ConnectedComponentsTypes::CC_STAT_WIDTH] -= statsPtr[cv::ConnectedComponentsTypes::CC_STAT_LEFT] - 1;
+				statsPtr[cv::ConnectedComponentsTypes::CC_STAT_HEIGHT] -= statsPtr[cv::ConnectedComponentsTypes::CC_STAT_TOP] - 1;
+			}
+		}
+		/* end */
+	}
+
+	/// <summary>
+	/// 仮ラベルの根を求め, 経路を縮める
+	/// </summary>
+	/// <param name="label">仮ラベル</param>
+	/// <returns>根の仮ラベル</returns>
+	int LaneLabeler::FindRoot(int label)
+	{
+		auto root = label;
+		while (mParents[root] != root)
+			root = mParents[root];
+		while (mParents[label] != root)
+		{
+			const auto parent = mParents[label];
+			mParents[label] = root;
+			label = parent;
+		}
+		return root;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+#include "ImgProc.h"
+
+/// <summary>
+/// 車線ごとのラベリングを1回の走査で行う
+/// 道路マスク画像から画素ごとの車線番号の画像を一度だけ作り, 車両二値画像の画素は同じ車線の隣接画素(4近傍)とだけ連結する
+/// 車線ごとの統計情報はcv::connectedComponentsWithStatsと同じ形式, 同じラベル順で出力する
+/// 道路マスク画像が重なっていると1画素に1車線を割り当てられないので使わない
+/// </summary>
+class ImgProc::LaneLabeler
+{
+private:
+	static constexpr size_t MAX_LANES_NUM = 255; // 車線番号は1画素1バイトで, 0はどの車線でもない
+
+	Image mLaneIdx; // 画素ごとの車線番号+1, 処理範囲の大きさ
+	size_t mLanesNum = 0; // 車線数
+
+	/* ラベリングに用いるバッファ, フレーム間で使い回す */
+	std::vector<int> mPrevRow; // 直前の行の仮ラベル, 0はラベルなし
+	std::vector<int> mCurRow; // 現在の行の仮ラベル
+	std::vector<int> mParents; // 仮ラベルの親, 根は連結成分内で最小の仮ラベル
+	std::vector<uchar> mLabelLanes; // 仮ラベルの車線番号+1
+	std::vector<std::array<int, 5>> mBoxes; // 仮ラベルごとの左端, 上端, 右端, 下端, 面積
+	std::vector<int> mFinalLabels; // 根の仮ラベルごとの, 車線内のラベル番号
+	/* end */
+
+	std::vector<Image> mLaneStats; // 車線ごとの統計情報, 0番は背景
+	std::vector<int> mLabelNums; // 車線ごとのラベル数, 背景を含む
+
+public:
+	LaneLabeler() = default;
+
+	/// <summary>
+	/// 道路マスク画像から車線番号の画像を作る
+	/// </summary>
+	/// <param name="roadMasksGray">二値化済み道路マスク画像, フレーム全体の大きさ</param>
+	/// <param name="roi">処理範囲</param>
+	/// <returns>道路マスク画像が重なっているか車線が多すぎればfalse, このときは使わない</returns>
+	bool Build(const std::vector<Image>& roadMasksGray, const cv::Rect& roi);
+
+	/// <summary>
+	/// 車両二値画像を車線ごとにラベリングし, 車線ごとの統計情報を作る
+	/// </summary>
+	/// <param name="carsImg">車両二値画像, 処理範囲の大きさ</param>
+	void Label(const Image& carsImg);
+
+	bool IsBuilt() const { return !mLaneIdx.empty(); }
+	const Image& GetStats(const size_t& lane) const { return mLaneStats[lane]; }
+	const int& GetLabelNum(const size_t& lane) const { return mLabelNums[lane]; }
+
+private:
+	LaneLabeler(const LaneLabeler& other) = delete;
+
+	/// <summary>
+	/// 仮ラベルの根を求め, 経路を縮める
+	/// </summary>
+	/// <param name="label">仮ラベル</param>
+	/// <returns>根の仮ラベル</returns>
+	int FindRoot(int label);
+};
\ No newline at end of file
@@ -0,0 +1,119 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ImgProc
+{
+	/// <summary>
+	/// ファイル全体をコピーオンライトでマップする
+	/// </summary>
+	/// <param name="path">ファイルパス</param>
+	/// <param name="isSequential">先頭から順に読むか, 先読みを深くし読み終えたページは早めに捨てさせる</param>
+	/// <returns>開けなければfalse</returns>
+	bool MappedFile::Open(const std::string& path, const bool& isSequential)
+	{
+		Close();
+
+#ifdef _WIN32
+		const DWORD flags = isSequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL;
+		mFileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+		if (mFileHandle == INVALID_HANDLE_VALUE)
+		{
+			mFileHandle = nullptr;
+			return false;
+		}
+
+		LARGE_INTEGER fileSize{};
+		GetFileSizeEx(mFileHandle, &fileSize);
+		mSize = static_cast<size_t>(fileSize.QuadPart);
+		if (mSize == 0)
+		{
+			Close();
+			return false;
+		}
+
+		mMappingHandle = CreateFileMappingA(mFileHandle, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		if (mMappingHandle != nullptr)
+			mData = static_cast<uchar*>(MapViewOfFile(mMappingHandle, FILE_MAP_COPY, 0, 0, 0));
+#else
+		mFd = ::open(path.c_str(), O_RDONLY);
+		if (mFd < 0)
+			return false;
+
+		struct stat fileStat {};
+		if ((::fstat(mFd, &fileStat) != 0) || (fileStat.st_size == 0))
+		{
+			Close();
+			return false;
+		}
+		mSize = static_cast<size_t>(fileStat.st_size);
+
+		auto mapped = ::mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, mFd, 0);
+		if (mapped != MAP_FAILED)
+		{
+			mData = static_cast<uchar*>(mapped);
+			if (isSequential)
+				::madvise(mData, mSize, MADV_SEQUENTIAL);
+		}
+#endif
+		if (mData == nullptr)
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// マップを解除してファイルを閉じる. マップ上を指す画像はこれ以降参照しない
+	/// </summary>
+	void MappedFile::Close()
+	{
+#ifdef _WIN32
+		if (mData != nullptr)
+			UnmapViewOfFile(mData);
+		if (mMappingHandle != nullptr)
+			CloseHandle(mMappingHandle);
+		if (mFileHandle != nullptr)
+			CloseHandle(mFileHandle);
+		mMappingHandle = nullptr;
+		mFileHandle = nullptr;
+#else
+		if (mData != nullptr)
+			::munmap(mData, mSize);
+		if (mFd >= 0)
+			::close(mFd);
+		mFd = -1;
+#endif
+		mData = nullptr;
+		mSize = 0;
+	}
+
+	/// <summary>
+	/// 指定範囲の読み込みをOSに依頼する. 読み込みを待たずに戻る
+	/// </summary>
+	/// <param name="offset">先頭からの位置</param>
+	/// <param name="bytes">バイト数</param>
+	void MappedFile::Prefetch(const uint64_t& offset, const uint64_t& bytes) const
+	{
+		if ((mData == nullptr) || (offset + bytes > mSize))
+			return;
+
+#ifdef _WIN32
+		WIN32_MEMORY_RANGE_ENTRY range{ mData + offset, static_cast<SIZE_T>(bytes) };
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+		::madvise(mData + offset, static_cast<size_t>(bytes), MADV_WILLNEED); // offsetはページ境界に揃えて渡す
+#endif
+	}
+};
\ No newline at end of file
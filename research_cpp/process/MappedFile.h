@@ -0,0 +1,52 @@
+#pragma once
+#include "ImgProc.h"
+
+#include <string>
+
+/// <summary>
+/// ファイル全体のコピーオンライトのメモリマップ
+/// マップ上に書き込んでもファイルは変わらないので, 読み込んだ画像をそのまま処理中のバッファとして使える
+/// </summary>
+class ImgProc::MappedFile
+{
+private:
+	uchar* mData = nullptr; // マップ先頭
+	size_t mSize = 0; // マップしたバイト数
+#ifdef _WIN32
+	void* mFileHandle = nullptr; // ファイルハンドル
+	void* mMappingHandle = nullptr; // マッピングハンドル
+#else
+	int mFd = -1; // ファイルディスクリプタ
+#endif
+
+public:
+	MappedFile() = default;
+	~MappedFile() { Close(); }
+
+	/// <summary>
+	/// ファイル全体をコピーオンライトでマップする
+	/// </summary>
+	/// <param name="path">ファイルパス</param>
+	/// <param name="isSequential">先頭から順に読むか, 先読みを深くし読み終えたページは早めに捨てさせる</param>
+	/// <returns>開けなければfalse</returns>
+	bool Open(const std::string& path, const bool& isSequential);
+
+	/// <summary>
+	/// マップを解除してファイルを閉じる. マップ上を指す画像はこれ以降参照しない
+	/// </summary>
+	void Close();
+
+	/// <summary>
+	/// 指定範囲の読み込みをOSに依頼する. 読み込みを待たずに戻る
+	/// </summary>
+	/// <param name="offset">先頭からの位置</param>
+	/// <param name="bytes">バイト数</param>
+	void Prefetch(const uint64_t& offset, const uint64_t& bytes) const;
+
+	bool IsOpened() const { return mData != nullptr; }
+	uchar* GetData() const { return mData; }
+	const size_t& GetSize() const { return mSize; }
+
+private:
+	MappedFile(const MappedFile& other) = delete;
+};
\ No newline at end of file
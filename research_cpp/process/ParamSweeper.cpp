@@ -0,0 +1,337 @@
+#include "ParamSweeper.h"
+#include "PipelineContext.h"
+#include "CarsExtractor.h"
+#include "CarsTracer.h"
+#include "ThreadPool.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <sstream>
+
+namespace ImgProc
+{
+	ParamSweeper::ParamSweeper() : mBase(std::make_unique<PipelineContext>())
+	{
+	}
+
+	ParamSweeper::~ParamSweeper() = default;
+
+	/// <summary>
+	/// テストケースでパラメータ探索が指定されているか
+	/// </summary>
+	/// <param name="root">テストケースパラメータハッシュ</param>
+	/// <returns>SweepParams.enableが0以外ならtrue</returns>
+	bool ParamSweeper::IsEnabled(const cv::FileNode& root)
+	{
+		const auto sweepParams = root["SweepParams"];
+		return !sweepParams.empty() && (static_cast<int>(sweepParams["enable"].real()) != 0);
+	}
+
+	/// <summary>
+	/// 共有段のリソース読み込みと, パラメータ組の展開
+	/// </summary>
+	/// <param name="root">テストケースパラメータハッシュ</param>
+	/// <param name="testCaseNum">テストケース番号(0始まり)</param>
+	void ParamSweeper::SetResourcesAndParams(const cv::FileNode& root, const int& testCaseNum)
+	{
+		mTestCaseNum = testCaseNum;
+		mBase->SetSweepBase();
+		mBase->SetResourcesAndParams(root, testCaseNum);
+
+		const auto sweepParams = root["SweepParams"];
+		mGroundTruthPath = sweepParams["groundTruth"].string();
+
+		/* 探索できるパラメータ */
+		const std::vector<std::pair<std::string, void(*)(ExtractorParams&, const double&)>> extractorFields = {
+			{ "shadowThrL", [](ExtractorParams& params, const double& value) { params.shadowThrL = static_cast<int>(value); } },
+			{ "shadowThrB", [](ExtractorParams& params, const double& value) { params.shadowThrB = static_cast<int>(value); } },
+			{ "closeCount", [](ExtractorParams& params, const double& value) { params.closeCount = static_cast<int>(value); } },
+			{ "kernelSize", [](ExtractorParams& params, const double& value) { params.kernelSize = static_cast<int>(value); } },
+			{ "reshadowAreaThr", [](ExtractorParams& params, const double& value) { params.reshadowAreaThr = static_cast<int>(value); } },
+			{ "reshadowAspectThr", [](ExtractorParams& params, const double& value) { params.reshadowAspectThr = static_cast<float>(value); } },
+		};
+		const std::vector<std::pair<std::string, void(*)(TracerParams&, const double&)>> tracerFields = {
+			{ "minAreaRatio", [](TracerParams& params, const double& value) { params.minAreaRatio = value; } },
+			{ "minMatchingThr", [](TracerParams& params, const double& value) { params.minMatchingThr = value; } },
+			{ "detectAreaThr", [](TracerParams& params, const double& value) { params.detectAreaThr = static_cast<int>(value); } },
+			{ "pyramidMinSize", [](TracerParams& params, const double& value) { params.pyramidMinSize = std::max(static_cast<int>(value), 1); } },
+			{ "edgeBinThr", [](TracerParams& params, const double& value) { params.edgeBinThr = std::clamp(static_cast<int>(value), 0, 254); } },
+		};
+		const std::vector<std::pair<std::string, void(*)(TemplateHandleParams&, const double&)>> templateHandleFields = {
+			{ "mergin", [](TemplateHandleParams& params, const double& value) { params.mergin = static_cast<int>(value); } },
+			{ "magni", [](TemplateHandleParams& params, const double& value) { params.magni = value; } },
+			{ "scaleStep", [](TemplateHandleParams& params, const double& value) { params.scaleStep = std::max(value, 1.001); } },
+			{ "motionGain", [](TemplateHandleParams& params, const double& value) { params.motionGain = std::clamp(value, 0.0, 1.0); } },
+			{ "minMergin", [](TemplateHandleParams& params, const double& value) { params.minMergin = std::max(static_cast<int>(value), 0); } },
+			{ "kernelSize", [](TemplateHandleParams& params, const double& value) { params.kernelSize = static_cast<int>(value); } },
+			{ "closeCount", [](TemplateHandleParams& params, const double& value) { params.closeCount = static_cast<int>(value); } },
+			{ "minAreaRatio", [](TemplateHandleParams& params, const double& value) { params.minAreaRatio = value; } },
+			{ "areaThr", [](TemplateHandleParams& params, const double& value) { params.areaThr = static_cast<int>(value); } },
+		};
+		/* end */
+
+		/* 車両抽出段と車両追跡段のパラメータ組を展開 */
+		const auto extractors = ExpandGrid(mBase->GetExtractorParams(), sweepParams["ExtractorParams"], extractorFields);
+		const auto tracers = ExpandGrid(mBase->GetTracerParams(), sweepParams["TracerParams"], tracerFields);
+		const auto templateHandles = ExpandGrid(mBase->GetTemplateHandleParams(), sweepParams["TemplateHandleParams"], templateHandleFields);
+
+		mExtractorParamsList.clear();
+		mExtractorLabels.clear();
+		mVariants.clear();
+		for (size_t extractorIdx = 0; extractorIdx < extractors.size(); extractorIdx++)
+		{
+			mExtractorParamsList.push_back(extractors[extractorIdx].first);
+			mExtractorLabels.push_back(extractors[extractorIdx].second);
+			for (const auto& [tracerParams, tracerLabel] : tracers)
+			{
+				for (const auto& [templateHandleParams, templateHandleLabel] : templateHandles)
+				{
+					Variant variant;
+					variant.extractorIdx = extractorIdx;
+					variant.tracerParams = tracerParams;
+					variant.templateHandleParams = templateHandleParams;
+					variant.label = tracerLabel + ((tracerLabel.empty() || templateHandleLabel.empty()) ? "" : " ") + templateHandleLabel;
+					mVariants.push_back(variant);
+				}
+			}
+		}
+		/* end */
+
+		std::cout << "Sweep TestCase " << (testCaseNum + 1) << ": " << mExtractorParamsList.size() << " extractors, "
+			<< mVariants.size() << " variants" << std::endl;
+	}
+
+	/// <summary>
+	/// 全パラメータ組を実行し, 結果を出力する. 各段のパラメータ組は共有スレッドプール上で並列に実行する
+	/// </summary>
+	void ParamSweeper::Run()
+	{
+		auto& refBase = *mBase;
+		auto& refThreadPool = ImgProcToolkit::GetThreadPool();
+		const auto tick = cv::getTickFrequency();
+
+		/* 共有段, 入力の読み込みと初期背景画像の作成は1回だけ行う */
+		refBase.SetThreadsNum(refThreadPool.GetThreadsNum()); // 共有段は単独で実行する
+		CarsExtractor baseExtractor(refBase);
+		refBase.StartFrameReader();
+		baseExtractor.InitBackgroundImage();
+		/* end */
+
+		/* パラメータ組ごとのコンテキストを作成, 処理範囲は初期背景画像の作成後のものを引き継ぐ */
+		std::vector<std::unique_ptr<PipelineContext>> extractorContexts, tracerContexts;
+		std::vector<std::unique_ptr<CarsExtractor>> extractors;
+		std::vector<std::unique_ptr<CarsTracer>> tracers;
+		for (const auto& extractorParams : mExtractorParamsList)
+		{
+			extractorContexts.push_back(std::make_unique<PipelineContext>());
+			extractorContexts.back()->SetSweepVariant(refBase, extractorParams, refBase.GetTracerParams(), refBase.GetTemplateHandleParams());
+			extractorContexts.back()->SetThreadsNum(refThreadPool.GetThreadsNum() / mExtractorParamsList.size()); // 同じ段の組で分け合う
+			extractors.push_back(std::make_unique<CarsExtractor>(*extractorContexts.back()));
+		}
+		for (const auto& variant : mVariants)
+		{
+			tracerContexts.push_back(std::make_unique<PipelineContext>());
+			tracerContexts.back()->SetSweepVariant(refBase, mExtractorParamsList[variant.extractorIdx], variant.tracerParams, variant.templateHandleParams);
+			tracerContexts.back()->SetThreadsNum(refThreadPool.GetThreadsNum() / mVariants.size());
+			tracers.push_back(std::make_unique<CarsTracer>(*tracerContexts.back()));
+		}
+		/* end */
+
+		/* 1フレームずつ, 共有段の背景差分を各段のパラメータ組へ配る */
+		FrameData baseFrameData;
+		std::vector<FrameData> extractorFrameDatas(extractors.size()), tracerFrameDatas(tracers.size());
+		std::vector<int64_t> extractorTicks(extractors.size(), 0), tracerTicks(tracers.size(), 0);
+		int64_t sharedTicks = 0;
+		uint64_t framesNum = 0;
+		std::vector<std::future<void>> tasks;
+		const auto startTime = cv::getTickCount();
+		while (refBase.ReadFrame(baseFrameData.frame))
+		{
+			baseFrameData.frameCount = refBase.GetFrameCount();
+			if (baseFrameData.frameCount > refBase.GetEndFrame())
+				break;
+
+			/* 背景差分, 全組で共有 */
+			auto sharedBegin = cv::getTickCount();
+			baseExtractor.SubtractBackImage(baseFrameData);
+			const auto& crefSubtracted = baseExtractor.GetSubtracted();
+			sharedTicks += cv::getTickCount() - sharedBegin;
+			/* end */
+
+			/* 車両抽出, ExtractorParamsが同じ組で共有 */
+			for (size_t extractorIdx = 0; extractorIdx < extractors.size(); extractorIdx++)
+			{
+				tasks.push_back(refThreadPool.Submit([&, extractorIdx]()
+				{
+					auto begin = cv::getTickCount();
+					auto& refFrameData = extractorFrameDatas[extractorIdx];
+					refFrameData.frame = baseFrameData.frame;
+					refFrameData.frameCount = baseFrameData.frameCount;
+					extractors[extractorIdx]->ExtractCars(refFrameData, crefSubtracted);
+					extractorTicks[extractorIdx] += cv::getTickCount() - begin;
+				}));
+			}
+			for (auto& task : tasks)
+				task.get();
+			tasks.clear();
+			/* end */
+
+			/* 車両追跡, 組ごと */
+			for (size_t variantIdx = 0; variantIdx < tracers.size(); variantIdx++)
+			{
+				tasks.push_back(refThreadPool.Submit([&, variantIdx]()
+				{
+					auto begin = cv::getTickCount();
+					auto& refFrameData = tracerFrameDatas[variantIdx];
+					refFrameData.frame = baseFrameData.frame;
+					refFrameData.backImg = baseFrameData.backImg; // テンプレート再抽出で使う
+					refFrameData.carsImg = extractorFrameDatas[mVariants[variantIdx].extractorIdx].carsImg; // 読み取りのみなのでヘッダのみ共有
+					refFrameData.frameCount = baseFrameData.frameCount;
+					tracers[variantIdx]->DetectCars(refFrameData);
+					tracerTicks[variantIdx] += cv::getTickCount() - begin;
+				}));
+			}
+			for (auto& task : tasks)
+				task.get();
+			tasks.clear();
+			/* end */
+
+			refBase.ReleaseFrame();
+			framesNum++;
+		}
+		refBase.StopFrameReader();
+		const auto elapsed = (double)(cv::getTickCount() - startTime) / tick;
+		/* end */
+
+		std::cout << "Sweep TestCase " << (mTestCaseNum + 1) << ": " << framesNum << " frames x " << mVariants.size() << " variants in "
+			<< elapsed << " s (" << ((elapsed > 0.0) ? framesNum * mVariants.size() / elapsed : 0.0) << " variant-frames/s)" << std::endl;
+
+		/* 結果集計, 処理速度は共有段・車両抽出段・車両追跡段の時間を足して単独実行時を見積もる */
+		const auto groundTruth = ReadGroundTruth(mGroundTruthPath);
+		std::vector<Result> results;
+		for (size_t variantIdx = 0; variantIdx < mVariants.size(); variantIdx++)
+		{
+			Result result;
+			result.variantIdx = variantIdx;
+			result.carsNum = tracerContexts[variantIdx]->GetCarsNum();
+			result.error = (groundTruth >= 0) ? static_cast<int64_t>(result.carsNum) - groundTruth : 0;
+
+			const auto variantTicks = sharedTicks + extractorTicks[mVariants[variantIdx].extractorIdx] + tracerTicks[variantIdx];
+			result.fps = (variantTicks > 0) ? framesNum / (variantTicks / tick) : 0.0;
+			results.push_back(result);
+		}
+		Report(results, groundTruth);
+		/* end */
+	}
+
+	/// <summary>
+	/// 探索範囲を展開する. 値の配列が指定されたパラメータごとに, それまでの組み合わせと直積を取る
+	/// </summary>
+	/// <param name="base">テストケースで指定されたパラメータ, 探索しないパラメータはこの値のまま</param>
+	/// <param name="grid">パラメータ名ごとの値の配列</param>
+	/// <param name="fields">探索できるパラメータ名と, その値を設定する関数</param>
+	/// <returns>パラメータ組と, 探索したパラメータの値の組</returns>
+	template <class Params>
+	std::vector<std::pair<Params, std::string>> ParamSweeper::ExpandGrid(const Params& base, const cv::FileNode& grid,
+		const std::vector<std::pair<std::string, void(*)(Params&, const double&)>>& fields)
+	{
+		std::vector<std::pair<Params, std::string>> expanded{ { base, "" } };
+		if (grid.empty())
+			return expanded;
+
+		for (const auto& [name, setter] : fields)
+		{
+			/* 値の列挙, 配列でなければ1つの値とみなす */
+			const auto valuesNode = grid[name];
+			if (valuesNode.empty())
+				continue;
+
+			std::vector<double> values;
+			if (valuesNode.isSeq())
+			{
+				for (int i = 0; i < static_cast<int>(valuesNode.size()); i++)
+					values.push_back(valuesNode[i].real());
+			}
+			else
+				values.push_back(valuesNode.real());
+			/* end */
+
+			/* 直積 */
+			std::vector<std::pair<Params, std::string>> next;
+			for (const auto& [params, label] : expanded)
+			{
+				for (const auto& value : values)
+				{
+					auto nextParams = params;
+					setter(nextParams, value);
+					std::ostringstream nextLabel;
+					nextLabel << label << (label.empty() ? "" : " ") << name << '=' << value;
+					next.emplace_back(nextParams, nextLabel.str());
+				}
+			}
+			expanded.swap(next);
+			/* end */
+		}
+		return expanded;
+	}
+
+	/// <summary>
+	/// 正解台数ファイルを読み込む. 先頭の整数を正解台数とする
+	/// </summary>
+	/// <param name="path">正解台数ファイルのパス</param>
+	/// <returns>読めなければ-1</returns>
+	int64_t ParamSweeper::ReadGroundTruth(const std::string& path)
+	{
+		std::ifstream file(path);
+		int64_t groundTruth = -1;
+		if (!(file >> groundTruth) || (groundTruth < 0))
+		{
+			std::cout << path << ": can't read ground truth, errors are not scored." << std::endl;
+			return -1;
+		}
+		return groundTruth;
+	}
+
+	/// <summary>
+	/// 結果を誤差の小さい順, 同じなら処理速度の速い順に標準出力とCSVへ出力する
+	/// </summary>
+	/// <param name="results">パラメータ組ごとの結果</param>
+	/// <param name="groundTruth">正解台数, 負なら誤差を出さない</param>
+	void ParamSweeper::Report(std::vector<Result>& results, const int64_t& groundTruth)
+	{
+		std::stable_sort(results.begin(), results.end(), [](const Result& lhs, const Result& rhs)
+		{
+			if (std::abs(lhs.error) != std::abs(rhs.error))
+				return std::abs(lhs.error) < std::abs(rhs.error);
+			return lhs.fps > rhs.fps;
+		});
+
+		const auto csvPath = mBase->GetOutputBasePath() + "_sweep.csv";
+		std::ofstream csv(csvPath);
+		if (!csv)
+			std::cout << csvPath << ": can't create or overwrite" << std::endl;
+		csv << "rank,extractor,tracer,cars,groundTruth,error,fps\n";
+
+		std::ostringstream log; // 他のコンテキストの出力と混ざらないよう, まとめて1回で書き出す
+		for (size_t rank = 0; rank < results.size(); rank++)
+		{
+			const auto& crefResult = results[rank];
+			const auto& crefVariant = mVariants[crefResult.variantIdx];
+			const auto& crefExtractorLabel = mExtractorLabels[crefVariant.extractorIdx];
+
+			log << (rank + 1) << ": cars " << crefResult.carsNum;
+			if (groundTruth >= 0)
+				log << " (" << ((crefResult.error > 0) ? "+" : "") << crefResult.error << ")";
+			log << ", " << crefResult.fps << " fps, [" << crefExtractorLabel << "] [" << crefVariant.label << "]\n";
+
+			csv << (rank + 1) << ',' << crefExtractorLabel << ',' << crefVariant.label << ',' << crefResult.carsNum << ',';
+			if (groundTruth >= 0)
+				csv << groundTruth << ',' << crefResult.error;
+			else
+				csv << ',';
+			csv << ',' << crefResult.fps << '\n';
+		}
+		std::cout << log.str() << std::flush;
+	}
+};
\ No newline at end of file
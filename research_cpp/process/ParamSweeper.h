@@ -0,0 +1,92 @@
+#pragma once
+#include "ImgProc.h"
+
+/// <summary>
+/// パラメータ探索
+/// SweepParamsに列挙したExtractorParams, TracerParams, TemplateHandleParamsの全組み合わせを1回の入力読み込みで並列に実行する
+/// 背景差分はどの組でも同じなので1回だけ計算し, 車両抽出はExtractorParamsが同じ組の間で共有する
+/// 各組の車両台数を正解台数と比べ, 単独実行したときの処理速度の見積もりと合わせて出力する
+/// </summary>
+class ImgProc::ParamSweeper
+{
+private:
+	/// <summary>
+	/// 車両追跡段のパラメータ組
+	/// </summary>
+	struct Variant
+	{
+		size_t extractorIdx = 0; // 共有する車両抽出段の番号
+		TracerParams tracerParams{}; // 車両追跡パラメータ
+		TemplateHandleParams templateHandleParams{}; // テンプレート操作パラメータ
+		std::string label; // 探索したパラメータの値, 出力用
+	};
+
+	/// <summary>
+	/// 1パラメータ組の結果
+	/// </summary>
+	struct Result
+	{
+		size_t variantIdx = 0; // パラメータ組の番号
+		uint64_t carsNum = 0; // 車両台数
+		int64_t error = 0; // 正解台数との差
+		double fps = 0.0; // 単独実行したときの処理速度の見積もり, デコードを除く
+	};
+
+	std::unique_ptr<PipelineContext> mBase; // 共有段(入力と背景差分)のコンテキスト
+	std::vector<ExtractorParams> mExtractorParamsList; // 車両抽出段のパラメータ組
+	std::vector<std::string> mExtractorLabels; // 車両抽出段で探索したパラメータの値, 出力用
+	std::vector<Variant> mVariants; // 車両追跡段のパラメータ組
+	std::string mGroundTruthPath; // 正解台数ファイルのパス
+	int mTestCaseNum = 0; // テストケース番号(0始まり)
+
+public:
+	ParamSweeper();
+	~ParamSweeper();
+
+	/// <summary>
+	/// テストケースでパラメータ探索が指定されているか
+	/// </summary>
+	/// <param name="root">テストケースパラメータハッシュ</param>
+	/// <returns>SweepParams.enableが0以外ならtrue</returns>
+	static bool IsEnabled(const cv::FileNode& root);
+
+	/// <summary>
+	/// 共有段のリソース読み込みと, パラメータ組の展開
+	/// </summary>
+	/// <param name="root">テストケースパラメータハッシュ</param>
+	/// <param name="testCaseNum">テストケース番号(0始まり)</param>
+	void SetResourcesAndParams(const cv::FileNode& root, const int& testCaseNum);
+
+	/// <summary>
+	/// 全パラメータ組を実行し, 結果を出力する. 各段のパラメータ組は共有スレッドプール上で並列に実行する
+	/// </summary>
+	void Run();
+
+private:
+	ParamSweeper(const ParamSweeper& other) = delete;
+
+	/// <summary>
+	/// 探索範囲を展開する. 値の配列が指定されたパラメータごとに, それまでの組み合わせと直積を取る
+	/// </summary>
+	/// <param name="base">テストケースで指定されたパラメータ, 探索しないパラメータはこの値のまま</param>
+	/// <param name="grid">パラメータ名ごとの値の配列</param>
+	/// <param name="fields">探索できるパラメータ名と, その値を設定する関数</param>
+	/// <returns>パラメータ組と, 探索したパラメータの値の組</returns>
+	template <class Params>
+	static std::vector<std::pair<Params, std::string>> ExpandGrid(const Params& base, const cv::FileNode& grid,
+		const std::vector<std::pair<std::string, void(*)(Params&, const double&)>>& fields);
+
+	/// <summary>
+	/// 正解台数ファイルを読み込む. 先頭の整数を正解台数とする
+	/// </summary>
+	/// <param name="path">正解台数ファイルのパス</param>
+	/// <returns>読めなければ-1</returns>
+	static int64_t ReadGroundTruth(const std::string& path);
+
+	/// <summary>
+	/// 結果を誤差の小さい順, 同じなら処理速度の速い順に標準出力とCSVへ出力する
+	/// </summary>
+	/// <param name="results">パラメータ組ごとの結果</param>
+	/// <param name="groundTruth">正解台数, 負なら誤差を出さない</param>
+	void Report(std::vector<Result>& results, const int64_t& groundTruth);
+};
\ No newline at end of file
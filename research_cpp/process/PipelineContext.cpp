@@ -0,0 +1,855 @@
+#include "PipelineContext.h"
+#include "CarsExtractor.h"
+#include "CarsTracer.h"
+
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace ImgProc
+{
+	/// <summary>
+	/// ビデオリソース読み込み・書き出し設定
+	/// </summary>
+	/// <param name="inputPath">入力ビデオパス</param>
+	/// <param name="outputBasePath">出力ベースパス</param>
+	void PipelineContext::CreateVideoResource(const std::string& inputPath, const std::string& outputBasePath)
+	{
+		/* 生フレーム入力, ヘッダがないのでサイズとフレームレートは設定値を使う */
+		if (mInputParams.type == InputType::RAW)
+		{
+			mVideoWidth = mInputParams.width;
+			mVideoHeight = mInputParams.height;
+			mVideoFps = mInputParams.fps;
+			if (!mRawFrameSource.Open(inputPath, mInputParams.rawFormat, cv::Size(mVideoWidth, mVideoHeight)))
+			{
+				std::cout << inputPath << ": can't open this." << std::endl;
+				assert("failed to open raw frame stream");
+			}
+		}
+		/* end */
+		else
+		{
+			mVideoCapture.open(inputPath);
+			if (!mVideoCapture.isOpened())
+			{
+				std::cout << inputPath << ": doesn't exist" << std::endl;
+				assert("failed to read video");
+			}
+
+			mVideoWidth = static_cast<int>(mVideoCapture.get(cv::CAP_PROP_FRAME_WIDTH));
+			mVideoHeight = static_cast<int>(mVideoCapture.get(cv::CAP_PROP_FRAME_HEIGHT));
+			mVideoFps = mVideoCapture.get(cv::CAP_PROP_FPS);
+
+			/* デコード済みフレームのキャッシュ, 終了フレームまで入っていないか動画が置き換えられていれば作り直す */
+			if (mInputParams.frameCache)
+			{
+				const auto cachePath = FrameCache::GetCachePath(inputPath);
+				const auto frameNum = mEndFrame + 1; // 0番フレームから終了フレームまで
+				const auto sourceFrameCount = static_cast<uint64_t>(mVideoCapture.get(cv::CAP_PROP_FRAME_COUNT));
+				if (!mFrameCache.Open(cachePath, inputPath, sourceFrameCount) || !mFrameCache.Covers(frameNum))
+				{
+					mFrameCache.Close();
+					if (FrameCache::Build(mVideoCapture, inputPath, cachePath, frameNum))
+						mFrameCache.Open(cachePath, inputPath, sourceFrameCount);
+					else
+						std::cout << cachePath << ": can't write this, decode the video instead." << std::endl;
+
+					mVideoCapture.release(); // 作成でストリームを読み進めたので開き直す
+					mVideoCapture.open(inputPath);
+				}
+
+				if (mFrameCache.IsOpened())
+					mVideoCapture.release(); // 以降はキャッシュのみから読む
+			}
+			/* end */
+		}
+
+		/* 有効なタップポイントのみ書き出し先を開く */
+		const std::string suffixes[TAP_POINT_NUM] = { "_Sub", "_Shadow", "_ReShadow", "_PreCars", "_Cars", "" };
+		const cv::Rect frameRect(0, 0, mVideoWidth, mVideoHeight);
+		mVideoWriterPool.SetParams(mVideoWriterParams);
+		for (size_t tapIdx = 0; tapIdx < TAP_POINT_NUM; tapIdx++)
+		{
+			auto& refTapParams = mTapPointParams[tapIdx];
+			if (!refTapParams.enable)
+				continue;
+
+			const auto outputPath = outputBasePath + suffixes[tapIdx] + ".mp4";
+
+			/* 出力範囲をフレーム内に収める. フレーム外の範囲は空になるのでフレーム全体に戻す */
+			if (refTapParams.roi.empty())
+				refTapParams.roi = frameRect;
+			refTapParams.roi &= frameRect;
+			if (refTapParams.roi.empty())
+			{
+				std::cout << outputPath << ": roi is outside the frame, output the whole frame instead." << std::endl;
+				refTapParams.roi = frameRect;
+			}
+			/* end */
+
+			const auto isDebug = (static_cast<TapPoint>(tapIdx) != TapPoint::RESULT);
+			mTapWriterIds[tapIdx] = mVideoWriterPool.Open(outputPath, mVideoFps, refTapParams.roi.size(), isDebug);
+		}
+		/* end */
+
+		/* 検出ログ, 開けなければ記録しない */
+		if (mDetectionLogParams.enable)
+			mDetectionLogParams.enable = mDetectionLogWriter.Open(outputBasePath + ".detlog", mDetectionLogParams);
+		/* end */
+	}
+
+	/// <summary>
+	/// タップポイントの出力設定を読み込む
+	/// </summary>
+	/// <param name="tapPoints">"TapPoints"ノード</param>
+	void PipelineContext::SetTapPointParams(const cv::FileNode& tapPoints)
+	{
+		const std::string names[TAP_POINT_NUM] = { "Subtracted", "Shadow", "ReShadow", "PreCars", "Cars", "Result" };
+
+		/* 指定がなければ結果画像のみ出力 */
+		if (tapPoints.empty())
+		{
+			mTapPointParams[static_cast<size_t>(TapPoint::RESULT)].enable = true;
+			return;
+		}
+		/* end */
+
+		for (size_t tapIdx = 0; tapIdx < TAP_POINT_NUM; tapIdx++)
+		{
+			const auto tapPoint = tapPoints[names[tapIdx]];
+			auto& refTapParams = mTapPointParams[tapIdx];
+			if (tapPoint.empty())
+				continue;
+
+			refTapParams.enable = static_cast<int>(tapPoint["enable"].real()) != 0;
+			refTapParams.decimation = std::max(static_cast<int>(tapPoint["decimation"].real()), 1);
+
+			const auto roi = tapPoint["roi"];
+			if (roi.size() == 4)
+			{
+				refTapParams.roi = cv::Rect(static_cast<int>(roi[0].real()), static_cast<int>(roi[1].real()),
+					static_cast<int>(roi[2].real()), static_cast<int>(roi[3].real()));
+			}
+		}
+	}
+
+	/// <summary>
+	/// マスク画像等読み込み
+	/// </summary>
+	/// <param name="roadMaskPath">マスク画像（全体）パス</param>
+	/// <param name="roadMasksBasePath">道路マスク画像ベースパス</param>
+	void PipelineContext::CreateImageResource(const std::string& roadMaskPath, const std::string& roadMasksBasePath)
+	{
+		/* スナップショットが新しければ, 二値化済みのマスク画像をそこから参照する */
+		if (mSnapshotParams.enable)
+		{
+			const auto masksWriteTime = BackgroundSnapshot::GetMasksWriteTime(roadMaskPath, roadMasksBasePath);
+			if (mSnapshot.Open(mSnapshotParams.path, mSnapshotParams.cameraId, cv::Size(mVideoWidth, mVideoHeight), masksWriteTime, mBackImgHandleParams))
+			{
+				mRoadMaskGray = mSnapshot.GetRoadMaskGray();
+				mRoadMasksGray = mSnapshot.GetRoadMasksGray();
+				mRoadMasksNum = mRoadMasksGray.size();
+				mBoundaryCarIdLists.resize(mRoadMasksNum);
+				mTemplatesList.resize(mRoadMasksNum);
+				mTemplatePositionsList.resize(mRoadMasksNum);
+				return;
+			}
+		}
+		/* end */
+
+		mRoadMaskGray = cv::imread(roadMaskPath);
+		if (mRoadMaskGray.empty())
+		{
+			std::cout << roadMaskPath << ": can't read this." << std::endl;
+			assert("failed to read roadMask");
+		}
+		binarizeImage(mRoadMaskGray);
+
+		size_t idx = 0;
+		while (true)
+		{
+			const auto filePath = roadMasksBasePath + std::to_string(idx) + ".png";
+			auto mask = cv::imread(filePath);
+			if (mask.empty())
+			{
+				if (idx == 0)
+				{
+					std::cout << filePath << ": can't read this." << std::endl;
+					assert("failed to read some roadMasks");
+				}
+				break;
+			}
+			binarizeImage(mask);
+			mRoadMasksGray.push_back(mask.clone());
+			idx++;
+		}
+		mRoadMasksNum = idx;
+		mBoundaryCarIdLists.resize(idx);
+		mTemplatesList.resize(idx);
+		mTemplatePositionsList.resize(idx);
+	}
+
+	/// <summary>
+	/// 処理範囲を決める. 道路マスクの外接矩形の和を, 検出範囲に検出・テンプレートの余白を加えた帯で切り取る
+	/// あわせて処理範囲内で道路マスク画像が重なっていないかを調べる
+	/// </summary>
+	void PipelineContext::SetProcessRoi()
+	{
+		const cv::Rect frameRect(0, 0, mVideoWidth, mVideoHeight);
+		cv::Rect roadRect;
+		for (const auto& mask : mRoadMasksGray)
+			roadRect |= cv::boundingRect(mask); // 道路マスク外は抽出しても追跡時に0にされる
+
+		const auto mergin = mDetectAreaInf.mergin + mDetectAreaInf.merginPad + mTemplateHandleParams.mergin;
+		const cv::Rect detectBand(0, mDetectAreaInf.top - mergin, mVideoWidth, mDetectAreaInf.bottom - mDetectAreaInf.top + mergin * 2);
+		mProcessRoi = roadRect & detectBand & frameRect;
+		if (mProcessRoi.empty()) // 検出範囲の指定がなければフレーム全体
+			mProcessRoi = frameRect;
+
+		/* 道路マスク画像の重なり判定, 重なっていれば追跡時に車線ごとにラベリングする */
+		mAreRoadMasksDisjoint = !mRoadMasksGray.empty();
+		Image roadUnion = Image::zeros(mProcessRoi.size(), CV_8UC1);
+		Image overlap;
+		for (const auto& mask : mRoadMasksGray)
+		{
+			cv::bitwise_and(roadUnion, mask(mProcessRoi), overlap);
+			if (cv::countNonZero(overlap) > 0)
+			{
+				mAreRoadMasksDisjoint = false;
+				break;
+			}
+			cv::bitwise_or(roadUnion, mask(mProcessRoi), roadUnion);
+		}
+		if (!mAreRoadMasksDisjoint && (mShard.shardIdx == 0)) // 分割時は先頭チャンクのみ表示する
+			std::cout << mInputPath << ": road masks overlap, label each lane separately." << std::endl;
+		/* end */
+	}
+
+	/// <summary>
+	/// 背景モデルと道路マスクのスナップショットを書き出す. スナップショットが無効なら何もしない
+	/// </summary>
+	/// <param name="backImgFixed">背景モデル, CV_16UC3(Q8.8)</param>
+	void PipelineContext::SaveSnapshot(const Image& backImgFixed)
+	{
+		if (!mSnapshotParams.enable)
+			return;
+
+		/* 書き出しでマップを閉じるので, マップを参照しているマスク画像は先に複製する */
+		if (mSnapshot.IsOpened())
+		{
+			mRoadMaskGray = mRoadMaskGray.clone();
+			for (auto& refMask : mRoadMasksGray)
+				refMask = refMask.clone();
+		}
+		/* end */
+
+		BackgroundSnapshot::Header header{};
+		header.cameraHash = BackgroundSnapshot::HashCameraId(mSnapshotParams.cameraId);
+		header.masksWriteTime = BackgroundSnapshot::GetMasksWriteTime(mRoadMaskPath, mRoadMasksBasePath);
+		header.frameCount = mFrameCount;
+		header.backImgHandleParams = mBackImgHandleParams;
+		if (!mSnapshot.Save(mSnapshotParams.path, header, backImgFixed, mRoadMaskGray, mRoadMasksGray))
+			std::cout << mSnapshotParams.path << ": can't write snapshot" << std::endl;
+	}
+
+	/// <summary>
+	/// 車線ごとの車の移動方向を設定
+	/// </summary>
+	/// <param name="directions">"L"か"R"が格納された配列</param>
+	void PipelineContext::SetRoadCarsDirections(const std::vector<std::string>& directions)
+	{
+		size_t idx = 0;
+		RoadDirect directTemp{};
+		for (const auto& direct : directions)
+		{
+			if (direct == "L")
+				directTemp = RoadDirect::LEAVE;
+			else
+				directTemp = RoadDirect::APPROACH;
+
+			mRoadCarsDirections[idx] = directTemp;
+			idx++;
+		}
+	}
+
+	/// <summary>
+	/// リソース画像表示
+	/// </summary>
+	/// <param name="interval">待機時間[ms]</param>
+	void PipelineContext::ShowResourceImgs(const int& interval)
+	{
+		cv::imshow("", mBackImg);
+		cv::waitKey(interval);
+		cv::imshow("", mRoadMaskGray);
+		cv::waitKey(interval);
+		for (auto itr = mRoadMasksGray.begin(); itr != mRoadMasksGray.end(); itr++)
+		{
+			cv::imshow("", *itr);
+			cv::waitKey(interval);
+		}
+	}
+
+	/// <summary>
+	/// リソース読み込み
+	/// </summary>
+	/// <param name="root">テストケースパラメータハッシュ</param>
+	/// <param name="testCaseNum">テストケース番号(0始まり)</param>
+	void PipelineContext::SetResourcesAndParams(const cv::FileNode& root, const int& testCaseNum)
+	{
+		mTestCaseNum = testCaseNum;
+
+		/* 処理フレーム指定 */
+		mStartFrame = static_cast<uint64_t>(root["startFrame"].real());
+		mEndFrame = static_cast<uint64_t>(root["endFrame"].real());
+		/* end */
+		
+		/* リソース指定 */
+		const auto resources = root["Resources"];
+
+		const auto inputPath = resources["video"].string();
+		mInputPath = inputPath;
+		mOutputBasePath = resources["result"].string() + "_" + std::to_string(testCaseNum);
+		if (mShard.shardsNum > 1)
+			mOutputBasePath += "_shard" + std::to_string(mShard.shardIdx);
+		const auto roadMaskPath = resources["mask"].string();
+		const auto roadMasksBasePath = resources["roadMasksBase"].string();
+
+		std::vector<std::string> directions{};
+		const auto roadDirections = resources["roadDirections"];
+		for (int i = 0; i < roadDirections.size(); i++)
+			directions.push_back(roadDirections[i].string());
+
+		/* 動画書き出しパラメータ, 書き出し先を開く前に設定する */
+		const auto videoWriterParams = root["VideoWriterParams"];
+		mVideoWriterParams.queueSize = static_cast<int>(videoWriterParams["queueSize"].real());
+		if (videoWriterParams["backpressure"].string() == "drop")
+			mVideoWriterParams.backpressure = WriterBackpressure::DROP_DEBUG;
+		else
+			mVideoWriterParams.backpressure = WriterBackpressure::BLOCK;
+		/* end */
+
+		/* 検出ログパラメータ, 指定がなければ記録せず, 標準出力に処理時間を出す */
+		const auto detectionLogParams = root["DetectionLogParams"];
+		if (!detectionLogParams.empty())
+		{
+			mDetectionLogParams.enable = static_cast<int>(detectionLogParams["enable"].real()) != 0;
+			if (!detectionLogParams["blockRows"].empty())
+				mDetectionLogParams.blockRows = static_cast<int>(detectionLogParams["blockRows"].real());
+			if (!detectionLogParams["printFrameTimes"].empty())
+				mDetectionLogParams.printFrameTimes = static_cast<int>(detectionLogParams["printFrameTimes"].real()) != 0;
+		}
+		/* end */
+
+		/* スナップショットパラメータ, 時間方向に分割したチャンクは途中から始まるので使わない */
+		const auto snapshotParams = root["SnapshotParams"];
+		if (!snapshotParams.empty() && (mShard.shardsNum <= 1))
+		{
+			mSnapshotParams.enable = static_cast<int>(snapshotParams["enable"].real()) != 0;
+			mSnapshotParams.path = snapshotParams["path"].string();
+			mSnapshotParams.cameraId = snapshotParams["cameraId"].string();
+		}
+		if (mSnapshotParams.path.empty())
+			mSnapshotParams.path = mOutputBasePath + ".snapshot";
+		if (mSnapshotParams.cameraId.empty())
+			mSnapshotParams.cameraId = inputPath;
+		mRoadMaskPath = roadMaskPath;
+		mRoadMasksBasePath = roadMasksBasePath;
+		/* end */
+
+		/* 背景処理パラメータ, スナップショットの古さの確認に使うので画像リソースより先に設定する */
+		const auto backImgHandleParams = root["BackImgHandleParams"];
+		mBackImgHandleParams.blendAlpha = backImgHandleParams["blendAlpha"].real();
+		if (!backImgHandleParams["warmupFrames"].empty())
+			mBackImgHandleParams.warmupFrames = static_cast<int>(backImgHandleParams["warmupFrames"].real());
+		if (backImgHandleParams["warmupMode"].string() == "median")
+			mBackImgHandleParams.warmupMode = WarmupMode::MEDIAN;
+		if (!backImgHandleParams["warmupStride"].empty())
+			mBackImgHandleParams.warmupStride = std::max(static_cast<int>(backImgHandleParams["warmupStride"].real()), 1);
+		/* end */
+
+		/* 入力パラメータ, 指定がなければ動画ファイル */
+		const auto inputParams = root["InputParams"];
+		if (!inputParams.empty() && inputParams["type"].string() == "raw")
+		{
+			mInputParams.type = InputType::RAW;
+			mInputParams.rawFormat = (inputParams["rawFormat"].string() == "yuv420") ? RawFormat::YUV420 : RawFormat::BGR24;
+			mInputParams.width = static_cast<int>(inputParams["width"].real());
+			mInputParams.height = static_cast<int>(inputParams["height"].real());
+			mInputParams.fps = inputParams["fps"].real();
+		}
+		if (!inputParams.empty())
+			mInputParams.frameCache = static_cast<int>(inputParams["frameCache"].real()) != 0;
+		/* end */
+
+		/* フレーム読み込みパラメータ */
+		const auto frameReaderParams = root["FrameReaderParams"];
+		mFrameReaderParams.ringSize = static_cast<int>(frameReaderParams["ringSize"].real());
+		if (frameReaderParams["seekMode"].string() == "grab")
+			mFrameReaderParams.seekMode = SeekMode::GRAB;
+		else
+			mFrameReaderParams.seekMode = SeekMode::KEYFRAME;
+		/* end */
+
+		SetTapPointParams(root["TapPoints"]);
+		if (mIsSweepBase)
+		{
+			for (auto& refTapParams : mTapPointParams)
+				refTapParams.enable = false;
+			mDetectionLogParams.enable = false;
+		}
+		CreateVideoResource(inputPath, mOutputBasePath);
+		CreateImageResource(roadMaskPath, roadMasksBasePath);
+		SetRoadCarsDirections(directions);
+		/* end */
+
+		/* パラメータ指定 */
+		/* その1 */
+		const auto detectAreaInf = root["DetectAreaInf"];
+		mDetectAreaInf.top = static_cast<int>(detectAreaInf["top"].real());
+		mDetectAreaInf.bottom = static_cast<int>(detectAreaInf["bottom"].real());
+		mDetectAreaInf.mergin = static_cast<int>(detectAreaInf["mergin"].real());
+		mDetectAreaInf.merginPad = static_cast<int>(detectAreaInf["merginPad"].real());
+		mDetectAreaInf.nearOffset = static_cast<int>(detectAreaInf["nearOffset"].real());
+		/* end */
+
+		/* その2 */
+		const auto extractorParams = root["ExtractorParams"];
+		mExtractorParams.shadowThrL = static_cast<int>(extractorParams["shadowThrL"].real());
+		mExtractorParams.shadowThrB = static_cast<int>(extractorParams["shadowThrB"].real());
+		mExtractorParams.closeCount = static_cast<int>(extractorParams["closeCount"].real());
+		mExtractorParams.kernelSize = static_cast<int>(extractorParams["kernelSize"].real());
+		mExtractorParams.reshadowAreaThr = static_cast<int>(extractorParams["reshadowAreaThr"].real());
+		mExtractorParams.reshadowAspectThr = static_cast<float>(extractorParams["reshadowAspectThr"].real());
+		/* end */
+
+		/* その3 */
+		const auto tracerParams = root["TracerParams"];
+		mTracerParams.minAreaRatio = tracerParams["minAreaRatio"].real();
+		mTracerParams.detectAreaThr = static_cast<int>(tracerParams["detectAreaThr"].real());
+		mTracerParams.minMatchingThr = tracerParams["minMatchingThr"].real();
+		if (tracerParams["matchMode"].string() == "pyramid")
+			mTracerParams.matchMode = MatchMode::PYRAMID;
+		else if (tracerParams["matchMode"].string() == "sad")
+			mTracerParams.matchMode = MatchMode::SAD;
+		if (!tracerParams["pyramidMinSize"].empty())
+			mTracerParams.pyramidMinSize = std::max(static_cast<int>(tracerParams["pyramidMinSize"].real()), 1);
+		if (!tracerParams["binaryEdge"].empty())
+			mTracerParams.binaryEdge = static_cast<int>(tracerParams["binaryEdge"].real()) != 0;
+		if (!tracerParams["edgeBinThr"].empty())
+			mTracerParams.edgeBinThr = std::clamp(static_cast<int>(tracerParams["edgeBinThr"].real()), 0, 254);
+		/* end */
+
+		/* その4 */
+		const auto templateHandleParams = root["TemplateHandleParams"];
+		mTemplateHandleParams.mergin = static_cast<int>(templateHandleParams["mergin"].real());
+		mTemplateHandleParams.magni = templateHandleParams["magni"].real();
+		if (!templateHandleParams["scaleStep"].empty())
+			mTemplateHandleParams.scaleStep = std::max(templateHandleParams["scaleStep"].real(), 1.001); // 1以下では段が作れない
+		if (!templateHandleParams["motionGain"].empty())
+			mTemplateHandleParams.motionGain = std::clamp(templateHandleParams["motionGain"].real(), 0.0, 1.0);
+		if (!templateHandleParams["minMergin"].empty())
+			mTemplateHandleParams.minMergin = std::max(static_cast<int>(templateHandleParams["minMergin"].real()), 0);
+		mTemplateHandleParams.kernelSize = static_cast<int>(templateHandleParams["kernelSize"].real());
+		mTemplateHandleParams.closeCount = static_cast<int>(templateHandleParams["closeCount"].real());
+		mTemplateHandleParams.minAreaRatio = templateHandleParams["minAreaRatio"].real();
+		mTemplateHandleParams.areaThr = static_cast<int>(templateHandleParams["areaThr"].real());
+		/* end */
+		/* end */
+
+		/* 時間方向に分割するときは, チャンクの処理範囲の直前を初期背景画像の作成に使う */
+		if (mShard.shardsNum > 1)
+		{
+			mBackImgHandleParams.warmupFrames = mShard.preRoll;
+			mStartFrame = mShard.processBegin - mShard.preRoll;
+			mEndFrame = mShard.processEnd;
+		}
+		/* end */
+
+		SetProcessRoi();
+	}
+
+	/// <summary>
+	/// パラメータ探索の1パラメータ組として, 共有段のコンテキストからリソースと処理範囲を引き継ぐ
+	/// 入力は開かず, 動画と検出ログも出力しない. 共有段の初期背景画像の作成後に呼ぶ
+	/// </summary>
+	/// <param name="base">共有段のコンテキスト</param>
+	/// <param name="extractorParams">車両抽出パラメータ</param>
+	/// <param name="tracerParams">車両追跡パラメータ</param>
+	/// <param name="templateHandleParams">テンプレート操作パラメータ</param>
+	void PipelineContext::SetSweepVariant(const PipelineContext& base, const ExtractorParams& extractorParams,
+		const TracerParams& tracerParams, const TemplateHandleParams& templateHandleParams)
+	{
+		mTestCaseNum = base.mTestCaseNum;
+		mOutputBasePath = base.mOutputBasePath;
+
+		/* 処理範囲, 共有段で初期背景画像の作成に使ったフレームを除いた後のもの */
+		mStartFrame = base.mStartFrame;
+		mEndFrame = base.mEndFrame;
+		/* end */
+
+		/* リソース, マスク画像は読み取りのみなのでヘッダのみ共有する */
+		mVideoWidth = base.mVideoWidth;
+		mVideoHeight = base.mVideoHeight;
+		mVideoFps = base.mVideoFps;
+		mRoadMaskGray = base.mRoadMaskGray;
+		mRoadMasksGray = base.mRoadMasksGray;
+		mRoadMasksNum = base.mRoadMasksNum;
+		mProcessRoi = base.mProcessRoi; // 共有段の背景差分画像をそのまま使うので, 処理範囲も合わせる
+		mAreRoadMasksDisjoint = base.mAreRoadMasksDisjoint;
+		mRoadCarsDirections = base.mRoadCarsDirections;
+		mBoundaryCarIdLists.resize(mRoadMasksNum);
+		mTemplatesList.resize(mRoadMasksNum);
+		mTemplatePositionsList.resize(mRoadMasksNum);
+		/* end */
+
+		/* パラメータ */
+		mDetectAreaInf = base.mDetectAreaInf;
+		mBackImgHandleParams = base.mBackImgHandleParams;
+		mExtractorParams = extractorParams;
+		mTracerParams = tracerParams;
+		mTemplateHandleParams = templateHandleParams;
+		/* end */
+	}
+
+	/// <summary>
+	/// リソース確認
+	/// </summary>
+	void PipelineContext::ShowResourcesAndParams()
+	{
+		std::cout << mStartFrame << std::endl;
+		std::cout << mEndFrame << std::endl;
+
+		//cv::imshow("", mRoadMaskGray);
+		//cv::waitKey(1000);
+	}
+
+	/// <summary>
+	/// 処理実行
+	/// </summary>
+	void PipelineContext::RunImageProcedure()
+	{
+		double tick = cv::getTickFrequency(); // 1秒あたりのフレーム数
+
+		CarsExtractor extractor(*this); // 抽出器
+		CarsTracer tracer(*this); // 検出器
+
+		StartFrameReader(); // 以降, デコードは先読みスレッドで行う
+		extractor.InitBackgroundImage();
+
+		/* 抽出と追跡を1フレームずらして重ねる. フレームN+1の抽出中にフレームNを追跡する */
+		// 抽出は背景モデルのみ, 追跡は追跡状態のみを更新するため, 各フレームのバッファを分ければ逐次実行と同じ結果になる
+		FrameData frameDatas[2];
+		size_t current = 0;
+		auto hasFrame = ExtractNextFrame(extractor, frameDatas[current]);
+
+		/* 抽出スレッド, フレームごとにスレッドを立てないよう1本を使い回し, 抽出するフレームバッファを受け渡す */
+		std::mutex extractMutex;
+		std::condition_variable extractCond; // 抽出の依頼・完了通知
+		FrameData* extractTargetPtr = nullptr; // 抽出を依頼したフレームバッファ, 抽出を終えたらnullptrに戻す
+		bool isExtracted = false; // 依頼した抽出の結果
+		bool isExtractClosing = false;
+		std::thread extractWorker([&]()
+		{
+			std::unique_lock<std::mutex> lock(extractMutex);
+			while (true)
+			{
+				extractCond.wait(lock, [&] { return (extractTargetPtr != nullptr) || isExtractClosing; });
+				if (extractTargetPtr == nullptr)
+					break;
+
+				auto& refTarget = *extractTargetPtr;
+				lock.unlock();
+				const auto isSucceeded = ExtractNextFrame(extractor, refTarget);
+				lock.lock();
+				isExtracted = isSucceeded;
+				extractTargetPtr = nullptr;
+				extractCond.notify_all();
+			}
+		});
+		/* end */
+
+		while (hasFrame)
+		{
+			// 実行時間計測開始
+			auto startTime = cv::getTickCount();
+
+			auto& refFrameData = frameDatas[current];
+			auto& refNextFrameData = frameDatas[current ^ 1];
+
+			/* メイン処理 */
+			{
+				std::lock_guard<std::mutex> lock(extractMutex);
+				extractTargetPtr = &refNextFrameData; // 次フレームの車両抽出
+			}
+			extractCond.notify_all();
+			tracer.DetectCars(refFrameData); // 車両検出・追跡
+			/* end */
+
+			/* 結果出力 */
+			OutputTapPoint(TapPoint::RESULT, refFrameData.resultImg, refFrameData.frameCount);
+			TakeTrackSnapshot(refFrameData.frameCount);
+			ReleaseFrame(); // 追跡を終えたフレームを返却, 先に取り出した方から返却される
+			{
+				std::unique_lock<std::mutex> lock(extractMutex);
+				extractCond.wait(lock, [&] { return extractTargetPtr == nullptr; });
+				hasFrame = isExtracted;
+			}
+			/* end */
+
+			/* 実行時間計測 */
+			auto endTime = cv::getTickCount();
+			const auto elapsed = (double)(endTime - startTime) / tick;
+			if (mDetectionLogParams.enable)
+			{
+				mDetectionLogWriter.Append(refFrameData.records);
+				mDetectionLogWriter.Append(FrameRecord{ refFrameData.frameCount, elapsed, mCarsNum });
+			}
+			if (mDetectionLogParams.printFrameTimes)
+			{
+				std::ostringstream log; // 並列実行時に他のコンテキストの出力と混ざらないよう, まとめて1回で書き出す
+				log << refFrameData.frameCount << '\n' << elapsed << '\n';
+				std::cout << log.str() << std::flush;
+			}
+			/* end */
+
+			current ^= 1;
+		}
+		/* end */
+
+		{
+			std::lock_guard<std::mutex> lock(extractMutex);
+			isExtractClosing = true;
+		}
+		extractCond.notify_all();
+		extractWorker.join();
+
+		StopFrameReader();
+		SaveSnapshot(extractor.GetBackImgFixed()); // 次回の起動時はここから再開する
+		mVideoWriterPool.Close(); // 書き出し待ちのフレームをすべてエンコードしてから閉じる
+		mDetectionLogWriter.Close(); // 書き出し待ちのブロックをすべて書き込んでから閉じる
+	}
+
+	/// <summary>
+	/// デコード先読みスレッドを入力の種類に応じて開始. 0番フレームの次からmStartFrameの直前までは読み飛ばす
+	/// </summary>
+	void PipelineContext::StartFrameReader()
+	{
+		// 0番は初期背景の大きさを決めるためだけに読み, 1番からmStartFrameの直前までは読み飛ばす
+		// 初期背景画像の作成に使うフレームを別に読むときは, その範囲も読み飛ばす
+		const auto skipEnd = IsWarmupReadSeparately() ? mStartFrame + mBackImgHandleParams.warmupFrames : mStartFrame;
+		mFrameReader.SetSkipRange(1, skipEnd);
+		if (mInputParams.type == InputType::RAW)
+			mFrameReader.Start(mRawFrameSource, mFrameReaderParams);
+		else if (mFrameCache.IsOpened())
+			mFrameReader.Start(mFrameCache, mFrameReaderParams);
+		else
+			mFrameReader.Start(mVideoCapture, cv::Size(mVideoWidth, mVideoHeight), mFrameReaderParams);
+	}
+
+	/// <summary>
+	/// 初期背景画像の作成に使うフレームを, デコード先読みスレッドとは別に読むか
+	/// 生フレーム入力は読み直せず, スナップショットから再開するときは読まない
+	/// </summary>
+	/// <returns>メディアンで作成し, 入力を読み直せるならtrue</returns>
+	bool PipelineContext::IsWarmupReadSeparately() const
+	{
+		return (mBackImgHandleParams.warmupMode == WarmupMode::MEDIAN)
+			&& (mInputParams.type != InputType::RAW)
+			&& !mSnapshot.IsOpened();
+	}
+
+	/// <summary>
+	/// 指定したフレームをデコード先読みスレッドとは別に並列に読み込む
+	/// キャッシュが開いていればマップを直接参照し, なければ区間ごとに入力ビデオを開き直してデコードする
+	/// </summary>
+	/// <param name="frameCounts">読み込むフレーム番号, 昇順</param>
+	/// <param name="frames">読み込んだフレームの格納先, 読めなかったフレームは含まない</param>
+	void PipelineContext::ReadSampledFrames(const std::vector<uint64_t>& frameCounts, std::vector<Image>& frames)
+	{
+		frames.assign(frameCounts.size(), Image());
+
+		if (mFrameCache.IsOpened())
+		{
+			/* キャッシュは任意のフレームを直接参照できる. 先読みスレッドと同時に読んでも書き換えなければ問題ない */
+			for (size_t idx = 0; idx < frameCounts.size(); idx++)
+				mFrameCache.GetFrame(frameCounts[idx], frames[idx]);
+			/* end */
+		}
+		else
+		{
+			/* 連続した区間に分け, 区間ごとに入力ビデオを開き直して先頭へシークしデコードする */
+			// 共有スレッドプールはコンテキスト自体の実行に使われているので, ここで待つとデッドロックし得る. 区間ごとにスレッドを立てる
+			const auto tasksNum = std::min<size_t>(mThreadsNum, frameCounts.size());
+			std::vector<std::future<void>> decodes;
+			for (size_t taskIdx = 0; taskIdx < tasksNum; taskIdx++)
+			{
+				decodes.push_back(std::async(std::launch::async, [&, taskIdx]()
+				{
+					const auto begin = frameCounts.size() * taskIdx / tasksNum;
+					const auto end = frameCounts.size() * (taskIdx + 1) / tasksNum;
+					cv::VideoCapture capture(mInputPath);
+					if (!capture.isOpened())
+						return;
+
+					/* FrameReader::Seekと同じく, キーフレームシークは着地位置を確かめ, 合わなければ先頭から逐次読み飛ばす */
+					uint64_t position = 0;
+					if (mFrameReaderParams.seekMode == SeekMode::KEYFRAME)
+					{
+						if (FrameReader::SeekToFrame(capture, frameCounts[begin]))
+							position = frameCounts[begin];
+						else
+						{
+							capture.release(); // 位置が合わないストリームは開き直して先頭から数え直す
+							if (!capture.open(mInputPath))
+								return;
+						}
+					}
+					/* end */
+					for (auto idx = begin; idx < end; idx++)
+					{
+						for (; position < frameCounts[idx]; position++)
+							capture.grab(); // 抜き出さないフレームは色変換しない
+						if (!capture.read(frames[idx]))
+							break;
+						position++;
+					}
+				}));
+			}
+			for (auto& decode : decodes)
+				decode.get();
+			/* end */
+		}
+
+		frames.erase(std::remove_if(frames.begin(), frames.end(), [](const Image& frame) { return frame.empty(); }), frames.end());
+	}
+
+	/// <summary>
+	/// 処理範囲内の次のフレームを読み込み, 車両抽出まで行う
+	/// </summary>
+	/// <param name="extractor">抽出器</param>
+	/// <param name="frameData">フレームバッファ</param>
+	/// <returns>処理範囲の終わりかストリーム終端ならfalse</returns>
+	bool PipelineContext::ExtractNextFrame(CarsExtractor& extractor, FrameData& frameData)
+	{
+		/* ビデオフレーム読み込み, mStartFrame未満のフレームはデコード先読みスレッドと初期背景作成で消費済み */
+		if (!ReadFrame(frameData.frame))
+			return false;
+		frameData.frameCount = mFrameCount;
+
+		if (frameData.frameCount > mEndFrame)
+			return false;
+		/* end */
+
+		extractor.ExtractCars(frameData); // 車両抽出
+		return true;
+	}
+
+	/// <summary>
+	/// デコード先読みスレッドから次のフレームを取り出し, mFrameCountをそのフレーム番号にする
+	/// 取り出したフレームはReleaseFrame()を呼ぶまで有効
+	/// </summary>
+	/// <param name="frame">フレームの参照先</param>
+	/// <returns>ストリーム終端ならfalse, frameは空になる</returns>
+	bool PipelineContext::ReadFrame(Image& frame)
+	{
+		const auto isRead = mFrameReader.Acquire(frame, mFrameCount);
+		if (mFrameReader.TakeSeekFallback())
+		{
+			std::ostringstream log; // 並列実行時に他のコンテキストの出力と混ざらないよう, まとめて1回で書き出す
+			log << mInputPath << ": keyframe seek failed, fell back to grab" << '\n';
+			std::cout << log.str() << std::flush;
+		}
+		return isRead;
+	}
+
+	/// <summary>
+	/// 取り出し中のフレームのうち最も古いものをデコード先読みスレッドに返却
+	/// </summary>
+	void PipelineContext::ReleaseFrame()
+	{
+		mFrameReader.Release();
+	}
+
+	/// <summary>
+	/// 指定フレームでタップポイントを出力するか
+	/// </summary>
+	/// <param name="tap">タップポイント</param>
+	/// <param name="frameCount">フレーム番号</param>
+	/// <returns>有効かつ間引き対象でなければtrue</returns>
+	bool PipelineContext::IsTapPointActive(const TapPoint& tap, const uint64_t& frameCount) const
+	{
+		const auto& crefTapParams = mTapPointParams[static_cast<size_t>(tap)];
+		return crefTapParams.enable && (frameCount % crefTapParams.decimation == 0);
+	}
+
+	/// <summary>
+	/// タップポイントの画像を書き出す. 出力しないフレームでは何もしない
+	/// </summary>
+	/// <param name="tap">タップポイント</param>
+	/// <param name="img">出力画像</param>
+	/// <param name="frameCount">フレーム番号</param>
+	void PipelineContext::OutputTapPoint(const TapPoint& tap, const Image& img, const uint64_t& frameCount)
+	{
+		if (!IsTapPointActive(tap, frameCount))
+			return;
+
+		const auto& tapIdx = static_cast<size_t>(tap);
+		mVideoWriterPool.Submit(mTapWriterIds[tapIdx], img(mTapPointParams[tapIdx].roi)); // 切り出しは書き出しバッファへのコピーで行う
+	}
+
+	/// <summary>
+	/// 処理範囲の大きさのタップポイント画像を, フレーム全体の位置に戻して書き出す. 出力しないフレームでは何もしない
+	/// </summary>
+	/// <param name="tap">タップポイント</param>
+	/// <param name="roiImg">処理範囲の出力画像, 1チャンネル</param>
+	/// <param name="frameCount">フレーム番号</param>
+	void PipelineContext::OutputRoiTapPoint(const TapPoint& tap, const Image& roiImg, const uint64_t& frameCount)
+	{
+		if (!IsTapPointActive(tap, frameCount))
+			return;
+
+		// 呼び出しは車両抽出側のみで, 書き出しバッファへはSubmit()内でコピーされるので使い回せる
+		if (mTapCanvas.empty() || (mTapCanvas.type() != roiImg.type()))
+			mTapCanvas = Image::zeros(cv::Size(mVideoWidth, mVideoHeight), roiImg.type());
+		auto canvasRoi = mTapCanvas(mProcessRoi);
+		roiImg.copyTo(canvasRoi);
+		OutputTapPoint(tap, mTapCanvas, frameCount);
+	}
+
+	/// <summary>
+	/// 記録を要求されたフレームなら, 追跡中の全車両の位置とテンプレートを記録する
+	/// </summary>
+	/// <param name="frameCount">追跡を終えたフレームのフレーム番号</param>
+	void PipelineContext::TakeTrackSnapshot(const uint64_t& frameCount)
+	{
+		auto itr = mTrackSnapshots.find(frameCount);
+		if (itr == mTrackSnapshots.end())
+			return;
+
+		auto& refSnapshots = itr->second;
+		for (size_t roadIdx = 0; roadIdx < mRoadMasksNum; roadIdx++)
+		{
+			auto& refTemplates = mTemplatesList[roadIdx];
+			for (const auto& [carId, carPos] : mTemplatePositionsList[roadIdx])
+			{
+				// テンプレートは追跡中に拡大縮小で置き換わるのでクローンしておく
+				refSnapshots.push_back(TrackSnapshot{ roadIdx, carId, mCarFirstFrames[carId], carPos, refTemplates[carId].clone() });
+			}
+		}
+	}
+
+	/// <summary>
+	/// 記録した追跡状態を取得
+	/// </summary>
+	/// <param name="frameCount">フレーム番号</param>
+	/// <returns>追跡中だった車両群, 要求していないか処理しなかったフレームなら空</returns>
+	const std::vector<TrackSnapshot>& PipelineContext::GetTrackSnapshot(const uint64_t& frameCount) const
+	{
+		static const std::vector<TrackSnapshot> sEmpty;
+		const auto itr = mTrackSnapshots.find(frameCount);
+		return (itr == mTrackSnapshots.end()) ? sEmpty : itr->second;
+	}
+};
\ No newline at end of file
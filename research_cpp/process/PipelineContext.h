@@ -0,0 +1,342 @@
+#pragma once
+#include "ImgProc.h"
+#include "FrameReader.h"
+#include "VideoWriterPool.h"
+#include "DetectionLogWriter.h"
+#include "BackgroundSnapshot.h"
+
+#include <map>
+
+/// <summary>
+/// 1回の実行(1テストケース)分の状態をまとめたコンテキスト. 複数のコンテキストを並列に実行できる
+/// </summary>
+class ImgProc::PipelineContext
+{
+private:
+	// 入力ビデオキャプチャ
+	cv::VideoCapture mVideoCapture;
+	// 生フレーム入力, InputType::RAWのときmVideoCaptureの代わりに使う
+	RawFrameSource mRawFrameSource;
+	// デコード済みフレームのキャッシュ, 開いていればmVideoCaptureの代わりに使う
+	FrameCache mFrameCache;
+	// デコード先読みスレッド
+	FrameReader mFrameReader;
+	// 非同期エンコーダ
+	VideoWriterPool mVideoWriterPool;
+	// 背景モデルと道路マスクのスナップショット, 開いていれば初期背景画像の作成とマスク画像の読み込みを省く
+	BackgroundSnapshot mSnapshot;
+	// 検出ログの非同期書き出し
+	DetectionLogWriter mDetectionLogWriter;
+	// タップポイントごとの書き出し先ID, 無効なタップポイントは書き出し先を開かない
+	std::array<size_t, TAP_POINT_NUM> mTapWriterIds{};
+	// 入力ビデオの横幅
+	int mVideoWidth = 0;
+	// 入力ビデオの縦幅
+	int mVideoHeight = 0;
+	// 入力ビデオのフレームレート
+	double mVideoFps = 0.0;
+	// 背景画像, 最後に更新した背景モデルの8bit版
+	Image mBackImg;
+	// 道路マスク画像
+	Image mRoadMaskGray;
+	// 道路マスク画像(テンプレートマッチング)
+	std::vector<Image> mRoadMasksGray;
+	// 処理範囲, 車両抽出はこの範囲のみ行い, 座標は追跡と描画の時点でフレーム全体に戻す
+	cv::Rect mProcessRoi{};
+	// 処理範囲内で道路マスク画像どうしが重ならないか, 重ならなければ全車線をまとめてラベリングできる
+	bool mAreRoadMasksDisjoint = false;
+	// 処理範囲の大きさのタップポイント画像をフレーム全体に戻すバッファ, 処理範囲外は0のまま
+	Image mTapCanvas;
+	/* end */
+
+	/* テンプレート処理に用いる変数 */
+	// 抽出したテンプレートを保存, 車線ごとに保存
+	std::vector<std::unordered_map<uint64_t, Image>> mTemplatesList;
+	// テンプレートの抽出位置を保存, 車線ごとに保存
+	std::vector<std::unordered_map<uint64_t, cv::Rect2d>> mTemplatePositionsList;
+	// 車線ごとの車の移動方向を保存
+	std::unordered_map<size_t, RoadDirect> mRoadCarsDirections;
+	// 車線ごとに検出境界に最も近い(高さの大小)車両IDを保存
+	std::vector<std::unordered_set<uint64_t>> mBoundaryCarIdLists;
+	/* end */
+
+	/* ファイルパス関連 */
+	// mRoadMasksのsize数
+	size_t mRoadMasksNum = 0;
+	/* end */
+
+	// 最後に読み込んだフレームのフレーム番号
+	uint64_t mFrameCount = 0;
+	// 初期フレーム
+	uint64_t mStartFrame = 0;
+	// 終了フレーム
+	uint64_t mEndFrame = 0;
+	// 全フレーム中の検出・追跡中車両台数
+	uint64_t mCarsNum = 0;
+	// 全フレーム中の検出・追跡中車両台数(前フレームのもの)
+	uint64_t mCarsNumPrev = 0;
+	// 現在のフレーム中の車両台数
+	uint64_t mFrameCarsNum = 0;
+	// 検出車両のうち, もっとも最初に検出した車両のID
+	uint64_t mFrontCarId = 0;
+
+	/* パラメータ構造体 */
+	DetectAreaInf mDetectAreaInf{}; // 検出範囲
+	ExtractorParams mExtractorParams{}; // 車両抽出パラメータ
+	TracerParams mTracerParams{}; // 車両追跡パラメータ
+	TemplateHandleParams mTemplateHandleParams{}; // テンプレート操作パラメータ
+	BackImgHandleParams mBackImgHandleParams{}; // 背景処理パラメータ
+	InputParams mInputParams{}; // 入力パラメータ
+	FrameReaderParams mFrameReaderParams{}; // フレーム読み込みパラメータ
+	VideoWriterParams mVideoWriterParams{}; // 動画書き出しパラメータ
+	DetectionLogParams mDetectionLogParams{}; // 検出ログパラメータ
+	SnapshotParams mSnapshotParams{}; // スナップショットパラメータ
+	std::array<TapPointParams, TAP_POINT_NUM> mTapPointParams{}; // タップポイントごとの出力設定
+	/* end */
+
+	std::string mInputPath; // 入力ビデオパス, 初期背景画像の作成に使うフレームを別に読むときに開き直す
+	std::string mOutputBasePath; // 出力動画のベースパス
+	std::string mRoadMaskPath; // マスク画像(全体)パス, スナップショットの古さの確認に使う
+	std::string mRoadMasksBasePath; // 道路マスク画像ベースパス, スナップショットの古さの確認に使う
+	int mTestCaseNum = 0; // テストケース番号(0始まり)
+	bool mIsSweepBase = false; // パラメータ探索の共有段か, 動画と検出ログを出力しない
+	size_t mThreadsNum = 1; // このコンテキストが内部の並列処理に使うスレッド数, 同時に実行するコンテキストで共有スレッドプールを分け合う
+
+	/* 時間方向の分割処理 */
+	// このコンテキストが処理するチャンク, 分割しないときはshardsNumが1
+	ShardRange mShard{};
+	// 車両IDごとの初検出フレーム, 添え字が車両ID
+	std::vector<uint64_t> mCarFirstFrames;
+	// 記録を要求されたフレームごとの追跡状態
+	std::map<uint64_t, std::vector<TrackSnapshot>> mTrackSnapshots;
+	/* end */
+
+private:
+	/// <summary>
+	/// ビデオリソース読み込み・書き出し設定
+	/// </summary>
+	/// <param name="inputPath">入力ビデオパス, 生フレーム入力では"-"(標準入力)か名前付きパイプのパス</param>
+	/// <param name="outputBasePath">出力ベースパス</param>
+	void CreateVideoResource(const std::string& inputPath, const std::string& outputBasePath);
+
+	/// <summary>
+	/// タップポイントの出力設定を読み込む
+	/// </summary>
+	/// <param name="tapPoints">"TapPoints"ノード</param>
+	void SetTapPointParams(const cv::FileNode& tapPoints);
+
+	/// <summary>
+	/// マスク画像等読み込み
+	/// </summary>
+	/// <param name="roadMaskPath">マスク画像（全体）パス</param>
+	/// <param name="roadMasksBasePath">道路マスク画像ベースパス</param>
+	void CreateImageResource(const std::string& roadMaskPath, const std::string& roadMasksBasePath);
+
+	/// <summary>
+	/// 処理範囲を決める. 道路マスクの外接矩形の和を, 検出範囲に検出・テンプレートの余白を加えた帯で切り取る
+	/// あわせて処理範囲内で道路マスク画像が重なっていないかを調べる
+	/// </summary>
+	void SetProcessRoi();
+
+	/// <summary>
+	/// 背景モデルと道路マスクのスナップショットを書き出す. スナップショットが無効なら何もしない
+	/// </summary>
+	/// <param name="backImgFixed">背景モデル, CV_16UC3(Q8.8)</param>
+	void SaveSnapshot(const Image& backImgFixed);
+
+	/// <summary>
+	/// 車線ごとの車の移動方向を設定
+	/// </summary>
+	/// <param name="directions">"L"か"R"が格納された配列</param>
+	void SetRoadCarsDirections(const std::vector<std::string>& directions);
+
+	/// <summary>
+	/// リソース画像表示
+	/// </summary>
+	/// <param name="interval">待機時間[ms]</param>
+	void ShowResourceImgs(const int& interval);
+
+	/// <summary>
+	/// 処理範囲内の次のフレームを読み込み, 車両抽出まで行う
+	/// </summary>
+	/// <param name="extractor">抽出器</param>
+	/// <param name="frameData">フレームバッファ</param>
+	/// <returns>処理範囲の終わりかストリーム終端ならfalse</returns>
+	bool ExtractNextFrame(CarsExtractor& extractor, FrameData& frameData);
+
+	/// <summary>
+	/// 記録を要求されたフレームなら, 追跡中の全車両の位置とテンプレートを記録する
+	/// </summary>
+	/// <param name="frameCount">追跡を終えたフレームのフレーム番号</param>
+	void TakeTrackSnapshot(const uint64_t& frameCount);
+
+	PipelineContext(const PipelineContext& other) = delete;
+
+public:
+	PipelineContext() = default;
+
+	/// <summary>
+	/// 時間方向に分割したときの処理範囲を設定, SetResourcesAndParams()より前に呼ぶ
+	/// </summary>
+	/// <param name="shard">チャンクの処理範囲</param>
+	void SetShard(const ShardRange& shard) { mShard = shard; }
+
+	/// <summary>
+	/// パラメータ探索の共有段(入力と背景差分)として使う. 動画と検出ログを出力しない, SetResourcesAndParams()より前に呼ぶ
+	/// </summary>
+	void SetSweepBase() { mIsSweepBase = true; }
+
+	/// <summary>
+	/// 内部の並列処理に使うスレッド数を設定. OpenCV全体の並列数はプロセスで1回だけ設定し, コンテキストごとの配分はこちらで行う
+	/// </summary>
+	/// <param name="threadsNum">スレッド数, 0なら1とする</param>
+	void SetThreadsNum(const size_t& threadsNum) { mThreadsNum = std::max<size_t>(threadsNum, 1); }
+
+	/// <summary>
+	/// パラメータ探索の1パラメータ組として, 共有段のコンテキストからリソースと処理範囲を引き継ぐ
+	/// 入力は開かず, 動画と検出ログも出力しない. 共有段の初期背景画像の作成後に呼ぶ
+	/// </summary>
+	/// <param name="base">共有段のコンテキスト</param>
+	/// <param name="extractorParams">車両抽出パラメータ</param>
+	/// <param name="tracerParams">車両追跡パラメータ</param>
+	/// <param name="templateHandleParams">テンプレート操作パラメータ</param>
+	void SetSweepVariant(const PipelineContext& base, const ExtractorParams& extractorParams,
+		const TracerParams& tracerParams, const TemplateHandleParams& templateHandleParams);
+
+	/// <summary>
+	/// 指定フレームの追跡終了後に追跡状態を記録するよう要求する, RunImageProcedure()より前に呼ぶ
+	/// </summary>
+	/// <param name="frameCount">フレーム番号</param>
+	void RequestTrackSnapshot(const uint64_t& frameCount) { mTrackSnapshots[frameCount]; }
+
+	/// <summary>
+	/// 記録した追跡状態を取得
+	/// </summary>
+	/// <param name="frameCount">フレーム番号</param>
+	/// <returns>追跡中だった車両群, 要求していないか処理しなかったフレームなら空</returns>
+	const std::vector<TrackSnapshot>& GetTrackSnapshot(const uint64_t& frameCount) const;
+
+	/// <summary>
+	/// リソース読み込み
+	/// </summary>
+	/// <param name="root">テストケースパラメータハッシュ</param>
+	/// <param name="testCaseNum">テストケース番号(0始まり)</param>
+	void SetResourcesAndParams(const cv::FileNode& root, const int& testCaseNum);
+
+	/// <summary>
+	/// リソース確認
+	/// </summary>
+	void ShowResourcesAndParams();
+
+	/// <summary>
+	/// 処理実行
+	/// </summary>
+	void RunImageProcedure();
+
+	/// <summary>
+	/// デコード先読みスレッドを入力の種類に応じて開始. 0番フレームの次からmStartFrameの直前までは読み飛ばす
+	/// </summary>
+	void StartFrameReader();
+
+	/// <summary>
+	/// デコード先読みスレッドを停止
+	/// </summary>
+	void StopFrameReader() { mFrameReader.Stop(); }
+
+	/// <summary>
+	/// 初期背景画像の作成に使うフレームを, デコード先読みスレッドとは別に読むか
+	/// 生フレーム入力は読み直せず, スナップショットから再開するときは読まない
+	/// </summary>
+	/// <returns>メディアンで作成し, 入力を読み直せるならtrue</returns>
+	bool IsWarmupReadSeparately() const;
+
+	/// <summary>
+	/// 指定したフレームをデコード先読みスレッドとは別に並列に読み込む
+	/// キャッシュが開いていればマップを直接参照し, なければ区間ごとに入力ビデオを開き直してデコードする
+	/// </summary>
+	/// <param name="frameCounts">読み込むフレーム番号, 昇順</param>
+	/// <param name="frames">読み込んだフレームの格納先, 読めなかったフレームは含まない</param>
+	void ReadSampledFrames(const std::vector<uint64_t>& frameCounts, std::vector<Image>& frames);
+
+	/// <summary>
+	/// デコード先読みスレッドから次のフレームを取り出し, mFrameCountをそのフレーム番号にする
+	/// 取り出したフレームはReleaseFrame()を呼ぶまで有効
+	/// </summary>
+	/// <param name="frame">フレームの参照先</param>
+	/// <returns>ストリーム終端ならfalse, frameは空になる</returns>
+	bool ReadFrame(Image& frame);
+
+	/// <summary>
+	/// 取り出し中のフレームのうち最も古いものをデコード先読みスレッドに返却
+	/// </summary>
+	void ReleaseFrame();
+
+	/// <summary>
+	/// 指定フレームでタップポイントを出力するか
+	/// </summary>
+	/// <param name="tap">タップポイント</param>
+	/// <param name="frameCount">フレーム番号</param>
+	/// <returns>有効かつ間引き対象でなければtrue</returns>
+	bool IsTapPointActive(const TapPoint& tap, const uint64_t& frameCount) const;
+
+	/// <summary>
+	/// タップポイントの画像を書き出す. 出力しないフレームでは何もしない
+	/// </summary>
+	/// <param name="tap">タップポイント</param>
+	/// <param name="img">出力画像</param>
+	/// <param name="frameCount">フレーム番号</param>
+	void OutputTapPoint(const TapPoint& tap, const Image& img, const uint64_t& frameCount);
+
+	/// <summary>
+	/// 処理範囲の大きさのタップポイント画像を, フレーム全体の位置に戻して書き出す. 出力しないフレームでは何もしない
+	/// </summary>
+	/// <param name="tap">タップポイント</param>
+	/// <param name="roiImg">処理範囲の出力画像, 1チャンネル</param>
+	/// <param name="frameCount">フレーム番号</param>
+	void OutputRoiTapPoint(const TapPoint& tap, const Image& roiImg, const uint64_t& frameCount);
+
+	/* セッタ・ゲッタ */
+	/* セッタ */
+	void SetCarsNum(const uint64_t& carsNum) { mCarsNum = carsNum; }
+	void SetCarsNumPrev(const uint64_t& carsNumPrev) { mCarsNumPrev = carsNumPrev; }
+	void SetFrameCarsNum(const uint64_t& frameCarsNum) { mFrameCarsNum = frameCarsNum; }
+	/* end */
+	/* ゲッタ */
+	VideoWriterPool& GetVideoWriterPool() { return mVideoWriterPool; }
+	std::pair<int, int> GetVideoWidAndHigh() { return std::make_pair(mVideoWidth, mVideoHeight); }
+	const double& GetVideoFps() { return mVideoFps; }
+	uint64_t& GetStartFrame() { return mStartFrame; }
+	uint64_t& GetEndFrame() { return mEndFrame; }
+	Image& GetBackImg() { return mBackImg; }
+	const size_t& GetRoadMasksNum() { return mRoadMasksNum; }
+	Image& GetRoadMaskGray() { return mRoadMaskGray; }
+	std::vector<Image>& GetRoadMasksGray() { return mRoadMasksGray; }
+	const cv::Rect& GetProcessRoi() const { return mProcessRoi; }
+	bool AreRoadMasksDisjoint() const { return mAreRoadMasksDisjoint; }
+	uint64_t& GetFrameCount() { return mFrameCount; }
+	uint64_t& GetFrontCarId() { return mFrontCarId; }
+	uint64_t& GetCarsNum() { return mCarsNum; }
+	uint64_t& GetFrameCarsNum() { return mFrameCarsNum; }
+	const uint64_t& GetCarsNumPrev() { return mCarsNumPrev; }
+	std::vector<std::unordered_map<uint64_t, Image>>& GetTemplatesList() { return mTemplatesList; }
+	std::vector<std::unordered_map<uint64_t, cv::Rect2d>>& GetTemplatePositionsList() { return mTemplatePositionsList; }
+	std::unordered_map<size_t, RoadDirect>& GetRoadCarsDirections() { return mRoadCarsDirections; }
+	std::vector<std::unordered_set<uint64_t>>& GetBoundaryCarIdLists() { return mBoundaryCarIdLists; }
+	const DetectAreaInf& GetDetectAreaInf() { return mDetectAreaInf; }
+	const ExtractorParams& GetExtractorParams() { return mExtractorParams; }
+	const TracerParams& GetTracerParams() { return mTracerParams; }
+	const TemplateHandleParams& GetTemplateHandleParams() { return mTemplateHandleParams; }
+	const BackImgHandleParams& GetBackImgHandleParams() { return mBackImgHandleParams; }
+	const InputParams& GetInputParams() { return mInputParams; }
+	const FrameReaderParams& GetFrameReaderParams() { return mFrameReaderParams; }
+	const VideoWriterParams& GetVideoWriterParams() { return mVideoWriterParams; }
+	const DetectionLogParams& GetDetectionLogParams() { return mDetectionLogParams; }
+	const BackgroundSnapshot& GetSnapshot() const { return mSnapshot; }
+	const std::string& GetOutputBasePath() { return mOutputBasePath; }
+	const int& GetTestCaseNum() { return mTestCaseNum; }
+	const ShardRange& GetShard() const { return mShard; }
+	const size_t& GetThreadsNum() const { return mThreadsNum; }
+	std::vector<uint64_t>& GetCarFirstFrames() { return mCarFirstFrames; }
+	/* end */
+	/* end */
+};
\ No newline at end of file
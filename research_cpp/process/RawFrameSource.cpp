@@ -0,0 +1,136 @@
+#include "RawFrameSource.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace ImgProc
+{
+	/// <summary>
+	/// 入力ストリームを開く
+	/// </summary>
+	/// <param name="path">入力パス, "-"なら標準入力</param>
+	/// <param name="format">画素形式</param>
+	/// <param name="frameSize">フレームサイズ, YUV420では縦横とも偶数</param>
+	/// <returns>開けなければfalse</returns>
+	bool RawFrameSource::Open(const std::string& path, const RawFormat& format, const cv::Size& frameSize)
+	{
+		Close();
+
+		/* ストリームを開く */
+		mIsStdin = (path == "-");
+		if (mIsStdin)
+		{
+#ifdef _WIN32
+			_setmode(_fileno(stdin), _O_BINARY); // 改行変換を止める
+#endif
+			mFile = stdin;
+		}
+		else
+			mFile = std::fopen(path.c_str(), "rb"); // 名前付きパイプも通常のファイルと同様に開ける
+
+		if (mFile == nullptr)
+			return false;
+		std::setvbuf(mFile, nullptr, _IONBF, 0); // stdioのバッファを経由させず, 読み込み先へ直接読ませる
+		/* end */
+
+		/* 受信バッファの確保 */
+		mFormat = format;
+		mFrameSize = frameSize;
+		if (mFormat == RawFormat::YUV420)
+		{
+			mRawBytes = static_cast<size_t>(frameSize.area()) * 3 / 2;
+			mRawBuffer = AllocateAligned(mRawBytes);
+			mRawImg = Image(frameSize.height * 3 / 2, frameSize.width, CV_8UC1, mRawBuffer.get());
+		}
+		else
+		{
+			mRawBytes = static_cast<size_t>(frameSize.area()) * 3;
+			mRawBuffer = AllocateAligned(mRawBytes);
+			mRawImg = Image(frameSize, CV_8UC3, mRawBuffer.get());
+		}
+		/* end */
+
+		return true;
+	}
+
+	/// <summary>
+	/// 入力ストリームを閉じる
+	/// </summary>
+	void RawFrameSource::Close()
+	{
+		if ((mFile != nullptr) && !mIsStdin)
+			std::fclose(mFile);
+		mFile = nullptr;
+	}
+
+	/// <summary>
+	/// BGRフレーム用のバッファをページ境界に揃えて確保し, コピーなしで包んだ画像を返す
+	/// </summary>
+	/// <param name="buffer">確保したバッファの所有先, 画像より長く保持する</param>
+	/// <returns>bufferを参照する連続なBGR画像</returns>
+	Image RawFrameSource::AllocateFrame(AlignedBuffer& buffer) const
+	{
+		buffer = AllocateAligned(static_cast<size_t>(mFrameSize.area()) * 3);
+		return Image(mFrameSize, CV_8UC3, buffer.get());
+	}
+
+	/// <summary>
+	/// 次のフレームを読み込む. BGR24はframeのバッファへ直接読み込み, YUV420は受信バッファからframeへ色変換する
+	/// </summary>
+	/// <param name="frame">AllocateFrame()で確保した画像</param>
+	/// <returns>ストリーム終端ならfalse</returns>
+	bool RawFrameSource::Read(Image& frame)
+	{
+		if (mFormat == RawFormat::BGR24)
+			return ReadFully(frame.data, mRawBytes);
+
+		if (!ReadFully(mRawBuffer.get(), mRawBytes))
+			return false;
+		cv::cvtColor(mRawImg, frame, cv::COLOR_YUV2BGR_I420); // 出力先のサイズ・型が同じなので再確保されず, frameのバッファに書き込まれる
+		return true;
+	}
+
+	/// <summary>
+	/// 次のフレームを読み捨てる. パイプはシークできないので, 読み飛ばしも読み込みで行う
+	/// </summary>
+	/// <returns>ストリーム終端ならfalse</returns>
+	bool RawFrameSource::Skip()
+	{
+		return ReadFully(mRawBuffer.get(), mRawBytes);
+	}
+
+	/// <summary>
+	/// ページ境界に揃えてバッファを確保
+	/// </summary>
+	/// <param name="bytes">バイト数</param>
+	/// <returns>確保したバッファ</returns>
+	RawFrameSource::AlignedBuffer RawFrameSource::AllocateAligned(const size_t& bytes)
+	{
+		const auto alignedBytes = (bytes + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE; // 末尾もページ単位に切り上げる
+		return AlignedBuffer(static_cast<uchar*>(::operator new[](alignedBytes, std::align_val_t(PAGE_SIZE))));
+	}
+
+	/// <summary>
+	/// 指定バイト数を読み切るまで読み込む. パイプは1回のfreadで要求量に満たないことがある
+	/// </summary>
+	/// <param name="dst">格納先</param>
+	/// <param name="bytes">バイト数</param>
+	/// <returns>途中で終端に達したらfalse</returns>
+	bool RawFrameSource::ReadFully(uchar* dst, const size_t& bytes)
+	{
+		if (mFile == nullptr)
+			return false;
+
+		size_t readBytes = 0;
+		while (readBytes < bytes)
+		{
+			const auto ret = std::fread(dst + readBytes, 1, bytes - readBytes, mFile);
+			if (ret == 0) // 終端かエラー
+				return false;
+			readBytes += ret;
+		}
+		return true;
+	}
+};
\ No newline at end of file
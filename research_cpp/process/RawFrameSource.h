@@ -0,0 +1,93 @@
+#pragma once
+#include "ImgProc.h"
+
+#include <cstdio>
+#include <memory>
+#include <new>
+
+/// <summary>
+/// 生フレーム入力
+/// 標準入力か名前付きパイプ(FIFO)から, コンテナなしの固定長BGR24・YUV420(I420)フレームを読み込む
+/// フレームはページ境界に揃えて事前確保したバッファへ直接読み込み, cv::Matはそのバッファをコピーなしで包む
+/// </summary>
+class ImgProc::RawFrameSource
+{
+public:
+	static constexpr size_t PAGE_SIZE = 4096; // バッファの境界
+
+	/// <summary>
+	/// ページ境界に揃えて確保したバッファの解放
+	/// </summary>
+	struct AlignedDeleter
+	{
+		void operator()(uchar* ptr) const { ::operator delete[](ptr, std::align_val_t(PAGE_SIZE)); }
+	};
+	using AlignedBuffer = std::unique_ptr<uchar[], AlignedDeleter>;
+
+private:
+	std::FILE* mFile = nullptr; // 入力ストリーム
+	bool mIsStdin = false; // 標準入力か, 標準入力は閉じない
+	RawFormat mFormat = RawFormat::BGR24; // 入力フレームの画素形式
+	cv::Size mFrameSize; // フレームサイズ
+	size_t mRawBytes = 0; // 入力フレーム1枚のバイト数
+	AlignedBuffer mRawBuffer; // YUV420の受信・読み飛ばし用バッファ
+	Image mRawImg; // mRawBufferを包むヘッダ, YUV420なら縦1.5倍の1チャンネル画像
+
+public:
+	RawFrameSource() = default;
+	~RawFrameSource() { Close(); }
+
+	/// <summary>
+	/// 入力ストリームを開く
+	/// </summary>
+	/// <param name="path">入力パス, "-"なら標準入力</param>
+	/// <param name="format">画素形式</param>
+	/// <param name="frameSize">フレームサイズ, YUV420では縦横とも偶数</param>
+	/// <returns>開けなければfalse</returns>
+	bool Open(const std::string& path, const RawFormat& format, const cv::Size& frameSize);
+
+	/// <summary>
+	/// 入力ストリームを閉じる
+	/// </summary>
+	void Close();
+
+	/// <summary>
+	/// BGRフレーム用のバッファをページ境界に揃えて確保し, コピーなしで包んだ画像を返す
+	/// </summary>
+	/// <param name="buffer">確保したバッファの所有先, 画像より長く保持する</param>
+	/// <returns>bufferを参照する連続なBGR画像</returns>
+	Image AllocateFrame(AlignedBuffer& buffer) const;
+
+	/// <summary>
+	/// 次のフレームを読み込む. BGR24はframeのバッファへ直接読み込み, YUV420は受信バッファからframeへ色変換する
+	/// </summary>
+	/// <param name="frame">AllocateFrame()で確保した画像</param>
+	/// <returns>ストリーム終端ならfalse</returns>
+	bool Read(Image& frame);
+
+	/// <summary>
+	/// 次のフレームを読み捨てる. パイプはシークできないので, 読み飛ばしも読み込みで行う
+	/// </summary>
+	/// <returns>ストリーム終端ならfalse</returns>
+	bool Skip();
+
+	const cv::Size& GetFrameSize() const { return mFrameSize; }
+
+private:
+	RawFrameSource(const RawFrameSource& other) = delete;
+
+	/// <summary>
+	/// ページ境界に揃えてバッファを確保
+	/// </summary>
+	/// <param name="bytes">バイト数</param>
+	/// <returns>確保したバッファ</returns>
+	static AlignedBuffer AllocateAligned(const size_t& bytes);
+
+	/// <summary>
+	/// 指定バイト数を読み切るまで読み込む. パイプは1回のfreadで要求量に満たないことがある
+	/// </summary>
+	/// <param name="dst">格納先</param>
+	/// <param name="bytes">バイト数</param>
+	/// <returns>途中で終端に達したらfalse</returns>
+	bool ReadFully(uchar* dst, const size_t& bytes);
+};
\ No newline at end of file
@@ -0,0 +1,211 @@
+#include "ShardStitcher.h"
+#include "PipelineContext.h"
+
+namespace ImgProc
+{
+	/// <summary>
+	/// チャンクごとの車両台数を統合して出力
+	/// </summary>
+	/// <param name="shards">1テストケース分のコンテキスト群, チャンク番号順</param>
+	/// <returns>統合後の車両台数</returns>
+	uint64_t ShardStitcher::Stitch(const std::vector<PipelineContext*>& shards)
+	{
+		uint64_t carsNum = 0; // 統合後の車両台数
+		uint64_t unresolvedNum = 0; // 照合できず補正しなかった車両数, 逐次実行の台数との差はこの範囲に収まる
+
+		for (const auto& shard : shards)
+			carsNum += CountOwnedCars(*shard);
+
+		/* チャンク境界ごとの補正 */
+		for (size_t shardIdx = 0; shardIdx + 1 < shards.size(); shardIdx++)
+		{
+			auto& refTail = *shards[shardIdx]; // 境界の前のチャンク
+			auto& refHead = *shards[shardIdx + 1]; // 境界の後のチャンク
+			const auto& crefBoundary = refTail.GetShard().ownedEnd; // 前のチャンクが担当する最後のフレーム
+			const auto& crefOverlapEnd = refTail.GetShard().processEnd; // 前のチャンクが重ねて処理する最後のフレーム
+
+			const auto& crefTailAtBoundary = refTail.GetTrackSnapshot(crefBoundary);
+			const auto& crefHeadAtBoundary = refHead.GetTrackSnapshot(crefBoundary);
+
+			/* 境界フレームで両チャンクが追跡していた車両を対応付ける */
+			std::vector<bool> isTailMatched(crefTailAtBoundary.size(), false);
+			std::set<uint64_t> headMatchedIds;
+			for (size_t idx = 0; idx < crefTailAtBoundary.size(); idx++)
+				isTailMatched[idx] = FindSameCar(crefTailAtBoundary[idx], crefHeadAtBoundary, headMatchedIds, 0, refTail);
+			/* end */
+
+			/* 後のチャンクが追跡していなかった車両, 境界後に新規車両として数えていれば二重計上なので差し引く */
+			// 重なりの間に追跡を終えた車両は, 追跡を終えたフレームの追跡状態で照合する
+			std::set<uint64_t> headLaterUsedIds;
+			for (size_t idx = 0; idx < crefTailAtBoundary.size(); idx++)
+			{
+				if (isTailMatched[idx])
+					continue;
+
+				uint64_t lastFrame = 0;
+				const auto laterPtr = FindLastTrack(refTail, crefTailAtBoundary[idx].carId, crefBoundary, crefOverlapEnd, lastFrame);
+				if ((laterPtr != nullptr)
+					&& FindSameCar(*laterPtr, refHead.GetTrackSnapshot(lastFrame), headLaterUsedIds, crefBoundary, refTail) && carsNum > 0)
+					carsNum--;
+				else
+					unresolvedNum++;
+			}
+			/* end */
+
+			/* 前のチャンクが追跡していなかった車両, 逐次実行なら境界後に新規車両として数えるはずなので足す */
+			std::set<uint64_t> tailLaterUsedIds;
+			for (size_t idx = 0; idx < crefHeadAtBoundary.size(); idx++)
+			{
+				if (headMatchedIds.count(crefHeadAtBoundary[idx].carId) > 0)
+					continue;
+
+				uint64_t lastFrame = 0;
+				const auto laterPtr = FindLastTrack(refHead, crefHeadAtBoundary[idx].carId, crefBoundary, crefOverlapEnd, lastFrame);
+				if ((laterPtr != nullptr)
+					&& FindSameCar(*laterPtr, refTail.GetTrackSnapshot(lastFrame), tailLaterUsedIds, crefBoundary, refTail))
+					carsNum++;
+				else
+					unresolvedNum++;
+			}
+			/* end */
+		}
+		/* end */
+
+		std::cout << "TestCase " << shards.front()->GetTestCaseNum() + 1 << ": " << carsNum << " cars (+-" << unresolvedNum
+			<< ", " << shards.size() << " shards)" << std::endl;
+		return carsNum;
+	}
+
+	/// <summary>
+	/// チャンクが台数に数える車両, 初検出フレームがチャンクの担当範囲内にある車両の数
+	/// </summary>
+	/// <param name="shard">チャンクのコンテキスト</param>
+	/// <returns>車両台数</returns>
+	uint64_t ShardStitcher::CountOwnedCars(PipelineContext& shard)
+	{
+		const auto& crefShard = shard.GetShard();
+		uint64_t ownedNum = 0;
+		for (const auto& firstFrame : shard.GetCarFirstFrames())
+		{
+			if (crefShard.ownedBegin <= firstFrame && firstFrame <= crefShard.ownedEnd)
+				ownedNum++;
+		}
+		return ownedNum;
+	}
+
+	/// <summary>
+	/// 同じフレームの2つの追跡状態が同じ車両か判定
+	/// 車線が同じで, 左上か右下の座標がnearOffset未満しか離れておらず, テンプレートの相関がminMatchingThr以上なら同じ車両とする
+	/// </summary>
+	/// <param name="lhs">追跡状態</param>
+	/// <param name="rhs">追跡状態</param>
+	/// <param name="nearOffset">座標の許容差</param>
+	/// <param name="minMatchingThr">テンプレートの相関の閾値</param>
+	/// <param name="score">テンプレートの相関の格納先</param>
+	/// <returns>同じ車両ならtrue</returns>
+	bool ShardStitcher::IsSameCar(const TrackSnapshot& lhs, const TrackSnapshot& rhs, const int& nearOffset, const double& minMatchingThr, double& score)
+	{
+		if (lhs.roadIdx != rhs.roadIdx)
+			return false;
+
+		/* 位置チェック, 新規検出判定(DoesntAddBoundCar)と同じ基準 */
+		const auto lhsBottom = lhs.position.br();
+		const auto rhsBottom = rhs.position.br();
+		const auto isNearTop = (std::abs(lhs.position.x - rhs.position.x) < nearOffset)
+			&& (std::abs(lhs.position.y - rhs.position.y) < nearOffset);
+		const auto isNearBottom = (std::abs(lhsBottom.x - rhsBottom.x) < nearOffset)
+			&& (std::abs(lhsBottom.y - rhsBottom.y) < nearOffset);
+		if (!isNearTop && !isNearBottom)
+			return false;
+		/* end */
+
+		/* 見た目チェック, 大きさをそろえてテンプレートの相関をとる */
+		if (lhs.templ.empty() || rhs.templ.empty())
+			return false;
+
+		Image resized, result;
+		cv::resize(rhs.templ, resized, lhs.templ.size());
+		cv::matchTemplate(lhs.templ, resized, result, cv::TM_CCOEFF_NORMED);
+		score = result.at<float>(0, 0);
+		/* end */
+
+		return score >= minMatchingThr;
+	}
+
+	/// <summary>
+	/// 候補の中から同じ車両とみなせるもののうち, 最もテンプレートの相関が高いものを探す
+	/// </summary>
+	/// <param name="target">探す車両</param>
+	/// <param name="candidates">候補群</param>
+	/// <param name="usedIds">照合済みの候補の車両ID, 見つかった候補を追加する</param>
+	/// <param name="detectedAfter">この値より後に初検出された候補のみ対象にする</param>
+	/// <param name="shard">閾値を参照するチャンクのコンテキスト</param>
+	/// <returns>見つかればtrue</returns>
+	bool ShardStitcher::FindSameCar(const TrackSnapshot& target, const std::vector<TrackSnapshot>& candidates, std::set<uint64_t>& usedIds,
+		const uint64_t& detectedAfter, PipelineContext& shard)
+	{
+		const auto& crefNearOffset = shard.GetDetectAreaInf().nearOffset;
+		const auto& crefMinMatchingThr = shard.GetTracerParams().minMatchingThr;
+
+		double bestScore = -1.0;
+		size_t bestIdx = candidates.size();
+		for (size_t idx = 0; idx < candidates.size(); idx++)
+		{
+			if ((usedIds.count(candidates[idx].carId) > 0) || candidates[idx].firstFrame <= detectedAfter)
+				continue;
+
+			double score = 0.0;
+			if (IsSameCar(target, candidates[idx], crefNearOffset, crefMinMatchingThr, score) && score > bestScore)
+			{
+				bestScore = score;
+				bestIdx = idx;
+			}
+		}
+
+		if (bestIdx == candidates.size())
+			return false;
+
+		usedIds.insert(candidates[bestIdx].carId);
+		return true;
+	}
+
+	/// <summary>
+	/// 境界フレームより後で, 重なりの最後のフレームまでのうち最後に車両を追跡していたフレームの追跡状態を探す
+	/// </summary>
+	/// <param name="shard">チャンクのコンテキスト</param>
+	/// <param name="carId">車両ID</param>
+	/// <param name="boundary">境界フレーム</param>
+	/// <param name="overlapEnd">重なりの最後のフレーム</param>
+	/// <param name="lastFrame">見つかったフレーム番号の格納先</param>
+	/// <returns>境界フレームより後に追跡していなければnullptr</returns>
+	const TrackSnapshot* ShardStitcher::FindLastTrack(const PipelineContext& shard, const uint64_t& carId, const uint64_t& boundary,
+		const uint64_t& overlapEnd, uint64_t& lastFrame)
+	{
+		for (auto frameCount = overlapEnd; frameCount > boundary; frameCount--)
+		{
+			const auto snapshotPtr = FindCarById(shard.GetTrackSnapshot(frameCount), carId);
+			if (snapshotPtr != nullptr)
+			{
+				lastFrame = frameCount;
+				return snapshotPtr;
+			}
+		}
+		return nullptr;
+	}
+
+	/// <summary>
+	/// 車両IDで追跡状態を探す
+	/// </summary>
+	/// <param name="snapshots">追跡状態群</param>
+	/// <param name="carId">車両ID</param>
+	/// <returns>見つからなければnullptr</returns>
+	const TrackSnapshot* ShardStitcher::FindCarById(const std::vector<TrackSnapshot>& snapshots, const uint64_t& carId)
+	{
+		for (const auto& snapshot : snapshots)
+		{
+			if (snapshot.carId == carId)
+				return &snapshot;
+		}
+		return nullptr;
+	}
+};
\ No newline at end of file
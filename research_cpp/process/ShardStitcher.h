@@ -0,0 +1,72 @@
+#pragma once
+#include "ImgProc.h"
+
+#include <set>
+
+/// <summary>
+/// 時間方向に分割して処理した1テストケースの車両台数を統合する
+/// 隣接チャンクが重ねて処理したフレームの追跡状態(位置とテンプレート)を照合し, 境界をまたぐ車両の二重計上・計上漏れを補正する
+/// </summary>
+class ImgProc::ShardStitcher
+{
+	ShardStitcher() = delete; //staticクラスなので
+public:
+	/// <summary>
+	/// チャンクごとの車両台数を統合して出力
+	/// </summary>
+	/// <param name="shards">1テストケース分のコンテキスト群, チャンク番号順</param>
+	/// <returns>統合後の車両台数</returns>
+	static uint64_t Stitch(const std::vector<PipelineContext*>& shards);
+
+private:
+	/// <summary>
+	/// チャンクが台数に数える車両, 初検出フレームがチャンクの担当範囲内にある車両の数
+	/// </summary>
+	/// <param name="shard">チャンクのコンテキスト</param>
+	/// <returns>車両台数</returns>
+	static uint64_t CountOwnedCars(PipelineContext& shard);
+
+	/// <summary>
+	/// 同じフレームの2つの追跡状態が同じ車両か判定
+	/// 車線が同じで, 左上か右下の座標がnearOffset未満しか離れておらず, テンプレートの相関がminMatchingThr以上なら同じ車両とする
+	/// </summary>
+	/// <param name="lhs">追跡状態</param>
+	/// <param name="rhs">追跡状態</param>
+	/// <param name="nearOffset">座標の許容差</param>
+	/// <param name="minMatchingThr">テンプレートの相関の閾値</param>
+	/// <param name="score">テンプレートの相関の格納先</param>
+	/// <returns>同じ車両ならtrue</returns>
+	static bool IsSameCar(const TrackSnapshot& lhs, const TrackSnapshot& rhs, const int& nearOffset, const double& minMatchingThr, double& score);
+
+	/// <summary>
+	/// 候補の中から同じ車両とみなせるもののうち, 最もテンプレートの相関が高いものを探す
+	/// </summary>
+	/// <param name="target">探す車両</param>
+	/// <param name="candidates">候補群</param>
+	/// <param name="usedIds">照合済みの候補の車両ID, 見つかった候補を追加する</param>
+	/// <param name="detectedAfter">この値より後に初検出された候補のみ対象にする</param>
+	/// <param name="shard">閾値を参照するチャンクのコンテキスト</param>
+	/// <returns>見つかればtrue</returns>
+	static bool FindSameCar(const TrackSnapshot& target, const std::vector<TrackSnapshot>& candidates, std::set<uint64_t>& usedIds,
+		const uint64_t& detectedAfter, PipelineContext& shard);
+
+	/// <summary>
+	/// 境界フレームより後で, 重なりの最後のフレームまでのうち最後に車両を追跡していたフレームの追跡状態を探す
+	/// </summary>
+	/// <param name="shard">チャンクのコンテキスト</param>
+	/// <param name="carId">車両ID</param>
+	/// <param name="boundary">境界フレーム</param>
+	/// <param name="overlapEnd">重なりの最後のフレーム</param>
+	/// <param name="lastFrame">見つかったフレーム番号の格納先</param>
+	/// <returns>境界フレームより後に追跡していなければnullptr</returns>
+	static const TrackSnapshot* FindLastTrack(const PipelineContext& shard, const uint64_t& carId, const uint64_t& boundary,
+		const uint64_t& overlapEnd, uint64_t& lastFrame);
+
+	/// <summary>
+	/// 車両IDで追跡状態を探す
+	/// </summary>
+	/// <param name="snapshots">追跡状態群</param>
+	/// <param name="carId">車両ID</param>
+	/// <returns>見つからなければnullptr</returns>
+	static const TrackSnapshot* FindCarById(const std::vector<TrackSnapshot>& snapshots, const uint64_t& carId);
+};
\ No newline at end of file
@@ -2,20 +2,8 @@
 
 #include <opencv2/core/core_c.h>
 
-using Tk = ImgProc::ImgProcToolkit;
-
 namespace ImgProc
 {
-	/* スタティック変数 */
-	Image CarsTracer::TemplateHandle::mLabels; //ラベル画像
-	Image CarsTracer::TemplateHandle::mStats; //ラベリングにおける統計情報
-	Image CarsTracer::TemplateHandle::mCentroids; //ラベリングにおける中心点座標群
-	Image CarsTracer::TemplateHandle::mTemp1;
-	Image CarsTracer::TemplateHandle::mTemp2;
-	Image CarsTracer::TemplateHandle::mTemp3;
-	Image CarsTracer::TemplateHandle::mCloseKernel; // クロージングで使用するカーネル
-	/* end */
-
 	/// <summary>
 	/// 頻度値データを, 一行n列の1チャンネル(グレースケール)画像として考え, 極大値をもつインデックスを保存
 	/// </summary>
@@ -66,39 +54,75 @@ namespace ImgProc
 
 	/// <summary>
 	/// テンプレートマッチングの対象領域を制限する
+	/// 車両ごとに並列に呼ばれるので, 渡された車両以外の状態は書き換えない
 	/// </summary>
 	/// <param name="nearRect">制限区域矩形</param>
 	/// <param name="maskId">道路マスク番号</param>
-	/// <param name="carId">車両番号</param>
-	void CarsTracer::TemplateHandle::ExtractCarsNearestArea(cv::Rect2d& nearRect, const size_t& maskId, const uint64_t& carId)
+	/// <param name="refCache">車両ごとの状態, 拡大・縮小段の累積倍率を更新し, 必要な段がなければ作る. 運動モデルは読むだけ</param>
+	/// <param name="refCarTemplate">テンプレート, 累積倍率に最も近い段に差し替える</param>
+	/// <param name="refRect">車両位置, 大きさを更新する</param>
+	void CarsTracer::TemplateHandle::ExtractCarsNearestArea(cv::Rect2d& nearRect, const size_t& maskId, TrackCache& refCache, Image& refCarTemplate, cv::Rect2d& refRect) const
 	{
-		const auto& crefParams = Tk::GetTemplateHandleParams();
+		const auto& crefParams = mContext.GetTemplateHandleParams();
 		auto magni = crefParams.magni;
-		auto& refRect = Tk::GetTemplatePositionsList()[maskId][carId];
-		auto& refCarTemplate = Tk::GetTemplatesList()[maskId][carId];
-		const auto& crefRoadCarsDirection = Tk::GetRoadCarsDirections()[maskId];
+		const auto& crefRoadCarsDirection = mContext.GetRoadCarsDirections().at(maskId); // operator[]は並列に呼べない
 
 		/* 車両が遠ざかっていくとき */
 		if (crefRoadCarsDirection == RoadDirect::LEAVE)
 			magni = 1 / crefParams.magni; // 縮小するために逆数にする
 		/* end */
 
-		/* テンプレートの拡大・縮小処理と, 座標矩形の縦横の変更 */
+		/* 座標矩形の縦横の変更と, テンプレートの段の選択 */
+		auto& refBank = refCache.bank;
 		refRect.width *= magni;
 		refRect.height *= magni;
-		cv::resize(refCarTemplate, refCarTemplate, refRect.size());
+		refBank.scale *= magni;
+		const auto level = static_cast<int>(std::lround(std::log(refBank.scale) / std::log(crefParams.scaleStep)));
+		auto itr = refBank.levels.find(level);
+		if (itr == refBank.levels.end())
+		{
+			/* 初めて使う段なら抽出時のテンプレートから作る, 以降はこの段に留まる間は拡大・縮小しない */
+			Image levelImg;
+			if (level == 0)
+				levelImg = refBank.original;
+			else
+			{
+				const auto levelScale = std::pow(crefParams.scaleStep, level);
+				const cv::Size levelSize(std::max(static_cast<int>(std::lround(refBank.original.cols * levelScale)), 1), std::max(static_cast<int>(std::lround(refBank.original.rows * levelScale)), 1));
+				cv::resize(refBank.original, levelImg, levelSize);
+			}
+			itr = refBank.levels.emplace(level, levelImg).first;
+			/* end */
+		}
+		refCarTemplate = itr->second;
 		/* end */
 
 		/* テンプレートマッチングの対象領域の限定 */
+		/* 探索の中心と幅, 運動モデルが揃っていれば予測位置の周りを予測誤差に応じた幅だけ探す */
+		auto center = refRect.tl();
+		auto merginX = static_cast<double>(crefParams.mergin);
+		auto merginY = static_cast<double>(crefParams.mergin);
+		const auto& crefMotion = refCache.motion;
+		if ((crefParams.motionGain > 0.0) && (crefMotion.updatesNum >= 2))
+		{
+			const auto minMergin = static_cast<double>(std::min(crefParams.minMergin, crefParams.mergin));
+			center += crefMotion.velocity;
+			merginX = std::clamp(std::ceil(minMergin + crefMotion.error.x * 3.0), minMergin, merginX); // 誤差の3倍まで外れても捉える
+			merginY = std::clamp(std::ceil(minMergin + crefMotion.error.y * 3.0), minMergin, merginY);
+		}
+		const auto templWidth = std::max(refRect.width, static_cast<double>(refCarTemplate.cols)); // 段の大きさは車両位置とわずかに異なる
+		const auto templHeight = std::max(refRect.height, static_cast<double>(refCarTemplate.rows));
+		/* end */
+
 		/* 原点の設定 */
-		const auto& [crefVideoWidth, crefVideoHeight] = Tk::GetVideoWidAndHigh();
-		auto findRectX = std::round(std::clamp((refRect.x - crefParams.mergin), 0.0, static_cast<double>(crefVideoWidth)));
-		auto findRectY = std::round(std::clamp((refRect.y - crefParams.mergin), 0.0, static_cast<double>(crefVideoHeight)));
+		const auto& [crefVideoWidth, crefVideoHeight] = mContext.GetVideoWidAndHigh();
+		auto findRectX = std::round(std::clamp((center.x - merginX), 0.0, static_cast<double>(crefVideoWidth)));
+		auto findRectY = std::round(std::clamp((center.y - merginY), 0.0, static_cast<double>(crefVideoHeight)));
 		/* end */
 
 		/* 移動後に予想される到達地点の最大値を算出 */
-		auto findRectXR = std::round(std::clamp(findRectX + refRect.width + crefParams.mergin * 2.0, 0.0, static_cast<double>(crefVideoWidth)));
-		auto findRectYB = std::round(std::clamp(findRectY + refRect.height + crefParams.mergin * 2.0, 0.0, static_cast<double>(crefVideoHeight)));
+		auto findRectXR = std::round(std::clamp(findRectX + templWidth + merginX * 2.0, 0.0, static_cast<double>(crefVideoWidth)));
+		auto findRectYB = std::round(std::clamp(findRectY + templHeight + merginY * 2.0, 0.0, static_cast<double>(crefVideoHeight)));
 		/* end */
 
 		/* 最終的な探索領域の縦横の幅を算出 */
@@ -120,12 +144,13 @@ namespace ImgProc
 	/// </summary>
 	/// <param name="finCarPosList">ラベル座標を格納するために渡されたリストの参照</param>
 	/// <param name="carPos">テンプレートの絶対座標</param>
-	void CarsTracer::TemplateHandle::ReLabelingTemplate(std::vector<cv::Rect>& finCarPosList, const cv::Rect2d& carPos)
+	/// <param name="frameData">フレームバッファ</param>
+	void CarsTracer::TemplateHandle::ReLabelingTemplate(std::vector<cv::Rect>& finCarPosList, const cv::Rect2d& carPos, const FrameData& frameData)
 	{
-		const auto& crefFrame = Tk::GetFrame();
-		const auto& crefBackImg = Tk::GetBackImg();
-		const auto& crefParams = Tk::GetTemplateHandleParams();
-		const auto& crefDetectArea = Tk::GetDetectAreaInf();
+		const auto& crefFrame = frameData.frame;
+		const auto& crefBackImg = frameData.backImg;
+		const auto& crefParams = mContext.GetTemplateHandleParams();
+		const auto& crefDetectArea = mContext.GetDetectAreaInf();
 
 		mTemp3 = ExtractTemplate(crefFrame, carPos);
 		mTemp1 = ExtractTemplate(crefBackImg, carPos);
@@ -136,26 +161,21 @@ namespace ImgProc
 
 		//ラベリングによって求められるラベル数
 		auto labelNum = cv::connectedComponentsWithStats(mTemp3, mLabels, mStats, mCentroids, 8);
-		/* 各領域ごとの処理, 0番は背景 */
-		for (int label = 1; label < labelNum; label++)
-		{
-			/* 統計情報分割 */
-			auto statsPtr = mStats.ptr<int>(label);
-			auto& x = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_LEFT];
-			auto& y = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_TOP];
-			auto& width = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_WIDTH];
-			auto& height = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_HEIGHT];
-			auto& area = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_AREA];
-			/* end */
-
-			auto tAreaThr = (carPos.y - crefDetectArea.top) / 4 + crefParams.areaThr; // 位置に応じた面積の閾値
-			if (area < tAreaThr)
-				continue;
 
-			if (area < width * height * crefParams.minAreaRatio) // 外周や直線だけで面積を稼いでるラベルを除外
-				continue;
+		/* 面積で車両でない領域を除く, 0番は背景 */
+		auto tAreaThr = (carPos.y - crefDetectArea.top) / 4 + crefParams.areaThr; // 位置に応じた面積の閾値
+		mLabelFilter.Build(mStats, labelNum, [&](const LabelFilter::Stats& stats)
+		{
+			return (stats.area >= tAreaThr)
+				&& (stats.area >= stats.width * stats.height * crefParams.minAreaRatio); // 外周や直線だけで面積を稼いでるラベルを除外
+		});
+		/* end */
 
-			finCarPosList.push_back(cv::Rect(static_cast<int>(carPos.x) + x, static_cast<int>(carPos.y) + y, width, height));
+		/* 残った領域の外接矩形をフレーム全体の座標で格納 */
+		for (const auto& label : mLabelFilter.GetKeptLabels())
+		{
+			const auto stats = LabelFilter::ReadStats(mStats, label);
+			finCarPosList.push_back(cv::Rect(static_cast<int>(carPos.x) + stats.x, static_cast<int>(carPos.y) + stats.y, stats.width, stats.height));
 		}
 		/* end */
 	}
@@ -165,12 +185,13 @@ namespace ImgProc
 	/// </summary>
 	/// <param name="finCarPosList">ラベル座標を格納するために渡されたリストの参照</param>
 	/// <param name="carPos">テンプレートの絶対座標</param>
-	void CarsTracer::TemplateHandle::ReLabelingTemplateContours(std::vector<cv::Rect>& finCarPosList, const cv::Rect2d& carPos)
+	/// <param name="frameData">フレームバッファ</param>
+	void CarsTracer::TemplateHandle::ReLabelingTemplateContours(std::vector<cv::Rect>& finCarPosList, const cv::Rect2d& carPos, const FrameData& frameData)
 	{
-		const auto& crefFrame = Tk::GetFrame();
-		const auto& crefBackImg = Tk::GetBackImg();
-		const auto& crefParams = Tk::GetTemplateHandleParams();
-		const auto& crefDetectArea = Tk::GetDetectAreaInf();
+		const auto& crefFrame = frameData.frame;
+		const auto& crefBackImg = frameData.backImg;
+		const auto& crefParams = mContext.GetTemplateHandleParams();
+		const auto& crefDetectArea = mContext.GetDetectAreaInf();
 
 		mTemp3 = ExtractTemplate(crefFrame, carPos);
 		mTemp1 = ExtractTemplate(crefBackImg, carPos);
@@ -181,26 +202,21 @@ namespace ImgProc
 
 		//ラベリングによって求められるラベル数
 		auto labelNum = cv::connectedComponentsWithStats(mTemp3, mLabels, mStats, mCentroids, 8);
-		/* 各領域ごとの処理, 0番は背景 */
-		for (int label = 1; label < labelNum; label++)
-		{
-			/* 統計情報分割 */
-			auto statsPtr = mStats.ptr<int>(label);
-			auto& x = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_LEFT];
-			auto& y = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_TOP];
-			auto& width = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_WIDTH];
-			auto& height = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_HEIGHT];
-			auto& area = statsPtr[cv::ConnectedComponentsTypes::CC_STAT_AREA];
-			/* end */
-
-			auto tAreaThr = (carPos.y - crefDetectArea.top) / 4 + crefParams.areaThr; // 位置に応じた面積の閾値
-			if (area < tAreaThr)
-				continue;
 
-			if (area < width * height * crefParams.minAreaRatio) // 外周や直線だけで面積を稼いでるラベルを除外
-				continue;
+		/* 面積で車両でない領域を除く, 0番は背景 */
+		auto tAreaThr = (carPos.y - crefDetectArea.top) / 4 + crefParams.areaThr; // 位置に応じた面積の閾値
+		mLabelFilter.Build(mStats, labelNum, [&](const LabelFilter::Stats& stats)
+		{
+			return (stats.area >= tAreaThr)
+				&& (stats.area >= stats.width * stats.height * crefParams.minAreaRatio); // 外周や直線だけで面積を稼いでるラベルを除外
+		});
+		/* end */
 
-			finCarPosList.push_back(cv::Rect(static_cast<int>(carPos.x) + x, static_cast<int>(carPos.y) + y, width, height));
+		/* 残った領域の外接矩形をフレーム全体の座標で格納 */
+		for (const auto& label : mLabelFilter.GetKeptLabels())
+		{
+			const auto stats = LabelFilter::ReadStats(mStats, label);
+			finCarPosList.push_back(cv::Rect(static_cast<int>(carPos.x) + stats.x, static_cast<int>(carPos.y) + stats.y, stats.width, stats.height));
 		}
 		/* end */
 	}
@@ -249,7 +265,7 @@ namespace ImgProc
 		//	b.y = elem;
 		//	cv::line(output, a, b, cv::Scalar(0, 0, 255));
 		//}
-		//const std::string path = Tk::sTemplatesPathList[Tk::sVideoType] + "template_" + std::to_string(Tk::sCarsNum) + ".png";
+		//const std::string path = mContext.sTemplatesPathList[mContext.sVideoType] + "template_" + std::to_string(mContext.sCarsNum) + ".png";
 		//cv::imwrite(path, output);
 
 		return *yFreqs.rbegin(); // 縦方向は最下部のエッジがわかればよいので, 候補の一番最後の添え字が最下部のy座標
@@ -325,4 +341,4 @@ namespace ImgProc
 
 		return ret;
 	}
-};
+};
\ No newline at end of file
@@ -1,16 +1,19 @@
 #pragma once
 #include "CarsTracer.h"
+#include "PipelineContext.h"
 
 class ImgProc::CarsTracer::TemplateHandle
 {
 private:
-	static Image mLabels; //ラベル画像
-	static Image mStats; //ラベリングにおける統計情報
-	static Image mCentroids; //ラベリングにおける中心点座標群
-	static Image mTemp1;
-	static Image mTemp2;
-	static Image mTemp3;
-	static Image mCloseKernel; // クロージングで使用するカーネル
+	PipelineContext& mContext; // 実行コンテキスト
+	Image mLabels; //ラベル画像
+	Image mStats; //ラベリングにおける統計情報
+	Image mCentroids; //ラベリングにおける中心点座標群
+	LabelFilter mLabelFilter; // ラベルごとの取捨選択
+	Image mTemp1;
+	Image mTemp2;
+	Image mTemp3;
+	Image mCloseKernel; // クロージングで使用するカーネル
 private:
 	/// <summary>
 	/// 頻度値データを, 一行n列の1チャンネル(グレースケール)画像として考え, 極大値をもつインデックスを保存
@@ -19,28 +22,54 @@ private:
 	/// <param name="retData">取得したいデータを格納するコンテナの参照</param>
 	static void SplitLineByEdge(const Image& inputData, std::vector<int>& retData);
 
+	/// <summary>
+	/// クロージングカーネルを設定
+	/// </summary>
+	void MakeCloseKernel() 
+	{
+		const auto& size = mContext.GetTemplateHandleParams().kernelSize;
+		mCloseKernel = cv::getStructuringElement(cv::MORPH_CROSS, cv::Size(size, size));
+		auto matPtr = mCloseKernel.ptr<cv::Vec3b>(size / 2);
+		for (int i = 0; i < size; i++)
+		{
+			if (i == size / 2)
+				continue;
+			matPtr[0][i] = 0;
+		}
+	}
+
 public:
+	explicit TemplateHandle(PipelineContext& context) : mContext(context)
+	{
+		MakeCloseKernel();
+	}
+
 	/// <summary>
 	/// テンプレートマッチングの対象領域を制限する
+	/// 車両ごとに並列に呼ばれるので, 渡された車両以外の状態は書き換えない
 	/// </summary>
 	/// <param name="nearRect">制限区域矩形</param>
 	/// <param name="maskId">道路マスク番号</param>
-	/// <param name="carId">車両番号</param>
-	static void ExtractCarsNearestArea(cv::Rect2d& nearRect, const size_t& maskId, const uint64_t& carId);
+	/// <param name="refCache">車両ごとの状態, 拡大・縮小段の累積倍率を更新し, 必要な段がなければ作る. 運動モデルは読むだけ</param>
+	/// <param name="refCarTemplate">テンプレート, 累積倍率に最も近い段に差し替える</param>
+	/// <param name="refRect">車両位置, 大きさを更新する</param>
+	void ExtractCarsNearestArea(cv::Rect2d& nearRect, const size_t& maskId, TrackCache& refCache, Image& refCarTemplate, cv::Rect2d& refRect) const;
 
 	/// <summary>
 	/// テンプレートに対してもう一度ラベリングを行い, ラベルの左上座標を参照リストに入れる
 	/// </summary>
 	/// <param name="finCarPosList">ラベル座標を格納するために渡されたリストの参照</param>
 	/// <param name="carPos">テンプレートの絶対座標</param>
-	static void ReLabelingTemplate(std::vector<cv::Rect>& finCarPosList, const cv::Rect2d& carPos);
+	/// <param name="frameData">フレームバッファ</param>
+	void ReLabelingTemplate(std::vector<cv::Rect>& finCarPosList, const cv::Rect2d& carPos, const FrameData& frameData);
 
 	/// <summary>
 	/// テンプレートに対してもう一度ラベリングを行い, ラベルの左上座標を参照リストに入れる
 	/// </summary>
 	/// <param name="finCarPosList">ラベル座標を格納するために渡されたリストの参照</param>
 	/// <param name="carPos">テンプレートの絶対座標</param>
-	static void ReLabelingTemplateContours(std::vector<cv::Rect>& finCarPosList, const cv::Rect2d& carPos);
+	/// <param name="frameData">フレームバッファ</param>
+	void ReLabelingTemplateContours(std::vector<cv::Rect>& finCarPosList, const cv::Rect2d& carPos, const FrameData& frameData);
 
 	/// <summary>
 	/// 横方向の負エッジをy方向微分によって求め, 切りだすy座標を処理によって選択
@@ -57,21 +86,4 @@ public:
 	/// <param name="inputImg">入力テンプレート画像</param>
 	/// <returns>切りだすx座標二つを一組にして返す</returns>
 	static std::pair<int, int> ExtractAreaByEdgeV(const Image& inputImg);
-
-	/// <summary>
-	/// クロージングカーネルを設定
-	/// </summary>
-	static void MakeCloseKernel() 
-	{
-		const auto& size = ImgProcToolkit::GetTemplateHandleParams().kernelSize;
-		mCloseKernel = cv::getStructuringElement(cv::MORPH_CROSS, cv::Size(size, size));
-		auto matPtr = mCloseKernel.ptr<cv::Vec3b>(size / 2);
-		for (int i = 0; i < size; i++)
-		{
-			if (i == size / 2)
-				continue;
-			matPtr[0][i] = 0;
-		}
-	}
-};
-
+};
\ No newline at end of file
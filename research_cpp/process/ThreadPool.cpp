@@ -0,0 +1,53 @@
+#include "ThreadPool.h"
+
+namespace ImgProc
+{
+	/// <summary>
+	/// ワーカスレッドを開始
+	/// </summary>
+	/// <param name="threadsNum">ワーカスレッド数, 0ならハードウェアスレッド数</param>
+	ThreadPool::ThreadPool(size_t threadsNum)
+	{
+		if (threadsNum == 0)
+			threadsNum = std::max(std::thread::hardware_concurrency(), 1u);
+
+		mWorkers.reserve(threadsNum);
+		for (size_t i = 0; i < threadsNum; i++)
+			mWorkers.emplace_back(&ThreadPool::Work, this);
+	}
+
+	/// <summary>
+	/// キューに残ったタスクをすべて実行してからワーカスレッドを停止
+	/// </summary>
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mIsStopped = true;
+		}
+		mCond.notify_all();
+
+		for (auto& worker : mWorkers)
+			worker.join();
+	}
+
+	/// <summary>
+	/// ワーカスレッド本体
+	/// </summary>
+	void ThreadPool::Work()
+	{
+		while (true)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mCond.wait(lock, [this]() { return mIsStopped || !mTasks.empty(); });
+				if (mTasks.empty())
+					return; // 停止要求があり, 残りのタスクもない
+				task = std::move(mTasks.front());
+				mTasks.pop_front();
+			}
+			task();
+		}
+	}
+};
\ No newline at end of file
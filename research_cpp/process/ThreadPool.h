@@ -0,0 +1,67 @@
+#pragma once
+#include "ImgProc.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/// <summary>
+/// 共有スレッドプール
+/// 全ワーカスレッドが1本のタスクキューから取り出して実行する
+/// </summary>
+class ImgProc::ThreadPool
+{
+private:
+	std::vector<std::thread> mWorkers; // ワーカスレッド群
+	std::deque<std::function<void()>> mTasks; // 実行待ちタスク
+	std::mutex mMutex; // mTasks, mIsStopped の保護
+	std::condition_variable mCond; // タスク追加・停止要求の通知
+	bool mIsStopped = false; // 停止要求
+
+public:
+	/// <summary>
+	/// ワーカスレッドを開始
+	/// </summary>
+	/// <param name="threadsNum">ワーカスレッド数, 0ならハードウェアスレッド数</param>
+	explicit ThreadPool(size_t threadsNum = 0);
+
+	/// <summary>
+	/// キューに残ったタスクをすべて実行してからワーカスレッドを停止
+	/// </summary>
+	~ThreadPool();
+
+	/// <summary>
+	/// タスクをキューに積む
+	/// </summary>
+	/// <param name="task">実行する関数</param>
+	/// <returns>戻り値を受け取るfuture, タスク内の例外もここから再送出される</returns>
+	template<class F>
+	auto Submit(F&& task) -> std::future<std::invoke_result_t<F>>
+	{
+		using Result = std::invoke_result_t<F>;
+
+		// std::functionはコピー可能な関数しか持てないので, packaged_taskはshared_ptrで包む
+		auto packagedTask = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+		auto future = packagedTask->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mTasks.emplace_back([packagedTask]() { (*packagedTask)(); });
+		}
+		mCond.notify_one();
+		return future;
+	}
+
+	size_t GetThreadsNum() const { return mWorkers.size(); }
+
+private:
+	ThreadPool(const ThreadPool& other) = delete;
+
+	/// <summary>
+	/// ワーカスレッド本体
+	/// </summary>
+	void Work();
+};
\ No newline at end of file
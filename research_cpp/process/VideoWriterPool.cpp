@@ -0,0 +1,146 @@
+#include "VideoWriterPool.h"
+
+namespace ImgProc
+{
+	/// <summary>
+	/// キュー長とキュー満杯時の挙動を設定, Open()より前に呼ぶ
+	/// </summary>
+	/// <param name="params">書き出しパラメータ</param>
+	void VideoWriterPool::SetParams(const VideoWriterParams& params)
+	{
+		mQueueSize = static_cast<size_t>(std::max(params.queueSize, 1));
+		mBackpressure = params.backpressure;
+	}
+
+	/// <summary>
+	/// 書き出し先を開き, 専用のワーカスレッドを開始
+	/// </summary>
+	/// <param name="outputPath">出力パス</param>
+	/// <param name="fps">フレームレート</param>
+	/// <param name="frameSize">フレームサイズ</param>
+	/// <param name="isDebug">途中結果の出力か</param>
+	/// <returns>書き出し先ID</returns>
+	size_t VideoWriterPool::Open(const std::string& outputPath, const double& fps, const cv::Size& frameSize, const bool& isDebug)
+	{
+		auto fourcc = cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+		auto writer = std::make_unique<Writer>();
+
+		writer->videoWriter.open(outputPath, fourcc, fps, frameSize);
+		if (!writer->videoWriter.isOpened())
+		{
+			std::cout << outputPath << ": can't create or overwrite" << std::endl;
+			assert("failed to overwrite video");
+		}
+		writer->isDebug = isDebug;
+		writer->path = outputPath;
+		writer->worker = std::thread(&VideoWriterPool::Work, std::ref(*writer));
+
+		mWriters.push_back(std::move(writer));
+		return mWriters.size() - 1;
+	}
+
+	/// <summary>
+	/// フレームを書き出しキューに積む. 再利用バッファへコピーしてから戻るので, 呼び出し後に入力画像を書き換えてよい
+	/// 1チャンネル画像はワーカスレッド側でBGRに展開する
+	/// </summary>
+	/// <param name="writerId">書き出し先ID</param>
+	/// <param name="img">書き出すフレーム</param>
+	void VideoWriterPool::Submit(const size_t& writerId, const Image& img)
+	{
+		auto& refWriter = *mWriters[writerId];
+		std::unique_lock<std::mutex> lock(refWriter.mutex);
+
+		/* キュー満杯時の処理 */
+		if (refWriter.queue.size() >= mQueueSize)
+		{
+			if (refWriter.isDebug && (mBackpressure == WriterBackpressure::DROP_DEBUG))
+			{
+				refWriter.droppedCount++;
+				return;
+			}
+			refWriter.cond.wait(lock, [&] { return refWriter.queue.size() < mQueueSize; });
+		}
+		/* end */
+
+		/* 再利用バッファを取り出し, ロック外でコピー */
+		Image buffer;
+		if (!refWriter.freeBuffers.empty())
+		{
+			buffer = std::move(refWriter.freeBuffers.back());
+			refWriter.freeBuffers.pop_back();
+		}
+		lock.unlock();
+		img.copyTo(buffer); // サイズが同じなら再確保は起きない
+		/* end */
+
+		lock.lock();
+		refWriter.queue.push_back(std::move(buffer));
+		lock.unlock();
+		refWriter.cond.notify_all();
+	}
+
+	/// <summary>
+	/// キューに残ったフレームを全て書き出してから全ワーカスレッドを停止し, 書き出し先を閉じる
+	/// </summary>
+	void VideoWriterPool::Close()
+	{
+		for (auto& writer : mWriters)
+		{
+			{
+				std::lock_guard<std::mutex> lock(writer->mutex);
+				writer->isClosing = true;
+			}
+			writer->cond.notify_all();
+		}
+
+		for (auto& writer : mWriters)
+		{
+			writer->worker.join();
+			writer->videoWriter.release();
+			if (writer->droppedCount > 0)
+				std::cout << writer->path << ": dropped " << writer->droppedCount << " frames" << std::endl;
+		}
+		mWriters.clear();
+	}
+
+	/// <summary>
+	/// ワーカスレッド本体
+	/// </summary>
+	/// <param name="writer">担当する書き出し先</param>
+	void VideoWriterPool::Work(Writer& writer)
+	{
+		Image buffer, bgr;
+		while (true)
+		{
+			/* 書き出し待ちフレームを取り出す, 終了要求があってもキューが空になるまでは続ける */
+			{
+				std::unique_lock<std::mutex> lock(writer.mutex);
+				writer.cond.wait(lock, [&] { return !writer.queue.empty() || writer.isClosing; });
+				if (writer.queue.empty())
+					break;
+
+				buffer = std::move(writer.queue.front());
+				writer.queue.pop_front();
+			}
+			writer.cond.notify_all(); // 満杯待ちの処理スレッドを起こす
+			/* end */
+
+			/* 色展開とエンコード */
+			if (buffer.channels() == 1)
+			{
+				cv::cvtColor(buffer, bgr, cv::COLOR_GRAY2BGR);
+				writer.videoWriter << bgr;
+			}
+			else
+				writer.videoWriter << buffer;
+			/* end */
+
+			/* 書き出し済みバッファを返却 */
+			{
+				std::lock_guard<std::mutex> lock(writer.mutex);
+				writer.freeBuffers.push_back(std::move(buffer));
+			}
+			/* end */
+		}
+	}
+};
\ No newline at end of file
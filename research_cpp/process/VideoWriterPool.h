@@ -0,0 +1,79 @@
+#pragma once
+#include "ImgProc.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/// <summary>
+/// 非同期エンコーダ
+/// 書き出し先ごとに専用のワーカスレッドを持ち, 再利用するフレームバッファ経由で処理スレッドからフレームを受け取る
+/// </summary>
+class ImgProc::VideoWriterPool
+{
+private:
+	/// <summary>
+	/// 書き出し先1つ分の状態
+	/// </summary>
+	struct Writer
+	{
+		cv::VideoWriter videoWriter; // ビデオレコーダー, ワーカスレッドのみが触る
+		std::thread worker; // ワーカスレッド
+		std::mutex mutex; // queue, freeBuffers, isClosing の保護
+		std::condition_variable cond; // キューの状態変化通知
+		std::deque<Image> queue; // 書き出し待ちフレーム
+		std::vector<Image> freeBuffers; // 書き出し済みで再利用できるフレームバッファ
+		bool isDebug = false; // 途中結果の出力か, DROP_DEBUGのとき満杯なら捨てる対象
+		bool isClosing = false; // 終了要求
+		uint64_t droppedCount = 0; // 捨てたフレーム数
+		std::string path; // 出力パス
+	};
+
+	std::vector<std::unique_ptr<Writer>> mWriters; // 書き出し先群, 添え字が書き出し先ID
+	size_t mQueueSize = 4; // 書き出し先ごとのキュー長
+	WriterBackpressure mBackpressure = WriterBackpressure::BLOCK; // キュー満杯時の挙動
+
+public:
+	VideoWriterPool() = default;
+	~VideoWriterPool() { Close(); }
+
+	/// <summary>
+	/// キュー長とキュー満杯時の挙動を設定, Open()より前に呼ぶ
+	/// </summary>
+	/// <param name="params">書き出しパラメータ</param>
+	void SetParams(const VideoWriterParams& params);
+
+	/// <summary>
+	/// 書き出し先を開き, 専用のワーカスレッドを開始
+	/// </summary>
+	/// <param name="outputPath">出力パス</param>
+	/// <param name="fps">フレームレート</param>
+	/// <param name="frameSize">フレームサイズ</param>
+	/// <param name="isDebug">途中結果の出力か</param>
+	/// <returns>書き出し先ID</returns>
+	size_t Open(const std::string& outputPath, const double& fps, const cv::Size& frameSize, const bool& isDebug);
+
+	/// <summary>
+	/// フレームを書き出しキューに積む. 再利用バッファへコピーしてから戻るので, 呼び出し後に入力画像を書き換えてよい
+	/// 1チャンネル画像はワーカスレッド側でBGRに展開する
+	/// </summary>
+	/// <param name="writerId">書き出し先ID</param>
+	/// <param name="img">書き出すフレーム</param>
+	void Submit(const size_t& writerId, const Image& img);
+
+	/// <summary>
+	/// キューに残ったフレームを全て書き出してから全ワーカスレッドを停止し, 書き出し先を閉じる
+	/// </summary>
+	void Close();
+
+private:
+	VideoWriterPool(const VideoWriterPool& other) = delete;
+
+	/// <summary>
+	/// ワーカスレッド本体
+	/// </summary>
+	/// <param name="writer">担当する書き出し先</param>
+	static void Work(Writer& writer);
+};
\ No newline at end of file